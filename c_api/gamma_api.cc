@@ -17,6 +17,7 @@
 #include "gamma_api_generated.h"
 #include "gamma_engine.h"
 #include "log.h"
+#include "memory_policy.h"
 #include "utils.h"
 
 INITIALIZE_EASYLOGGINGPP
@@ -76,6 +77,7 @@ Config *MakeConfig(ByteArray *path, int max_doc_size) {
 enum ResponseCode DestroyConfig(Config *config) {
   if (config != nullptr) {
     DestroyByteArray(config->path);
+    DestroyByteArray(config->memory_policy);
     free(config);
   }
   return ResponseCode::SUCCESSED;
@@ -106,6 +108,15 @@ VectorInfo *MakeVectorInfo(ByteArray *name, enum DataType data_type,
   return vectorInfo;
 }
 
+enum ResponseCode SetVectorInfoRetrieval(VectorInfo *vector_info,
+                                         ByteArray *retrieval_type,
+                                         ByteArray *retrieval_param) {
+  if (vector_info == nullptr) return ResponseCode::FAILED;
+  vector_info->retrieval_type = retrieval_type;
+  vector_info->retrieval_param = retrieval_param;
+  return ResponseCode::SUCCESSED;
+}
+
 enum ResponseCode SetVectorInfo(VectorInfo **vector_infos, int idx,
                                 VectorInfo *vector_info) {
   vector_infos[idx] = vector_info;
@@ -117,6 +128,8 @@ enum ResponseCode DestroyVectorInfo(VectorInfo *vector_info) {
     DestroyByteArray(vector_info->name);
     DestroyByteArray(vector_info->model_id);
     DestroyByteArray(vector_info->store_type);
+    DestroyByteArray(vector_info->retrieval_type);
+    DestroyByteArray(vector_info->retrieval_param);
     free(vector_info);
   }
   return ResponseCode::SUCCESSED;
@@ -286,15 +299,33 @@ enum ResponseCode SetLogDictionary(ByteArray *log_dir) {
   return ResponseCode::SUCCESSED;
 }
 
+enum ResponseCode SetConfigMemoryPolicy(Config *config,
+                                        ByteArray *memory_policy) {
+  if (config == nullptr) return ResponseCode::FAILED;
+  config->memory_policy = memory_policy;
+  return ResponseCode::SUCCESSED;
+}
+
 void *Init(Config *config) {
   string path = string(config->path->value, config->path->len);
+  if (config->memory_policy) {
+    utils::MemoryPolicy policy;
+    string policy_str = string(config->memory_policy->value,
+                               config->memory_policy->len);
+    if (policy.Parse(policy_str.c_str())) {
+      LOG(ERROR) << "invalid memory policy: " << policy_str;
+      return nullptr;
+    }
+    utils::SetMemoryPolicy(policy);
+  }
   tig_gamma::GammaEngine *engine =
       tig_gamma::GammaEngine::GetInstance(path, config->max_doc_size);
   if (engine == nullptr) {
     LOG(ERROR) << "Engine init faild!";
     return nullptr;
   }
-  LOG(INFO) << "Engine init successed!";
+  LOG(INFO) << "Engine init successed! memory policy: "
+            << utils::MemoryPolicyReport();
   return static_cast<void *>(engine);
 }
 
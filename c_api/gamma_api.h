@@ -67,10 +67,12 @@ enum ResponseCode DestroyByteArrays(ByteArray **byte_arrays, int num);
 /** engine config
  * path : files dictionary, includes .idx, .fet, .str.prf, .prf, etc.
  * max_doc_size : max doc size, TODO maybe remove in future
+ * memory_policy : allocation policy of large arenas, json format, can be null
  */
 typedef struct Config {
   ByteArray *path;
   int max_doc_size;
+  ByteArray *memory_policy;
 } Config;
 
 /** make Config
@@ -88,6 +90,18 @@ Config *MakeConfig(ByteArray *path, int max_doc_size);
  */
 enum ResponseCode DestroyConfig(Config *config);
 
+/** set the allocation policy of large arenas, it is process wide and takes
+ * effect for the arenas allocated after Init
+ *
+ * @param config         Config pointer
+ * @param memory_policy  json format, eg. {"hugepage":"thp","numa":"interleave"}
+ *                       hugepage: "none", "thp", "hugetlb"
+ *                       numa: "none", "interleave", "local"
+ * @return ResponseCode
+ */
+enum ResponseCode SetConfigMemoryPolicy(Config *config,
+                                        ByteArray *memory_policy);
+
 /** data type
  */
 enum DataType { INT = 0, LONG, FLOAT, DOUBLE, STRING, VECTOR };
@@ -102,6 +116,10 @@ typedef struct VectorInfo {
   ByteArray *store_type;    // "Mmap", "RocksDB"
   ByteArray *store_param;   // parameters of store, json format
   BOOL has_source;
+  ByteArray *retrieval_type;   // retrieval model of this vector, null means
+                               // using the table's retrieval_type
+  ByteArray *retrieval_param;  // retrieval parameters of this vector, json
+                               // format, null means using the table's
 } VectorInfo;
 
 /** make vector infos array
@@ -125,6 +143,19 @@ VectorInfo *MakeVectorInfo(ByteArray *name, enum DataType data_type,
                            ByteArray *store_type, ByteArray *store_param,
                            BOOL has_source);
 
+/** set retrieval model and parameters of one vector field, it overrides
+ * the table's retrieval_type and retrieval_param for this field. Fields
+ * searched together in one request must have the same metric_type
+ *
+ * @param vector_info      VectorInfo pointer
+ * @param retrieval_type   "IVFPQ", "HNSW", "FLAT", "BINARYIVF", "GPU"
+ * @param retrieval_param  retrieval parameters, json format, can be null
+ * @return ResponseCode
+ */
+enum ResponseCode SetVectorInfoRetrieval(VectorInfo *vector_info,
+                                         ByteArray *retrieval_type,
+                                         ByteArray *retrieval_param);
+
 /** Setting VectorInfo content
  *
  * @param vector_infos    VectorInfo array head pointer
@@ -586,6 +617,8 @@ typedef struct Request {
                           // not rank; 1, has rank
   BOOL parallel_based_on_query;  // TRUE: parallelize over queries
                                  // FALSE: parallelize over inverted lists
+                                 // ivfpq splits the work itself and
+                                 // ignores it, except for small doc num
   BOOL l2_sqrt;
   int nprobe;  // just for ivfpq, how many lists will be visited at search time
   BOOL ivf_flat;  // just for ivfpq, ivf flat means no quantization of vector
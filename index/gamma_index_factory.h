@@ -18,12 +18,38 @@
 #include "faiss/IndexFlat.h"
 #include "gamma_index_flat.h"
 #include "gamma_index_hnsw.h"
+#include "float16_raw_vector.h"
 #include "mmap_raw_vector.h"
 #include "raw_vector.h"
 
 namespace tig_gamma {
 class GammaIndexFactory {
  public:
+  /** parse retrieval model name, such as "IVFPQ", "HNSW"
+   *
+   * @param retrieval_type retrieval model name, case insensitive
+   * @param model(output) retrieval model
+   * @return 0 if successed
+   */
+  static int ParseModel(const std::string &retrieval_type,
+                        RetrievalModel &model) {
+    if (!strcasecmp("IVFPQ", retrieval_type.c_str())) {
+      model = RetrievalModel::IVFPQ;
+    } else if (!strcasecmp("GPU", retrieval_type.c_str())) {
+      model = RetrievalModel::GPU_IVFPQ;
+    } else if (!strcasecmp("BINARYIVF", retrieval_type.c_str())) {
+      model = RetrievalModel::BINARYIVF;
+    } else if (!strcasecmp("HNSW", retrieval_type.c_str())) {
+      model = RetrievalModel::HNSW;
+    } else if (!strcasecmp("FLAT", retrieval_type.c_str())) {
+      model = RetrievalModel::FLAT;
+    } else {
+      LOG(ERROR) << "NO support for retrieval type " << retrieval_type;
+      return -1;
+    }
+    return 0;
+  }
+
   static GammaIndex *Create(RetrievalModel model, size_t dimension,
                             const char *docids_bitmap,
                             RawVector<float> *raw_vec,
@@ -53,12 +79,36 @@ class GammaIndexFactory {
                     << dimension << "]";
         }
 
-        faiss::IndexFlatL2 *coarse_quantizer =
-            new faiss::IndexFlatL2(dimension);
-        GammaIndex *gamma_index = new GammaIVFPQIndex(
+        faiss::Index *coarse_quantizer = nullptr;
+        if (ivfpq_param->hnsw_quantizer) {
+          // flat scan of every centroid is too slow for large ncentroids
+          faiss::IndexHNSWFlat *hnsw_quantizer = new faiss::IndexHNSWFlat(
+              dimension, ivfpq_param->quantizer_nlinks);
+          hnsw_quantizer->hnsw.efSearch = ivfpq_param->quantizer_efSearch;
+          hnsw_quantizer->hnsw.efConstruction =
+              ivfpq_param->quantizer_efConstruction;
+          coarse_quantizer = hnsw_quantizer;
+        } else {
+          coarse_quantizer = new faiss::IndexFlatL2(dimension);
+        }
+        GammaIVFPQIndex *gamma_index = new GammaIVFPQIndex(
             coarse_quantizer, dimension, ivfpq_param->ncentroids,
             ivfpq_param->nsubvector, ivfpq_param->nbits_per_idx, docids_bitmap,
             raw_vec, counters);
+        if (ivfpq_param->hnsw_quantizer) {
+          gamma_index->EnableHNSWQuantizer(ivfpq_param->quantizer_efSearch);
+        }
+        gamma_index->SetTrainingParams(ivfpq_param->training_size,
+                                       ivfpq_param->kmeans_plusplus);
+        if (ivfpq_param->opq) {
+          gamma_index->EnableOPQ();
+        }
+        if (ivfpq_param->retrain_imbalance > 0) {
+          gamma_index->EnableAutoRetrain(ivfpq_param->retrain_imbalance);
+        }
+        if (ivfpq_param->rerank_sq8) {
+          gamma_index->EnableSQ8Rerank(ivfpq_param->sq8_rerank_num);
+        }
         delete ivfpq_param;
         return gamma_index;
         break;
@@ -81,6 +131,12 @@ class GammaIndexFactory {
                     << dimension << "]";
         }
 
+        if (ivfpq_param->nbits_per_idx != 8) {
+          LOG(ERROR) << "GPU IVFPQ only support nbits_per_idx=8";
+          delete ivfpq_param;
+          return nullptr;
+        }
+
         gamma_gpu::GammaIVFPQGPUIndex *gpu_index =
             new gamma_gpu::GammaIVFPQGPUIndex(
                 dimension, ivfpq_param->ncentroids, ivfpq_param->nsubvector,
@@ -92,8 +148,7 @@ class GammaIndexFactory {
 #endif
 
       case FLAT: {
-        auto raw_vec_type = dynamic_cast<MmapRawVector<float> *>(raw_vec);
-        if (raw_vec_type == nullptr || raw_vec_type->GetMemoryMode() == 0) {
+        if (!IsMemoryOnly(raw_vec)) {
           LOG(ERROR) << "FLAT cann't work in RocksDB or disk mode";
           return nullptr;
         }
@@ -113,8 +168,7 @@ class GammaIndexFactory {
       }
 
       case HNSW: {
-        auto raw_vec_type = dynamic_cast<MmapRawVector<float> *>(raw_vec);
-        if (raw_vec_type == nullptr || raw_vec_type->GetMemoryMode() == 0) {
+        if (!IsMemoryOnly(raw_vec)) {
           LOG(ERROR) << "HNSW cann't work in RocksDB or disk mode";
           return nullptr;
         }
@@ -181,6 +235,15 @@ class GammaIndexFactory {
 
     return nullptr;
   }
+
+ private:
+  // whether all vectors can be accessed through the vector header
+  static bool IsMemoryOnly(RawVector<float> *raw_vec) {
+    auto mmap_vec = dynamic_cast<MmapRawVector<float> *>(raw_vec);
+    if (mmap_vec != nullptr) return mmap_vec->GetMemoryMode() != 0;
+    auto fp16_vec = dynamic_cast<Float16RawVector *>(raw_vec);
+    return fp16_vec != nullptr && fp16_vec->GetMemoryMode() != 0;
+  }
 };
 
 }  // namespace tig_gamma
@@ -89,8 +89,18 @@ void GammaFLATIndex::SearchDirectly(int n, const float *x,
 
   int num_vectors = raw_vec_->GetVectorNum();
   ScopeVector<float> scope_vec;
-  raw_vec_->GetVectorHeader(0, 0 + num_vectors, scope_vec);
-  const float *vectors = scope_vec.Get();
+  ScopeVector<uint16_t> scope_fp16_vec;
+  const float *vectors = nullptr;
+  const uint16_t *fp16_vectors = nullptr;
+  // half precision vectors are scanned without decoding
+  auto fp16_raw_vec = dynamic_cast<Float16RawVector *>(raw_vec_);
+  if (fp16_raw_vec != nullptr) {
+    fp16_raw_vec->GetFP16VectorHeader(0, num_vectors, scope_fp16_vec);
+    fp16_vectors = scope_fp16_vec.Get();
+  } else {
+    raw_vec_->GetVectorHeader(0, 0 + num_vectors, scope_vec);
+    vectors = scope_vec.Get();
+  }
 
   long k = condition->topn;  // topK
 
@@ -141,8 +151,8 @@ void GammaFLATIndex::SearchDirectly(int n, const float *x,
       }
     };
 
-    auto search_impl = [&](const float *xi, const float *y, int ny, int offset,
-                           float *simi, idx_t *idxi, int k) -> int {
+    auto search_impl = [&](const float *xi, int ny, int offset, float *simi,
+                           idx_t *idxi, int k) -> int {
       int total = 0;
       auto *nr = condition->range_query_result;
       bool ck_dis = (condition->min_dist >= 0 && condition->max_dist >= 0);
@@ -157,8 +167,10 @@ void GammaFLATIndex::SearchDirectly(int n, const float *x,
             continue;
           }
 
-          const float *yi = y + i * d;
-          float dis = faiss::fvec_inner_product(xi, yi, d);
+          float dis =
+              fp16_vectors
+                  ? float16::inner_product(xi, fp16_vectors + (long)vid * d, d)
+                  : faiss::fvec_inner_product(xi, vectors + (long)vid * d, d);
 
           if (ck_dis &&
               (dis < condition->min_dist || dis > condition->max_dist)) {
@@ -182,8 +194,9 @@ void GammaFLATIndex::SearchDirectly(int n, const float *x,
             continue;
           }
 
-          const float *yi = y + i * d;
-          float dis = faiss::fvec_L2sqr(xi, yi, d);
+          float dis = fp16_vectors
+                          ? float16::L2sqr(xi, fp16_vectors + (long)vid * d, d)
+                          : faiss::fvec_L2sqr(xi, vectors + (long)vid * d, d);
 
           if (ck_dis &&
               (dis < condition->min_dist || dis > condition->max_dist)) {
@@ -212,7 +225,7 @@ void GammaFLATIndex::SearchDirectly(int n, const float *x,
 
         init_result(k, simi, idxi);
 
-        total[i] += search_impl(xi, vectors, num_vectors, 0, simi, idxi, k);
+        total[i] += search_impl(xi, num_vectors, 0, simi, idxi, k);
 
         if (condition->sort_by_docid) {
           sort_by_docid(k, simi, idxi);
@@ -240,7 +253,6 @@ void GammaFLATIndex::SearchDirectly(int n, const float *x,
           std::vector<float> local_dis(k);
           init_result(k, local_dis.data(), local_idx.data());
 
-          const float *y = vectors + ik * num_vectors_per_thread * d;
           size_t ny = num_vectors_per_thread;
 
           if (ik == num_threads - 1) {
@@ -249,7 +261,7 @@ void GammaFLATIndex::SearchDirectly(int n, const float *x,
 
           int offset = ik * num_vectors_per_thread;
 
-          ndis += search_impl(xi, y, ny, offset, local_dis.data(),
+          ndis += search_impl(xi, ny, offset, local_dis.data(),
                               local_idx.data(), k);
 
 #pragma omp critical
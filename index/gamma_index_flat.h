@@ -24,6 +24,8 @@
 #include "bitmap.h"
 #include "utils.h"
 #include "field_range_index.h"
+#include "float16.h"
+#include "float16_raw_vector.h"
 #include "gamma_common_data.h"
 #include "gamma_index.h"
 #include "log.h"
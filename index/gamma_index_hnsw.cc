@@ -43,6 +43,7 @@ GammaHNSWIndex::GammaHNSWIndex(faiss::Index *quantizer, size_t d,
 
   this->d = d;
   raw_vec_head_ = nullptr;
+  raw_vec_head_fp16_ = nullptr;
   indexed_vec_count_ = 0;
 
   gamma_hnsw_.efSearch = efSearch;
@@ -71,6 +72,13 @@ GammaHNSWIndex::~GammaHNSWIndex() {
 
 int GammaHNSWIndex::Indexing() {
   // get raw vec head for DistanceComputer
+  auto fp16_raw_vec = dynamic_cast<Float16RawVector *>(raw_vec_);
+  if (fp16_raw_vec != nullptr) {
+    ScopeVector<uint16_t> fp16_head;
+    fp16_raw_vec->GetFP16VectorHeader(0, 0, fp16_head);
+    raw_vec_head_fp16_ = fp16_head.Get();
+    return 0;
+  }
   ScopeVector<float> vector_head;
   raw_vec_->GetVectorHeader(0, 0, vector_head);
   raw_vec_head_ = const_cast<float *>(vector_head.Get());
@@ -193,9 +201,78 @@ struct FlatIPDis : DistanceComputer {
   }
 };
 
+struct FlatL2DisFP16 : DistanceComputer {
+  size_t d;
+  idx_t nb;
+  const uint16_t *xb;
+  const float *q;
+  size_t ndis;
+
+  float operator () (idx_t i) override {
+    ndis++;
+    return float16::L2sqr(q, xb + i * d, d);
+  }
+
+  float symmetric_dis(idx_t i, idx_t j) override {
+    ndis++;
+    return float16::L2sqr(xb + j * d, xb + i * d, d);
+  }
+
+  explicit FlatL2DisFP16(size_t d, idx_t nb,
+                        const uint16_t *xb = nullptr,
+                        const float *q = nullptr)
+      : d(d),
+        nb(nb),
+        xb(xb),
+        q(q),
+        ndis(0) {}
+
+  void set_query(const float *x) override {
+      q = x;
+  }
+};
+
+struct FlatIPDisFP16 : DistanceComputer {
+  size_t d;
+  idx_t nb;
+  const uint16_t *xb;
+  const float *q;
+  size_t ndis;
+
+  float operator () (idx_t i) override {
+    ndis++;
+    return -float16::inner_product(q, xb + i * d, d);
+  }
+
+  float symmetric_dis(idx_t i, idx_t j) override {
+    return -float16::inner_product(xb + j * d, xb + i * d, d);
+  }
+
+  explicit FlatIPDisFP16(size_t d, idx_t nb,
+                        const uint16_t *xb = nullptr,
+                        const float *q = nullptr)
+      : d(d),
+        nb(nb),
+        xb(xb),
+        q(q),
+        ndis(0) {}
+
+  void set_query(const float *x) override {
+      q = x;
+  }
+};
+
 };
 
 DistanceComputer * GammaHNSWIndex::GetDistanceComputer() const {
+  if (raw_vec_head_fp16_ != nullptr) {
+    if (metric_type == faiss::METRIC_L2) {
+      return new FlatL2DisFP16(d, indexed_vec_count_, raw_vec_head_fp16_);
+    } else if (metric_type == faiss::METRIC_INNER_PRODUCT) {
+      return new FlatIPDisFP16(d, indexed_vec_count_, raw_vec_head_fp16_);
+    }
+    return nullptr;
+  }
   if (metric_type == faiss::METRIC_L2) {
       return new FlatL2Dis(d, indexed_vec_count_, raw_vec_head_);
   } else if (metric_type == faiss::METRIC_INNER_PRODUCT) {
@@ -81,6 +81,8 @@ struct GammaHNSWIndex : GammaFLATIndex, faiss::IndexHNSW {
 
   // for search, every raw vector should be accessed
   float * raw_vec_head_;
+  // set instead of raw_vec_head_ when vectors are stored in half precision
+  const uint16_t * raw_vec_head_fp16_;
 
   // for add and search
   pthread_rwlock_t mutex_;
@@ -18,18 +18,51 @@
  */
 
 #include "gamma_index_ivfpq.h"
+#include "float16_raw_vector.h"
 #include "mmap_raw_vector.h"
 
 #include <algorithm>
+#include <limits>
+#include <memory>
+#include <random>
 #include <stdexcept>
 #include <vector>
 
 #include "bitmap.h"
+#include "faiss/IndexFlat.h"
+#include "faiss/IndexHNSW.h"
+#include "faiss/Clustering.h"
+#include "memory_policy.h"
 #include "omp.h"
+#include "rerank.h"
 #include "utils.h"
 
+#ifndef FINTEGER
+#define FINTEGER long
+#endif
+
+extern "C" {
+
+/* declare BLAS functions, see http://www.netlib.org/clapack/cblas/ */
+
+int sgemm_(const char *transa, const char *transb, FINTEGER *m, FINTEGER *n,
+           FINTEGER *k, const float *alpha, const float *a, FINTEGER *lda,
+           const float *b, FINTEGER *ldb, float *beta, float *c,
+           FINTEGER *ldc);
+}
+
 namespace tig_gamma {
 
+// faiss warns about k-means with less training points per centroid
+static const size_t kTrainingPointsPerCentroid = 39;
+// k-means++ seeding is quadratic in nlist, random seeding above it
+static const size_t kMaxKMeansPlusPlusCentroids = 8192;
+static const size_t kKMeansPlusPlusPointsPerCentroid = 16;
+// training vectors of the quantization error report
+static const long kTrainingErrorPoints = 10000;
+// work items of a search per thread, see search_preassigned
+static const int kWorkItemsPerThread = 4;
+
 static inline void ConvertVectorDim(size_t num, int raw_d, int d,
                                     const float *raw_vec, float *vec) {
   memset(vec, 0, num * d * sizeof(float));
@@ -42,6 +75,127 @@ static inline void ConvertVectorDim(size_t num, int raw_d, int d,
   }
 }
 
+// k nearest centroids of a flat quantizer for vectors with raw_d < d
+// components. As the tail of x is zero, only the first raw_d components of
+// the centroids take part in the inner products, which is a strided sgemm,
+// and L2 is |x|^2 + |c|^2 - 2<x, c> with the norms of whole centroids.
+static void SearchPaddedFlat(const faiss::IndexFlat *flat, size_t n,
+                             const float *x, size_t raw_d, size_t k,
+                             float *distances, idx_t *labels) {
+  using HeapForIP = faiss::CMin<float, idx_t>;
+  using HeapForL2 = faiss::CMax<float, idx_t>;
+  const size_t bs_x = 4096, bs_c = 1024;
+
+  size_t d = flat->d;
+  size_t nc = flat->ntotal;
+  const float *centroids = flat->xb.data();
+  bool ip = flat->metric_type == faiss::METRIC_INNER_PRODUCT;
+
+  std::vector<float> x_norms, c_norms;
+  if (!ip) {
+    x_norms.resize(n);
+    c_norms.resize(nc);
+    faiss::fvec_norms_L2sqr(x_norms.data(), x, raw_d, n);
+    faiss::fvec_norms_L2sqr(c_norms.data(), centroids, d, nc);
+  }
+
+  // a search usually has few queries, the block isn't larger than needed
+  std::unique_ptr<float[]> ip_block(
+      new float[std::min<size_t>(n, bs_x) * std::min<size_t>(nc, bs_c)]);
+  for (size_t i0 = 0; i0 < n; i0 += bs_x) {
+    size_t i1 = std::min(n, i0 + bs_x);
+    for (size_t i = i0; i < i1; i++) {
+      if (ip)
+        faiss::heap_heapify<HeapForIP>(k, distances + i * k, labels + i * k);
+      else
+        faiss::heap_heapify<HeapForL2>(k, distances + i * k, labels + i * k);
+    }
+    for (size_t j0 = 0; j0 < nc; j0 += bs_c) {
+      size_t j1 = std::min(nc, j0 + bs_c);
+      {
+        float one = 1, zero = 0;
+        FINTEGER nyi = j1 - j0, nxi = i1 - i0, di = raw_d, ldc = d;
+        sgemm_("Transpose", "Not transpose", &nyi, &nxi, &di, &one,
+               centroids + j0 * d, &ldc, x + i0 * raw_d, &di, &zero,
+               ip_block.get(), &nyi);
+      }
+#pragma omp parallel for
+      for (size_t i = i0; i < i1; i++) {
+        float *simi = distances + i * k;
+        idx_t *idxi = labels + i * k;
+        const float *ip_line = ip_block.get() + (i - i0) * (j1 - j0);
+        for (size_t j = j0; j < j1; j++) {
+          float dis = ip_line[j - j0];
+          if (ip) {
+            if (HeapForIP::cmp(simi[0], dis)) {
+              faiss::heap_pop<HeapForIP>(k, simi, idxi);
+              faiss::heap_push<HeapForIP>(k, simi, idxi, dis, j);
+            }
+          } else {
+            dis = x_norms[i] + c_norms[j] - 2 * dis;
+            if (dis < 0) dis = 0;
+            if (HeapForL2::cmp(simi[0], dis)) {
+              faiss::heap_pop<HeapForL2>(k, simi, idxi);
+              faiss::heap_push<HeapForL2>(k, simi, idxi, dis, j);
+            }
+          }
+        }
+      }
+    }
+    for (size_t i = i0; i < i1; i++) {
+      if (ip)
+        faiss::heap_reorder<HeapForIP>(k, distances + i * k, labels + i * k);
+      else
+        faiss::heap_reorder<HeapForL2>(k, distances + i * k, labels + i * k);
+    }
+  }
+}
+
+// uniform random sample of n sorted ids in [0, total), selection sampling
+// (Knuth's algorithm S) needs no memory but the output
+static void SampleIds(long total, long n, int64_t seed, std::vector<long> &ids) {
+  std::mt19937_64 rng(seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  ids.clear();
+  ids.reserve(n);
+  for (long i = 0; i < total && (long)ids.size() < n; i++) {
+    long needed = n - ids.size();
+    if (uniform(rng) * (total - i) < needed) ids.push_back(i);
+  }
+}
+
+// k-means++ seeding of k centroids with n points of x, each centroid is
+// drawn with the probability of the squared distance to the nearest one
+static void KMeansPlusPlus(size_t n, size_t d, const float *x, size_t k,
+                           int64_t seed, float *centroids) {
+  std::mt19937_64 rng(seed);
+  std::vector<float> min_dis(n, std::numeric_limits<float>::max());
+  size_t pick = rng() % n;
+  for (size_t c = 0; c < k; c++) {
+    memcpy(centroids + c * d, x + pick * d, d * sizeof(float));
+    if (c + 1 == k) break;
+
+    const float *centroid = centroids + c * d;
+    double sum = 0;
+#pragma omp parallel for reduction(+ : sum)
+    for (long i = 0; i < (long)n; i++) {
+      float dis = faiss::fvec_L2sqr(x + i * d, centroid, d);
+      if (dis < min_dis[i]) min_dis[i] = dis;
+      sum += min_dis[i];
+    }
+
+    double r = std::uniform_real_distribution<double>(0, sum)(rng);
+    pick = n - 1;
+    for (size_t i = 0; i < n; i++) {
+      r -= min_dis[i];
+      if (r < 0) {
+        pick = i;
+        break;
+      }
+    }
+  }
+}
+
 IndexIVFPQStats indexIVFPQ_stats;
 
 GammaIVFPQIndex::GammaIVFPQIndex(faiss::Index *quantizer, size_t d,
@@ -73,14 +227,42 @@ GammaIVFPQIndex::GammaIVFPQIndex(faiss::Index *quantizer, size_t d,
         new realtime::RTInvertedLists(rt_invert_index_ptr_, nlist, code_size);
   }
 
+  pq4_blocks_ = nbits_per_idx == 4 ? new pq4::BlockCache(nlist, code_size)
+                                   : nullptr;
+
   // default value, nprobe will be passed at search time
   this->nprobe = 20;
+  if (nbits_per_idx == 8) {
+    LOG(INFO) << "pq8 scan kernel=" << pq8::kernel_name();
+  }
 
   compaction_ = false;
   compact_bucket_no_ = 0;
   compacted_num_ = 0;
   updated_num_ = 0;
 
+  opq_ = nullptr;
+  sq_ = nullptr;
+  sq_codes_ = nullptr;
+  sq_codes_size_ = 0;
+  sq8_rerank_num_ = 0;
+  quantizer_ef_search_ = 0;
+  training_size_ = 0;
+  kmeans_plusplus_ = true;
+
+  // writer preferred, the swap is not starved by continuous searches
+  pthread_rwlockattr_t attr;
+  pthread_rwlockattr_init(&attr);
+  pthread_rwlockattr_setkind_np(&attr,
+                                PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+  pthread_rwlock_init(&shared_mutex_, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  pthread_mutex_init(&add_mutex_, NULL);
+  pthread_mutex_init(&retrain_del_mutex_, NULL);
+  retraining_ = false;
+  retrain_imbalance_ = 0;
+  retrain_check_count_ = 0;
+
 #ifdef PERFORMANCE_TESTING
   search_count_ = 0;
   add_count_ = 0;
@@ -88,10 +270,17 @@ GammaIVFPQIndex::GammaIVFPQIndex(faiss::Index *quantizer, size_t d,
 }
 
 GammaIVFPQIndex::~GammaIVFPQIndex() {
+  if (retrain_thread_.joinable()) {
+    retrain_thread_.join();
+  }
   if (rt_invert_index_ptr_) {
     delete rt_invert_index_ptr_;
     rt_invert_index_ptr_ = nullptr;
   }
+  if (pq4_blocks_) {
+    delete pq4_blocks_;
+    pq4_blocks_ = nullptr;
+  }
   if (invlists) {
     delete invlists;
     invlists = nullptr;
@@ -100,6 +289,104 @@ GammaIVFPQIndex::~GammaIVFPQIndex() {
     delete quantizer;  // it will not be delete in parent class
     quantizer = nullptr;
   }
+  if (clustering_index) {
+    delete clustering_index;
+    clustering_index = nullptr;
+  }
+  if (opq_) {
+    delete opq_;
+    opq_ = nullptr;
+  }
+  if (sq_) {
+    delete sq_;
+    sq_ = nullptr;
+  }
+  if (sq_codes_) {
+    utils::FreeLarge(sq_codes_, sq_codes_size_);
+    sq_codes_ = nullptr;
+  }
+  pthread_rwlock_destroy(&shared_mutex_);
+  pthread_mutex_destroy(&add_mutex_);
+  pthread_mutex_destroy(&retrain_del_mutex_);
+}
+
+void GammaIVFPQIndex::SetTrainingParams(int training_size,
+                                        bool kmeans_plusplus) {
+  training_size_ = training_size;
+  kmeans_plusplus_ = kmeans_plusplus;
+}
+
+void GammaIVFPQIndex::EnableAutoRetrain(double imbalance) {
+  retrain_imbalance_ = imbalance;
+  LOG(INFO) << "enable auto retrain, imbalance=" << retrain_imbalance_;
+}
+
+void GammaIVFPQIndex::EnableHNSWQuantizer(int ef_search) {
+  auto hnsw = dynamic_cast<faiss::IndexHNSWFlat *>(quantizer);
+  if (hnsw == nullptr) {
+    LOG(ERROR) << "the quantizer isn't HNSW";
+    return;
+  }
+  hnsw->hnsw.efSearch = ef_search;
+  quantizer_ef_search_ = ef_search;
+  if (clustering_index == nullptr) {
+    clustering_index = new faiss::IndexFlatL2(d);
+  }
+  LOG(INFO) << "enable hnsw quantizer, nlist=" << nlist
+            << ", efSearch=" << ef_search;
+}
+
+void GammaIVFPQIndex::EnableOPQ() {
+  if (opq_ == nullptr) {
+    opq_ = new faiss::OPQMatrix(d, pq.M);
+  }
+  LOG(INFO) << "enable opq, d=" << d << ", M=" << pq.M;
+}
+
+const float *GammaIVFPQIndex::Rotate(const faiss::OPQMatrix *opq, int n,
+                                     const float *x,
+                                     std::unique_ptr<float[]> &rotated) const {
+  if (opq == nullptr) return x;
+  int raw_d = raw_vec_->GetDimension();
+  std::unique_ptr<float[]> padded;
+  if (raw_d < d) {
+    padded.reset(new float[(size_t)n * d]);
+    ConvertVectorDim(n, raw_d, d, x, padded.get());
+    x = padded.get();
+  }
+  rotated.reset(new float[(size_t)n * d]);
+  opq->apply_noalloc(n, x, rotated.get());
+  return rotated.get();
+}
+
+void GammaIVFPQIndex::EnableSQ8Rerank(int sq8_rerank_num) {
+  if (sq_ == nullptr) {
+    sq_ = new faiss::ScalarQuantizer(raw_vec_->GetDimension(),
+                                     faiss::ScalarQuantizer::QT_8bit);
+  }
+  sq8_rerank_num_ = sq8_rerank_num;
+  LOG(INFO) << "enable sq8 rerank, sq8_rerank_num=" << sq8_rerank_num_;
+}
+
+int GammaIVFPQIndex::TrainSQ8(size_t n, const float *x) {
+  if (sq_ == nullptr) return 0;
+  // per dimension min/max, trained once with the same samples as IVFPQ
+  sq_->train(n, x);
+  return AllocSQ8Codes();
+}
+
+int GammaIVFPQIndex::AllocSQ8Codes() {
+  if (sq_codes_ == nullptr) {
+    // the arena is only reserved, pages are committed as vectors are indexed
+    size_t max_vec_size = raw_vec_->GetMaxVectorSize();
+    sq_codes_size_ = max_vec_size * sq_->code_size;
+    sq_codes_ = (uint8_t *)utils::AllocLarge(sq_codes_size_, "sq8 codes");
+    if (sq_codes_ == nullptr) {
+      LOG(ERROR) << "alloc sq8 codes error, max_vec_size=" << max_vec_size;
+      return -1;
+    }
+  }
+  return 0;
 }
 
 faiss::InvertedListScanner *GammaIVFPQIndex::get_InvertedListScanner(
@@ -128,16 +415,37 @@ GammaInvertedListScanner *GammaIVFPQIndex::GetGammaIVFFlatScanner
 
 GammaInvertedListScanner *GammaIVFPQIndex::GetGammaInvertedListScanner(
     bool store_pairs) const {
+  if (pq.nbits == 4) {
+    GammaInvertedListScanner *scanner = nullptr;
+    if (metric_type == faiss::METRIC_INNER_PRODUCT) {
+      auto fast_scanner =
+          new GammaIVFPQFastScanScanner<faiss::METRIC_INNER_PRODUCT,
+                                        faiss::CMin<float, idx_t>>(
+              *this, store_pairs, InputDim());
+      fast_scanner->set_block_cache(pq4_blocks_, rt_invert_index_ptr_);
+      scanner = fast_scanner;
+    } else if (metric_type == faiss::METRIC_L2) {
+      auto fast_scanner =
+          new GammaIVFPQFastScanScanner<faiss::METRIC_L2,
+                                        faiss::CMax<float, idx_t>>(
+              *this, store_pairs, InputDim());
+      fast_scanner->set_block_cache(pq4_blocks_, rt_invert_index_ptr_);
+      scanner = fast_scanner;
+    }
+    if (scanner) scanner->SetVecFilter(this->docids_bitmap_, this->raw_vec_);
+    return scanner;
+  }
   if (metric_type == faiss::METRIC_INNER_PRODUCT) {
     auto scanner =
         new GammaIVFPQScanner<faiss::METRIC_INNER_PRODUCT,
-                              faiss::CMin<float, idx_t>, 2>(*this, store_pairs);
+                              faiss::CMin<float, idx_t>, 2>(
+            *this, store_pairs, InputDim());
     scanner->SetVecFilter(this->docids_bitmap_, this->raw_vec_);
     return scanner;
   } else if (metric_type == faiss::METRIC_L2) {
     auto scanner =
         new GammaIVFPQScanner<faiss::METRIC_L2, faiss::CMax<float, idx_t>, 2>(
-            *this, store_pairs);
+            *this, store_pairs, InputDim());
     scanner->SetVecFilter(this->docids_bitmap_, this->raw_vec_);
     return scanner;
   }
@@ -149,61 +457,424 @@ int GammaIVFPQIndex::Indexing() {
     LOG(INFO) << "gamma ivfpq index is already trained, skip indexing";
     return 0;
   }
-  int vectors_count = raw_vec_->GetVectorNum();
-  if (vectors_count < 8192) {
-    LOG(ERROR) << "vector total count [" << vectors_count
-               << "] less then 8192, failed!";
+  std::vector<float> sample;
+  long num = Train(*this, opq_, raw_vec_->GetVectorNum(), sample);
+  if (num < 0) {
+    return -1;
+  }
+  if (TrainSQ8(num, sample.data())) {
+    LOG(ERROR) << "train sq8 error!";
     return -1;
   }
-  size_t num = vectors_count > 100000 ? 100000 : vectors_count;
-  ScopeVector<float> header;
-  raw_vec_->GetVectorHeader(0, num, header);
+  return 0;
+}
 
-  int raw_d = raw_vec_->GetDimension();
+long GammaIVFPQIndex::Train(faiss::IndexIVFPQ &ivfpq, faiss::OPQMatrix *opq,
+                            long total, std::vector<float> &sample) {
+  // k-means needs a point per centroid and PQ one per sub centroid
+  long min_count = std::max(nlist, (size_t)pq.ksub);
+  if (total < min_count) {
+    LOG(ERROR) << "vector total count [" << total << "] less then "
+               << min_count << ", failed!";
+    return -1;
+  }
+  long num = training_size_;
+  if (num <= 0) {
+    num = std::max(100000L, (long)(kTrainingPointsPerCentroid * nlist));
+  }
+  num = std::min(num, total);
+  if (num < (long)(kTrainingPointsPerCentroid * nlist)) {
+    LOG(WARNING) << "only " << num << " training vectors for " << nlist
+                 << " centroids, " << kTrainingPointsPerCentroid
+                 << " per centroid are suggested";
+  }
 
-  float *train_vec = nullptr;
+  double start = utils::getmillisecs();
+  int raw_d = raw_vec_->GetDimension();
+  if (SampleTrainingVectors(total, num, sample)) {
+    LOG(ERROR) << "sample training vectors error";
+    return -1;
+  }
 
+  const float *train_vec = sample.data();
+  std::vector<float> padded;
   if (d_ > raw_d) {
-    float *vec = new float[num * d_];
+    padded.resize((size_t)num * d);
+    ConvertVectorDim(num, raw_d, d, sample.data(), padded.data());
+    train_vec = padded.data();
+  }
+  double sample_end = utils::getmillisecs();
+
+  std::vector<float> rotated;
+  if (opq) {
+    // the rotation is trained with PQ of the same M and nbits, then the
+    // quantizers are trained in the rotated space
+    faiss::ProductQuantizer opq_pq(d, ivfpq.pq.M, ivfpq.pq.nbits);
+    opq->pq = &opq_pq;
+    opq->train(num, train_vec);
+    opq->pq = nullptr;
+    rotated.resize((size_t)num * d);
+    opq->apply_noalloc(num, train_vec, rotated.data());
+    train_vec = rotated.data();
+  }
+  double opq_end = utils::getmillisecs();
+
+  TrainCoarse(ivfpq, num, train_vec);
+  double coarse_end = utils::getmillisecs();
+
+  // the quantizer is trained, faiss only trains PQ with the residuals
+  ivfpq.train(num, train_vec);
+  double pq_end = utils::getmillisecs();
+
+  float coarse_mse = 0, pq_mse = 0;
+  TrainingError(ivfpq, num, train_vec, coarse_mse, pq_mse);
+  LOG(INFO) << "train successed! training vectors=" << num << "/" << total
+            << ", sample cost=" << sample_end - start
+            << "ms, opq cost=" << opq_end - sample_end
+            << "ms, coarse cost=" << coarse_end - opq_end
+            << "ms, pq cost=" << pq_end - coarse_end
+            << "ms, coarse mse=" << coarse_mse << ", pq mse=" << pq_mse
+            << ", use_precomputed_table=" << ivfpq.use_precomputed_table;
+  return num;
+}
+
+int GammaIVFPQIndex::SampleTrainingVectors(long total, long n,
+                                           std::vector<float> &sample) {
+  int raw_d = raw_vec_->GetDimension();
+  std::vector<long> ids;
+  SampleIds(total, n, cp.seed, ids);
+  sample.resize((size_t)n * raw_d);
+
+  const long batch = 4096;
+  for (long i = 0; i < n; i += batch) {
+    int k = (int)std::min(batch, n - i);
+    ScopeVectors<float> scope_vecs(k);
+    if (raw_vec_->Gets(k, ids.data() + i, scope_vecs)) return -1;
+    const float **vecs = scope_vecs.Get();
+    for (int j = 0; j < k; j++) {
+      if (vecs[j] == nullptr) {
+        LOG(ERROR) << "get vector error, vid=" << ids[i + j];
+        return -1;
+      }
+      memcpy(sample.data() + (i + j) * raw_d, vecs[j], raw_d * sizeof(float));
+    }
+  }
+  return 0;
+}
+
+void GammaIVFPQIndex::TrainCoarse(faiss::IndexIVFPQ &ivfpq, long n,
+                                  const float *x) {
+  faiss::Clustering clus(d, nlist, cp);
+  if (kmeans_plusplus_ && nlist <= kMaxKMeansPlusPlusCentroids) {
+    // seeding is O(n * nlist * d), a sample of the points is enough
+    long seed_num =
+        std::min(n, (long)(kKMeansPlusPlusPointsPerCentroid * nlist));
+    std::vector<long> ids;
+    SampleIds(n, seed_num, cp.seed + 1, ids);
+    std::vector<float> seed_vec((size_t)seed_num * d);
+    for (long i = 0; i < seed_num; i++) {
+      memcpy(seed_vec.data() + i * d, x + ids[i] * d, d * sizeof(float));
+    }
+    clus.centroids.resize(nlist * d);
+    KMeansPlusPlus(seed_num, d, seed_vec.data(), nlist, cp.seed,
+                   clus.centroids.data());
+  } else if (kmeans_plusplus_) {
+    LOG(INFO) << "nlist=" << nlist << " > " << kMaxKMeansPlusPlusCentroids
+              << ", centroids are initialized randomly";
+  }
+
+  // the assignment of k-means is a parallel flat search
+  faiss::IndexFlatL2 assign_index(d);
+  clus.train(n, x, clustering_index ? *clustering_index : assign_index);
+
+  ivfpq.quantizer->reset();
+  ivfpq.quantizer->add(nlist, clus.centroids.data());
+  ivfpq.quantizer->is_trained = true;
+}
 
-    ConvertVectorDim(num, raw_d, d, header.Get(), vec);
+void GammaIVFPQIndex::TrainingError(const faiss::IndexIVFPQ &ivfpq, long n,
+                                    const float *x, float &coarse_mse,
+                                    float &pq_mse) const {
+  const faiss::ProductQuantizer &pq = ivfpq.pq;
+  n = std::min(n, kTrainingErrorPoints);
+  std::vector<float> coarse_dis(n);
+  std::vector<idx_t> list_nos(n);
+  ivfpq.quantizer->search(n, x, 1, coarse_dis.data(), list_nos.data());
+
+  double coarse_sum = 0, pq_sum = 0;
+#pragma omp parallel reduction(+ : coarse_sum, pq_sum)
+  {
+    std::vector<float> residual(d), decoded(d);
+    std::vector<uint8_t> code(pq.code_size);
+#pragma omp for
+    for (long i = 0; i < n; i++) {
+      coarse_sum += coarse_dis[i];
+      const float *xi = x + i * d;
+      if (by_residual) {
+        ivfpq.quantizer->compute_residual(xi, residual.data(), list_nos[i]);
+        xi = residual.data();
+      }
+      pq.compute_code(xi, code.data());
+      pq.decode(code.data(), decoded.data());
+      pq_sum += faiss::fvec_L2sqr(xi, decoded.data(), d);
+    }
+  }
+  coarse_mse = n > 0 ? coarse_sum / n : 0;
+  pq_mse = n > 0 ? pq_sum / n : 0;
+}
 
-    train_vec = vec;
+faiss::IndexIVFPQ *GammaIVFPQIndex::NewShadowIndex() const {
+  faiss::Index *shadow_quantizer = nullptr;
+  auto hnsw = dynamic_cast<const faiss::IndexHNSWFlat *>(quantizer);
+  if (hnsw) {
+    auto shadow_hnsw =
+        new faiss::IndexHNSWFlat(d, hnsw->hnsw.nb_neighbors(1));
+    shadow_hnsw->hnsw.efConstruction = hnsw->hnsw.efConstruction;
+    shadow_hnsw->hnsw.efSearch = hnsw->hnsw.efSearch;
+    shadow_quantizer = shadow_hnsw;
   } else {
-    train_vec = const_cast<float *>(header.Get());
+    shadow_quantizer = new faiss::IndexFlatL2(d);
   }
+  faiss::IndexIVFPQ *shadow = new faiss::IndexIVFPQ(shadow_quantizer, d, nlist,
+                                                    pq.M, pq.nbits);
+  shadow->own_fields = true;
+  shadow->by_residual = by_residual;
+  shadow->cp = cp;
+  return shadow;
+}
 
-  train(num, train_vec);
+double GammaIVFPQIndex::ImbalanceFactor() const {
+  double total = 0, sum = 0;
+  for (size_t i = 0; i < nlist; i++) {
+    double size = invlists->list_size(i);
+    total += size;
+    sum += size * size;
+  }
+  return total > 0 ? sum * nlist / (total * total) : 1;
+}
 
-  if (d_ > raw_d) {
-    delete train_vec;
+int GammaIVFPQIndex::Retrain() {
+  bool expected = false;
+  if (!retraining_.compare_exchange_strong(expected, true)) {
+    LOG(ERROR) << "gamma ivfpq index is retraining";
+    return -1;
   }
+  int ret = DoRetrain();
+  retraining_ = false;
+  return ret;
+}
 
-  LOG(INFO) << "train successed!";
+int GammaIVFPQIndex::StartRetrain() {
+  bool expected = false;
+  if (!retraining_.compare_exchange_strong(expected, true)) {
+    return -1;
+  }
+  // the last retrain thread has finished
+  if (retrain_thread_.joinable()) {
+    retrain_thread_.join();
+  }
+  retrain_thread_ = std::thread([this]() {
+    DoRetrain();
+    retraining_ = false;
+  });
   return 0;
 }
 
-static float *compute_residuals(const faiss::Index *quantizer, long n,
-                                const float *x, const idx_t *list_nos) {
-  size_t d = quantizer->d;
-  float *residuals = new float[n * d];
-  for (int i = 0; i < n; i++) {
-    if (list_nos[i] < 0)
-      memset(residuals + i * d, 0, sizeof(*residuals) * d);
-    else
-      quantizer->compute_residual(x + i * d, residuals + i * d, list_nos[i]);
-  }
-  return residuals;
+int GammaIVFPQIndex::DoRetrain() {
+  if (!this->is_trained) {
+    LOG(ERROR) << "gamma ivfpq index isn't trained, skip retraining";
+    return -1;
+  }
+  double start = utils::getmillisecs();
+  double imbalance = ImbalanceFactor();
+  long vectors_count = 0;
+  {
+    ThreadLock add_lock(add_mutex_);
+    // vectors added or updated from now on are caught up before the swap
+    vectors_count = indexed_vec_count_;
+    retrain_updated_vids_.clear();
+  }
+  {
+    ThreadLock del_lock(retrain_del_mutex_);
+    retrain_deleted_vids_.clear();
+  }
+
+  std::unique_ptr<faiss::IndexIVFPQ> shadow(NewShadowIndex());
+  std::unique_ptr<faiss::OPQMatrix> shadow_opq(
+      opq_ ? new faiss::OPQMatrix(d, pq.M) : nullptr);
+  std::unique_ptr<pq4::BlockCache> shadow_blocks(
+      pq4_blocks_ ? new pq4::BlockCache(nlist, code_size) : nullptr);
+  std::vector<float> sample;
+  if (Train(*shadow, shadow_opq.get(), vectors_count, sample) < 0) {
+    LOG(ERROR) << "train shadow index error";
+    return -1;
+  }
+
+  std::unique_ptr<realtime::RTInvertIndex> rt_index(
+      new realtime::RTInvertIndex(nlist, code_size,
+                                  raw_vec_->GetMaxVectorSize(),
+                                  raw_vec_->vid_mgr_, docids_bitmap_, 100000,
+                                  12800000));
+  if (!rt_index->Init()) {
+    LOG(ERROR) << "init shadow realtime invert index error";
+    return -1;
+  }
+  shadow->replace_invlists(
+      new realtime::RTInvertedLists(rt_index.get(), nlist, code_size), true);
+
+  auto add_range = [&](long begin, long end) -> bool {
+    const long batch = 10000;
+    for (long vid = begin; vid < end; vid += batch) {
+      long num = std::min(batch, end - vid);
+      ScopeVector<float> vector_head;
+      raw_vec_->GetVectorHeader(vid, vid + num, vector_head);
+      if (!AddToLists(*shadow, shadow_opq.get(), rt_index.get(), vid, num,
+                      vector_head.Get())) {
+        LOG(ERROR) << "add shadow index from vid " << vid << " error!";
+        return false;
+      }
+    }
+    return true;
+  };
+  if (!add_range(0, vectors_count)) return -1;
+  double encode_end = utils::getmillisecs();
+
+  // the shadow counts a deleted vector when it is added, so a delete which
+  // raced with the add may be counted twice or never, recount its bucket
+  auto recount_deleted = [&]() -> long {
+    std::vector<int> deleted_vids;
+    {
+      ThreadLock del_lock(retrain_del_mutex_);
+      deleted_vids.swap(retrain_deleted_vids_);
+    }
+    rt_index->RecountDeleted(deleted_vids.data(), deleted_vids.size());
+    return deleted_vids.size();
+  };
+
+  long caught_up = 0, updated = 0, deleted = 0;
+  {
+    ThreadLock add_lock(add_mutex_);
+    caught_up = indexed_vec_count_ - vectors_count;
+    if (!add_range(vectors_count, indexed_vec_count_)) return -1;
+    updated = retrain_updated_vids_.size();
+    if (updated > 0) {
+      ScopeVectors<float> scope_vecs(updated);
+      raw_vec_->Gets(updated, retrain_updated_vids_.data(), scope_vecs);
+      UpdateLists(*shadow, shadow_opq.get(), rt_index.get(),
+                  retrain_updated_vids_, scope_vecs);
+      retrain_updated_vids_.clear();
+    }
+    deleted = recount_deleted();
+
+    WriteThreadLock write_lock(shared_mutex_);
+    // deletes hold the read lock, none is missed from here to the swap
+    deleted += recount_deleted();
+    std::swap(quantizer, shadow->quantizer);
+    std::swap(pq, shadow->pq);
+    std::swap(use_precomputed_table, shadow->use_precomputed_table);
+    precomputed_table.swap(shadow->precomputed_table);
+    std::swap(invlists, shadow->invlists);
+    if (opq_) {
+      faiss::OPQMatrix *old_opq = opq_;
+      opq_ = shadow_opq.release();
+      shadow_opq.reset(old_opq);
+    }
+    realtime::RTInvertIndex *old_rt_index = rt_invert_index_ptr_;
+    rt_invert_index_ptr_ = rt_index.release();
+    rt_index.reset(old_rt_index);
+    // packed blocks are of the old lists
+    if (pq4_blocks_) {
+      pq4::BlockCache *old_blocks = pq4_blocks_;
+      pq4_blocks_ = shadow_blocks.release();
+      shadow_blocks.reset(old_blocks);
+    }
+  }
+  double swap_end = utils::getmillisecs();
+
+  // the old quantizer, codebooks and lists are released with the shadow
+  shadow.reset();
+  shadow_blocks.reset();
+  shadow_opq.reset();
+  rt_index.reset();
+  LOG(INFO) << "retrain successed! vectors=" << vectors_count
+            << ", caught up=" << caught_up << ", updated=" << updated
+            << ", deleted=" << deleted
+            << ", imbalance factor " << imbalance << " -> "
+            << ImbalanceFactor() << ", train and encode cost="
+            << encode_end - start
+            << "ms, catch up and swap cost=" << swap_end - encode_end << "ms";
+  return 0;
+}
+
+void GammaIVFPQIndex::CoarseSearch(const faiss::IndexIVFPQ &ivfpq, int n,
+                                   const float *x, int k, float *distances,
+                                   idx_t *labels) const {
+  const faiss::Index *quantizer = ivfpq.quantizer;
+  int raw_d = InputDim();
+  if (raw_d == d) {
+    quantizer->search(n, x, k, distances, labels);
+    return;
+  }
+  auto flat = dynamic_cast<const faiss::IndexFlat *>(quantizer);
+  if (flat != nullptr) {
+    SearchPaddedFlat(flat, n, x, raw_d, k, distances, labels);
+    return;
+  }
+  // other quantizers need the padded vectors
+  std::unique_ptr<float[]> vec(new float[(size_t)n * d]);
+  ConvertVectorDim(n, raw_d, d, x, vec.get());
+  quantizer->search(n, vec.get(), k, distances, labels);
+}
+
+void GammaIVFPQIndex::ComputeCodes(const faiss::IndexIVFPQ &ivfpq, int n,
+                                   const float *x, const idx_t *list_nos,
+                                   uint8_t *codes) const {
+  const faiss::ProductQuantizer &pq = ivfpq.pq;
+  size_t raw_d = InputDim();
+  if (by_residual) {
+    // the residual is needed in full, the padded part is minus the centroid
+    std::unique_ptr<float[]> residuals(new float[(size_t)n * d]);
+    for (int i = 0; i < n; i++) {
+      float *residual = residuals.get() + (size_t)i * d;
+      if (list_nos[i] < 0)
+        memset(residual, 0, sizeof(float) * d);
+      else
+        ComputePaddedResidual(ivfpq.quantizer, x + i * raw_d, raw_d,
+                              list_nos[i], residual);
+    }
+    pq.compute_codes(residuals.get(), codes, n);
+  } else if (raw_d == (size_t)d) {
+    pq.compute_codes(x, codes, n);
+  } else {
+#pragma omp parallel
+    {
+      std::vector<float> tab(pq.M * pq.ksub);
+#pragma omp for
+      for (int i = 0; i < n; i++) {
+        ComputePaddedTable(pq, x + i * raw_d, raw_d, faiss::METRIC_L2,
+                           tab.data());
+        pq.compute_code_from_distance_table(tab.data(),
+                                            codes + (size_t)i * code_size);
+      }
+    }
+  }
 }
 
 int GammaIVFPQIndex::Delete(int docid) {
   std::vector<int> vids;
   raw_vec_->vid_mgr_->DocID2VID(docid, vids);
+  ReadThreadLock read_lock(shared_mutex_);
   rt_invert_index_ptr_->Delete(vids.data(), vids.size());
+  if (retraining_) {
+    ThreadLock del_lock(retrain_del_mutex_);
+    retrain_deleted_vids_.insert(retrain_deleted_vids_.end(), vids.begin(),
+                                 vids.end());
+  }
   return 0;
 }
 
 int GammaIVFPQIndex::AddRTVecsToIndex() {
+  ThreadLock add_lock(add_mutex_);
   int ret = 0;
   int total_stored_vecs = raw_vec_->GetVectorNum();
   if (indexed_vec_count_ > total_stored_vecs) {
@@ -231,32 +902,34 @@ int GammaIVFPQIndex::AddRTVecsToIndex() {
                                 indexed_vec_count_ + count_per_index,
                                 vector_head);
 
-      int raw_d = raw_vec_->GetDimension();
-      float *add_vec = nullptr;
-
-      if (d_ > raw_d) {
-        float *vec = new float[count_per_index * d_];
-
-        ConvertVectorDim(count_per_index, raw_d, d, vector_head.Get(), vec);
-        add_vec = vec;
-      } else {
-        add_vec = const_cast<float *>(vector_head.Get());
+      // codes must be ready before the vectors are searchable
+      if (sq_codes_) {
+        sq_->compute_codes(vector_head.Get(),
+                           sq_codes_ + (size_t)start_docid * sq_->code_size,
+                           count_per_index);
       }
 
-      if (!Add(count_per_index, add_vec)) {
+      if (!Add(count_per_index, vector_head.Get())) {
         LOG(ERROR) << "add index from docid " << start_docid << " error!";
         ret = -2;
       }
-
-      if (d_ > raw_d) {
-        delete add_vec;
-      }
     }
   }
   if (AddUpdatedVecToIndex()) {
     LOG(ERROR) << "add updated vectors to index error";
     return -1;
   }
+
+  if (retrain_imbalance_ > 0 && indexed_vec_count_ >= retrain_check_count_) {
+    retrain_check_count_ =
+        indexed_vec_count_ + std::max(indexed_vec_count_ / 10, (int)nlist);
+    double imbalance = ImbalanceFactor();
+    if (imbalance > retrain_imbalance_ && !retraining_) {
+      LOG(INFO) << "imbalance factor=" << imbalance << " exceeds "
+                << retrain_imbalance_ << ", start retraining";
+      StartRetrain();
+    }
+  }
   return ret;
 }  // namespace tig_gamma
 
@@ -272,35 +945,17 @@ int GammaIVFPQIndex::AddUpdatedVecToIndex() {
   if (vids.size() == 0) return 0;
   ScopeVectors<float> scope_vecs(vids.size());
   raw_vec_->Gets(vids.size(), vids.data(), scope_vecs);
-  int raw_d = raw_vec_->GetDimension();
-  for (size_t i = 0; i < vids.size(); i++) {
-    const float *vec = nullptr;
-    ScopeVector<float> del;
-    if (d_ > raw_d) {
-      float *extend_vec = new float[d_];
-      ConvertVectorDim(1, raw_d, d_, scope_vecs.Get(i), extend_vec);
-      vec = (const float *)extend_vec;
-      del.Set(extend_vec);
-    } else {
-      vec = scope_vecs.Get(i);
+  if (sq_codes_) {
+    for (size_t i = 0; i < vids.size(); i++) {
+      sq_->compute_codes(scope_vecs.Get(i),
+                         sq_codes_ + (size_t)vids[i] * sq_->code_size, 1);
     }
-    
-    idx_t idx = -1;
-    quantizer->assign(1, vec, &idx);
-
-    std::vector<uint8_t> xcodes;
-    xcodes.resize(code_size);
-    const float *to_encode = nullptr;
-    faiss::ScopeDeleter<float> del_to_encode;
-
-    if (by_residual) {
-      to_encode = compute_residuals(quantizer, 1, vec, &idx);
-      del_to_encode.set(to_encode);
-    } else {
-      to_encode = vec;
-    }
-    pq.compute_codes(to_encode, xcodes.data(), 1);
-    rt_invert_index_ptr_->Update(idx, vids[i], xcodes);
+  }
+  UpdateLists(*this, opq_, rt_invert_index_ptr_, vids, scope_vecs);
+  if (retraining_) {
+    // the shadow index may have encoded the old vectors
+    retrain_updated_vids_.insert(retrain_updated_vids_.end(), vids.begin(),
+                                 vids.end());
   }
   updated_num_ += vids.size();
   LOG(INFO) << "update index success! size=" << vids.size()
@@ -308,10 +963,57 @@ int GammaIVFPQIndex::AddUpdatedVecToIndex() {
   return 0;
 }
 
+void GammaIVFPQIndex::UpdateLists(const faiss::IndexIVFPQ &ivfpq,
+                                  const faiss::OPQMatrix *opq,
+                                  realtime::RTInvertIndex *rt_index,
+                                  const std::vector<long> &vids,
+                                  ScopeVectors<float> &vecs) const {
+  for (size_t i = 0; i < vids.size(); i++) {
+    if (vecs.Get(i) == nullptr) continue;
+    std::unique_ptr<float[]> rotated;
+    const float *vec = Rotate(opq, 1, vecs.Get(i), rotated);
+
+    idx_t idx = -1;
+    float dis;
+    CoarseSearch(ivfpq, 1, vec, 1, &dis, &idx);
+
+    std::vector<uint8_t> xcodes;
+    xcodes.resize(code_size);
+    ComputeCodes(ivfpq, 1, vec, &idx, xcodes.data());
+    rt_index->Update(idx, vids[i], xcodes);
+  }
+}
+
 bool GammaIVFPQIndex::Add(int n, const float *vec) {
 #ifdef PERFORMANCE_TESTING
   double t0 = faiss::getmillisecs();
 #endif
+  if (!AddToLists(*this, opq_, rt_invert_index_ptr_, indexed_vec_count_, n,
+                  vec)) {
+    return false;
+  }
+  indexed_vec_count_ += n;
+#ifdef PERFORMANCE_TESTING
+  add_count_ += n;
+  if (add_count_ >= 100000) {
+    double t1 = faiss::getmillisecs();
+    LOG(INFO) << "Add time [" << (t1 - t0) / n << "]ms, count "
+              << indexed_vec_count_;
+    // rt_invert_index_ptr_->PrintBucketSize();
+    add_count_ = 0;
+  }
+#endif
+  return true;
+}
+
+bool GammaIVFPQIndex::AddToLists(const faiss::IndexIVFPQ &ivfpq,
+                                 const faiss::OPQMatrix *opq,
+                                 realtime::RTInvertIndex *rt_index,
+                                 long start_vid, int n,
+                                 const float *vec) const {
+  std::unique_ptr<float[]> rotated;
+  vec = Rotate(opq, n, vec, rotated);
+
   std::map<int, std::vector<long>> new_keys;
   std::map<int, std::vector<uint8_t>> new_codes;
 
@@ -319,27 +1021,19 @@ bool GammaIVFPQIndex::Add(int n, const float *vec) {
   faiss::ScopeDeleter<idx_t> del_idx;
 
   idx_t *idx0 = new idx_t[n];
-  quantizer->assign(n, vec, idx0);
+  std::unique_ptr<float[]> coarse_dis(new float[n]);
+  CoarseSearch(ivfpq, n, vec, 1, coarse_dis.get(), idx0);
   idx = idx0;
   del_idx.set(idx);
 
   uint8_t *xcodes = new uint8_t[n * code_size];
   faiss::ScopeDeleter<uint8_t> del_xcodes(xcodes);
 
-  const float *to_encode = nullptr;
-  faiss::ScopeDeleter<float> del_to_encode;
-
-  if (by_residual) {
-    to_encode = compute_residuals(quantizer, n, vec, idx);
-    del_to_encode.set(to_encode);
-  } else {
-    to_encode = vec;
-  }
-  pq.compute_codes(to_encode, xcodes, n);
+  ComputeCodes(ivfpq, n, vec, idx, xcodes);
 
   size_t n_ignore = 0;
-  long vid = indexed_vec_count_;
-  for (int i = 0; i < n; i++) {
+  long vid = start_vid;
+  for (int i = 0; i < n; i++, vid++) {
     long key = idx[i];
     assert(key < (long)nlist);
     if (key < 0) {
@@ -347,10 +1041,9 @@ bool GammaIVFPQIndex::Add(int n, const float *vec) {
       continue;
     }
 
-    // long id = (long)(indexed_vec_count_++);
     uint8_t *code = xcodes + i * code_size;
 
-    new_keys[key].push_back(vid++);
+    new_keys[key].push_back(vid);
 
     size_t ofs = new_codes[key].size();
     new_codes[key].resize(ofs + code_size);
@@ -358,21 +1051,7 @@ bool GammaIVFPQIndex::Add(int n, const float *vec) {
   }
 
   /* stage 2 : add invert info to invert index */
-  if (!rt_invert_index_ptr_->AddKeys(new_keys, new_codes)) {
-    return false;
-  }
-  indexed_vec_count_ = vid;
-#ifdef PERFORMANCE_TESTING
-  add_count_ += n;
-  if (add_count_ >= 100000) {
-    double t1 = faiss::getmillisecs();
-    LOG(INFO) << "Add time [" << (t1 - t0) / n << "]ms, count "
-              << indexed_vec_count_;
-    // rt_invert_index_ptr_->PrintBucketSize();
-    add_count_ = 0;
-  }
-#endif
-  return true;
+  return rt_index->AddKeys(new_keys, new_codes);
 }
 
 void GammaIVFPQIndex::SearchIVFPQ(int n, const float *x,
@@ -389,7 +1068,9 @@ void GammaIVFPQIndex::SearchIVFPQ(int n, const float *x,
   std::unique_ptr<idx_t[]> idx(new idx_t[n * nprobe]);
   std::unique_ptr<float[]> coarse_dis(new float[n * nprobe]);
 
-  quantizer->search(n, x, nprobe, coarse_dis.get(), idx.get());
+  std::unique_ptr<float[]> rotated;
+  const float *xq = Rotate(opq_, n, x, rotated);
+  CoarseSearch(n, xq, nprobe, coarse_dis.get(), idx.get());
 
   this->invlists->prefetch_lists(idx.get(), n * nprobe);
 
@@ -397,8 +1078,59 @@ void GammaIVFPQIndex::SearchIVFPQ(int n, const float *x,
     search_ivf_flat(n, x, condition, idx.get(), coarse_dis.get(), distances, 
                     labels, total, false);
   else
-    search_preassigned(n, x, condition, idx.get(), coarse_dis.get(), distances,
-                     labels, total, false);
+    search_preassigned(n, x, xq, condition, idx.get(), coarse_dis.get(),
+                       distances, labels, total, false);
+}
+
+bool GammaIVFPQIndex::BuildVidFilter(int n, int nprobe,
+                                     const GammaSearchCondition *condition,
+                                     std::vector<char> &vid_bitmap,
+                                     long &vid_begin, long &vid_num) const {
+  const MultiRangeQueryResults *range = condition->range_query_result;
+  if (range == nullptr || range->GetAllResult() == nullptr) {
+    return false;
+  }
+
+  long total_vids = raw_vec_->GetVectorNum();
+  VIDMgr *vid_mgr = raw_vec_->vid_mgr_;
+  int max_docid = total_vids > 0 ? vid_mgr->VID2DocID(total_vids - 1) : -1;
+  int min_docid = std::max(range->Min(), 0);
+  max_docid = std::min(range->Max(), max_docid);
+  if (min_docid > max_docid) {
+    vid_begin = vid_num = 0;
+    vid_bitmap.assign(1, 0);
+    return true;
+  }
+
+  // the vids of the docs in [min_docid, max_docid] are contiguous, the
+  // bitmap only covers them
+  int start = -1;
+  vid_mgr->GetVIDRange(min_docid, start);
+  vid_begin = start;
+  int num = vid_mgr->GetVIDRange(max_docid, start);
+  vid_num = std::min((long)start + num, total_vids) - vid_begin;
+  if (vid_begin < 0 || vid_num < 0) vid_num = 0;
+
+  // each code to scan may need the docid lookups, each doc of the range is
+  // one lookup here and each byte of the bitmap is zeroed
+  long list_codes = indexed_vec_count_ / std::max(nlist, (size_t)1) + 1;
+  if ((long)max_docid - min_docid + 1 + (vid_num >> 3) >
+      (long)n * nprobe * list_codes) {
+    return false;
+  }
+
+  vid_bitmap.assign((vid_num >> 3) + 1, 0);
+  for (int docid = min_docid; docid <= max_docid; docid++) {
+    if (not range->Has(docid) || bitmap::test(docids_bitmap_, docid)) {
+      continue;
+    }
+    num = vid_mgr->GetVIDRange(docid, start);
+    long end = std::min((long)start + num, vid_begin + vid_num);
+    for (long vid = start; vid < end; vid++) {
+      bitmap::set(vid_bitmap.data(), vid - vid_begin);
+    }
+  }
+  return true;
 }
 
 namespace {
@@ -519,12 +1251,20 @@ void GammaIVFPQIndex::search_ivf_flat(
   // don't start parallel section if single query
   bool do_parallel = condition->parallel_mode == 0 ? n > 1 : nprobe > 1;
 
+  std::vector<char> vid_bitmap;
+  long vid_begin = 0, vid_num = 0;
+  bool vid_filter =
+      BuildVidFilter(n, nprobe, condition, vid_bitmap, vid_begin, vid_num);
+
   size_t ndis = 0;
 #pragma omp parallel if(do_parallel) reduction(+: ndis)
   {
     GammaInvertedListScanner *scanner = GetGammaIVFFlatScanner(raw_d);
     faiss::ScopeDeleter1<GammaInvertedListScanner> del(scanner);
     scanner->set_search_condition(condition);
+    if (vid_filter) {
+      scanner->set_vid_filter(vid_bitmap.data(), vid_begin, vid_num);
+    }
 
     /****************************************************
     * Actual loops, depending on parallel_mode
@@ -536,7 +1276,7 @@ void GammaIVFPQIndex::search_ivf_flat(
       for (int i = 0; i < n; i++) {
   
         // loop over queries
-        scanner->set_query (x + i * d);
+        scanner->set_query (x + i * raw_d);
         float * simi = distances + i * k;
         idx_t * idxi = labels + i * k;
   
@@ -565,7 +1305,7 @@ void GammaIVFPQIndex::search_ivf_flat(
       std::vector <float> local_dis (k);
   
       for (int i = 0; i < n; i++) {
-        scanner->set_query (x + i * d);
+        scanner->set_query (x + i * raw_d);
         init_result (metric_type, k, local_dis.data(), local_idx.data());
   
 #pragma omp for schedule(dynamic)
@@ -612,10 +1352,13 @@ void GammaIVFPQIndex::search_ivf_flat(
 }
 
 void GammaIVFPQIndex::search_preassigned(
-    int n, const float *x, GammaSearchCondition *condition, const idx_t *keys,
-    const float *coarse_dis, float *distances, idx_t *labels, int *total,
-    bool store_pairs, const faiss::IVFSearchParameters *params) {
+    int n, const float *x, const float *xq, GammaSearchCondition *condition,
+    const idx_t *keys, const float *coarse_dis, float *distances,
+    idx_t *labels, int *total, bool store_pairs,
+    const faiss::IVFSearchParameters *params) {
   int nprobe = condition->nprobe;
+  int raw_d = raw_vec_->GetDimension();
+  int query_d = InputDim();
 
   long max_codes = params ? params->max_codes : this->max_codes;
 
@@ -639,40 +1382,99 @@ void GammaIVFPQIndex::search_preassigned(
       compute_dis;
 
   if (condition->has_rank) {
+    auto fp16_raw_vec = dynamic_cast<Float16RawVector *>(raw_vec_);
+    // candidates kept by SQ8 before raw vectors are fetched
+    int sq_num = sq8_rerank_num_ > 0 ? sq8_rerank_num_ : 2 * k;
+    bool use_sq = sq_codes_ != nullptr && recall_num > sq_num;
     // calculate inner product for selected possible vectors
     compute_dis = [&](const float *xi, float *simi, idx_t *idxi,
                       float *recall_simi, idx_t *recall_idxi) {
-      ScopeVectors<float> scope_vecs(recall_num);
-      raw_vec_->Gets(recall_num, (long *)recall_idxi, scope_vecs);
-      const float **vecs = scope_vecs.Get();
-      int raw_d = raw_vec_->GetDimension();
-      for (int j = 0; j < recall_num; j++) {
-        if (recall_idxi[j] == -1) continue;
-        float dis = 0;
-        if (metric_type == faiss::METRIC_INNER_PRODUCT) {
-          dis = faiss::fvec_inner_product(xi, vecs[j], raw_d);
-        } else {
-          dis = faiss::fvec_L2sqr(xi, vecs[j], raw_d);
-        }
-
-        if (((condition->min_dist >= 0 && dis >= condition->min_dist) &&
-             (condition->max_dist >= 0 && dis <= condition->max_dist)) ||
-            (condition->min_dist == -1 && condition->max_dist == -1)) {
+      int cand_num = recall_num;
+      idx_t *cand_idxi = recall_idxi;
+      std::vector<float> sq_dis;
+      std::vector<idx_t> sq_idxi;
+      if (use_sq) {
+        // narrow PQ candidates with SQ8 codes which are cheap to read
+        sq_dis.resize(sq_num);
+        sq_idxi.resize(sq_num);
+        init_result(metric_type, sq_num, sq_dis.data(), sq_idxi.data());
+        std::unique_ptr<faiss::ScalarQuantizer::SQDistanceComputer> dc(
+            sq_->get_distance_computer(metric_type));
+        dc->set_query(xi);
+        for (int j = 0; j < recall_num; j++) {
+          if (recall_idxi[j] == -1) continue;
+          long id = recall_idxi[j];
+          float dis = dc->query_to_code(sq_codes_ + id * sq_->code_size);
           if (metric_type == faiss::METRIC_INNER_PRODUCT) {
-            if (HeapForIP::cmp(simi[0], dis)) {
-              faiss::heap_pop<HeapForIP>(k, simi, idxi);
-              long id = recall_idxi[j];
-              faiss::heap_push<HeapForIP>(k, simi, idxi, dis, id);
+            if (HeapForIP::cmp(sq_dis[0], dis)) {
+              faiss::heap_pop<HeapForIP>(sq_num, sq_dis.data(),
+                                         sq_idxi.data());
+              faiss::heap_push<HeapForIP>(sq_num, sq_dis.data(),
+                                          sq_idxi.data(), dis, id);
             }
           } else {
-            if (HeapForL2::cmp(simi[0], dis)) {
-              faiss::heap_pop<HeapForL2>(k, simi, idxi);
-              long id = recall_idxi[j];
-              faiss::heap_push<HeapForL2>(k, simi, idxi, dis, id);
+            if (HeapForL2::cmp(sq_dis[0], dis)) {
+              faiss::heap_pop<HeapForL2>(sq_num, sq_dis.data(),
+                                         sq_idxi.data());
+              faiss::heap_push<HeapForL2>(sq_num, sq_dis.data(),
+                                          sq_idxi.data(), dis, id);
             }
           }
         }
+        cand_num = sq_num;
+        cand_idxi = sq_idxi.data();
       }
+
+      // distances of the valid candidates, compacted in the order of ids
+      std::vector<float> cand_dis(cand_num);
+      std::vector<idx_t> cand_ids;
+      cand_ids.reserve(cand_num);
+      if (fp16_raw_vec != nullptr) {
+        // half precision vectors are compared without decoding
+        ScopeVectors<uint16_t> scope_vecs(cand_num);
+        fp16_raw_vec->GetFP16Vectors(cand_num, (long *)cand_idxi,
+                                     scope_vecs);
+        const uint16_t **vecs = scope_vecs.Get();
+        for (int j = 0; j < cand_num; j++) {
+          if (cand_idxi[j] == -1 || vecs[j] == nullptr) continue;
+          float *dis = cand_dis.data() + cand_ids.size();
+          if (metric_type == faiss::METRIC_INNER_PRODUCT) {
+            *dis = float16::inner_product(xi, vecs[j], raw_d);
+          } else {
+            *dis = float16::L2sqr(xi, vecs[j], raw_d);
+          }
+          cand_ids.push_back(cand_idxi[j]);
+        }
+      } else {
+        ScopeVectors<float> scope_vecs(cand_num);
+        raw_vec_->Gets(cand_num, (long *)cand_idxi, scope_vecs);
+        std::vector<const float *> vecs;
+        vecs.reserve(cand_num);
+        for (int j = 0; j < cand_num; j++) {
+          if (cand_idxi[j] == -1 || scope_vecs.Get(j) == nullptr) continue;
+          vecs.push_back(scope_vecs.Get(j));
+          cand_ids.push_back(cand_idxi[j]);
+        }
+        rerank::compute_distances(
+            metric_type == faiss::METRIC_INNER_PRODUCT, xi, raw_d,
+            vecs.size(), vecs.data(), cand_dis.data());
+      }
+
+      int selected = 0;
+      for (size_t j = 0; j < cand_ids.size(); j++) {
+        float dis = cand_dis[j];
+        if (((condition->min_dist >= 0 && dis >= condition->min_dist) &&
+             (condition->max_dist >= 0 && dis <= condition->max_dist)) ||
+            (condition->min_dist == -1 && condition->max_dist == -1)) {
+          cand_dis[selected] = dis;
+          cand_ids[selected] = cand_ids[j];
+          selected++;
+        }
+      }
+      // simi and idxi are initialized, the slots after the selected keep -1
+      rerank::select(metric_type == faiss::METRIC_INNER_PRODUCT, selected,
+                     cand_dis.data(), cand_ids.data(), k, simi, idxi);
+
       if (condition->sort_by_docid) {  // sort by doc id
         std::vector<std::pair<idx_t, float>> id_sim_pairs;
         for (int i = 0; i < k; i++) {
@@ -683,8 +1485,6 @@ void GammaIVFPQIndex::search_preassigned(
           idxi[i] = id_sim_pairs[i].first;
           simi[i] = id_sim_pairs[i].second;
         }
-      } else {  // sort by distance
-        reorder_result(metric_type, k, simi, idxi);
       }
     };
   } else {
@@ -718,10 +1518,10 @@ void GammaIVFPQIndex::search_preassigned(
     ni_total = condition->range_query_result->GetAllResult()->Size();
   }
 
+#ifdef SMALL_DOC_NUM_OPTIMIZATION
   // don't start parallel section if single query
   bool do_parallel = condition->parallel_mode == 0 ? n > 1 : nprobe > 1;
 
-#ifdef SMALL_DOC_NUM_OPTIMIZATION
   double s_start = utils::getmillisecs();
   if (condition->range_query_result &&
       condition->range_query_result->GetAllResult() != nullptr &&
@@ -734,21 +1534,21 @@ void GammaIVFPQIndex::search_preassigned(
                              docid_size > 1000 ? 1000 : docid_size, ',');
 #endif
 
-    std::vector<int> vid_list(docid_list.size() * MAX_VECTOR_NUM_PER_DOC);
-    int *vid_list_data = vid_list.data();
-    int *curr_ptr = vid_list_data;
+    std::vector<int> vid_list;
+    vid_list.reserve(docid_list.size());
     for (size_t i = 0; i < docid_list.size(); i++) {
       if (bitmap::test(this->docids_bitmap_, docid_list[i])) {
         continue;
       }
 
-      int *vids = this->raw_vec_->docid2vid_[docid_list[i]];
-      if (vids) {
-        memcpy((void *)(curr_ptr), (void *)(vids + 1), sizeof(int) * vids[0]);
-        curr_ptr += vids[0];
+      int start = -1;
+      int num = this->raw_vec_->vid_mgr_->GetVIDRange(docid_list[i], start);
+      for (int j = 0; j < num; j++) {
+        vid_list.push_back(start + j);
       }
     }
-    int vid_list_len = curr_ptr - vid_list_data;
+    int *vid_list_data = vid_list.data();
+    int vid_list_len = vid_list.size();
 
 #ifdef PERFORMANCE_TESTING
     double to_vid_end = utils::getmillisecs();
@@ -779,8 +1579,8 @@ void GammaIVFPQIndex::search_preassigned(
         double query_start = utils::getmillisecs();
 #endif
 
-        const float *xi = x + i * d;
-        scanner->set_query(x + i * d);
+        const float *xi = x + i * raw_d;
+        scanner->set_query(xq + i * query_d);
 
         float *simi = distances + i * k;
         idx_t *idxi = labels + i * k;
@@ -835,108 +1635,107 @@ void GammaIVFPQIndex::search_preassigned(
   }
 #endif  // SMALL_DOC_NUM_OPTIMIZATION
 
-#pragma omp parallel if (do_parallel) reduction(+ : ndis)
+  // shared by the scanners of all threads, they only read it
+  std::vector<char> vid_bitmap;
+  long vid_begin = 0, vid_num = 0;
+  bool vid_filter =
+      BuildVidFilter(n, nprobe, condition, vid_bitmap, vid_begin, vid_num);
+
+  // work items are (query, range of probes) in query order, the threads
+  // claim them from a shared counter until all are taken. Probes of a query
+  // are split into ranges only if the queries are too few to keep every
+  // thread busy, so a single query is scanned by all of them
+  int nt = omp_get_max_threads();
+  int ranges = (kWorkItemsPerThread * nt + n - 1) / n;
+  ranges = std::max(1, std::min(nprobe, ranges));
+  int probes_per_item = (nprobe + ranges - 1) / ranges;
+  ranges = (nprobe + probes_per_item - 1) / probes_per_item;
+  long item_num = (long)n * ranges;
+  std::atomic<long> next_item(0);
+
+  // every item of a split query has its own heap, they are merged by the
+  // thread which reranks the query, so no lock is needed
+  std::vector<float> item_dis;
+  std::vector<idx_t> item_ids;
+  if (ranges > 1) {
+    item_dis.resize(item_num * recall_num);
+    item_ids.resize(item_num * recall_num);
+  }
+
+#pragma omp parallel if (item_num > 1) reduction(+ : ndis)
   {
     GammaInvertedListScanner *scanner =
         GetGammaInvertedListScanner(store_pairs);
     faiss::ScopeDeleter1<GammaInvertedListScanner> del(scanner);
     scanner->set_search_condition(condition);
+    if (vid_filter) {
+      scanner->set_vid_filter(vid_bitmap.data(), vid_begin, vid_num);
+    }
 
-    if (condition->parallel_mode == 0) {  // parallelize over queries
-#pragma omp for
-      for (int i = 0; i < n; i++) {
-        // loop over queries
-        const float *xi = x + i * d;
-        scanner->set_query(x + i * d);
-        float *simi = distances + i * k;
-        idx_t *idxi = labels + i * k;
-
-        float *recall_simi = recall_distances + i * recall_num;
-        idx_t *recall_idxi = recall_labels + i * recall_num;
-
-        init_result(metric_type, k, simi, idxi);
-        init_result(metric_type, recall_num, recall_simi, recall_idxi);
-
-        long nscan = 0;
-
-        // loop over probes
-        for (int ik = 0; ik < nprobe; ik++) {
-          nscan +=
-              scan_one_list(scanner, keys[i * nprobe + ik], 
-                  coarse_dis[i * nprobe + ik], recall_simi, 
-                  recall_idxi, recall_num, this->nlist,
-                  this->invlists, store_pairs, condition->ivf_flat);
-
-          if (max_codes && nscan >= max_codes) break;
-        }
-        total[i] = ni_total;
-
-        ndis += nscan;
-        compute_dis(xi, simi, idxi, recall_simi, recall_idxi);
-      }       // parallel for
-    } else {  // parallelize over inverted lists
-      std::vector<idx_t> local_idx(recall_num);
-      std::vector<float> local_dis(recall_num);
-
-      for (int i = 0; i < n; i++) {
-        const float *xi = x + i * d;
-        scanner->set_query(xi);
+    int query = -1;
+    for (long item = next_item++; item < item_num; item = next_item++) {
+      int i = item / ranges;
+      int ik0 = (item % ranges) * probes_per_item;
+      int ik1 = std::min(nprobe, ik0 + probes_per_item);
+      if (i != query) {
+        scanner->set_query(xq + i * query_d);
+        query = i;
+      }
 
-        init_result(metric_type, recall_num, local_dis.data(), local_idx.data());
+      float *heap_dis = nullptr;
+      idx_t *heap_ids = nullptr;
+      if (ranges > 1) {
+        heap_dis = item_dis.data() + item * recall_num;
+        heap_ids = item_ids.data() + item * recall_num;
+      } else {
+        heap_dis = recall_distances + i * recall_num;
+        heap_ids = recall_labels + i * recall_num;
+      }
+      init_result(metric_type, recall_num, heap_dis, heap_ids);
+
+      long nscan = 0;
+      for (int ik = ik0; ik < ik1; ik++) {
+        nscan += scan_one_list(scanner, keys[i * nprobe + ik],
+                               coarse_dis[i * nprobe + ik], heap_dis,
+                               heap_ids, recall_num, this->nlist,
+                               this->invlists, store_pairs,
+                               condition->ivf_flat);
+
+        // can't do the test on max_codes if the query is split
+        if (ranges == 1 && max_codes && nscan >= max_codes) break;
+      }
+      ndis += nscan;
+    }
 
+    // the items of a query may be scanned by any thread
+#pragma omp barrier
 #pragma omp for schedule(dynamic)
-        for (int ik = 0; ik < nprobe; ik++) {
-          ndis +=
-              scan_one_list(scanner, keys[i * nprobe + ik], 
-                  coarse_dis[i * nprobe + ik], local_dis.data(), 
-                  local_idx.data(), recall_num, this->nlist,
-                  this->invlists, store_pairs, condition->ivf_flat);
-
-          // can't do the test on max_codes
-        }
-
-        total[i] = ni_total;
+    for (int i = 0; i < n; i++) {
+      float *simi = distances + i * k;
+      idx_t *idxi = labels + i * k;
 
-        // merge thread-local results
-
-        float *simi = distances + i * k;
-        idx_t *idxi = labels + i * k;
+      float *recall_simi = recall_distances + i * recall_num;
+      idx_t *recall_idxi = recall_labels + i * recall_num;
 
-        float *recall_simi = recall_distances + i * recall_num;
-        idx_t *recall_idxi = recall_labels + i * recall_num;
-
-#pragma omp single
-        {
-          init_result(metric_type, k, simi, idxi);
-          init_result(metric_type, recall_num, recall_simi, recall_idxi);
-        }
-
-#pragma omp barrier
-#pragma omp critical
-        {
+      if (ranges > 1) {
+        init_result(metric_type, recall_num, recall_simi, recall_idxi);
+        for (int r = 0; r < ranges; r++) {
+          size_t offset = ((size_t)i * ranges + r) * recall_num;
           if (metric_type == faiss::METRIC_INNER_PRODUCT) {
             faiss::heap_addn<HeapForIP>(recall_num, recall_simi, recall_idxi,
-                                        local_dis.data(), local_idx.data(),
-                                        recall_num);
+                                        item_dis.data() + offset,
+                                        item_ids.data() + offset, recall_num);
           } else {
             faiss::heap_addn<HeapForL2>(recall_num, recall_simi, recall_idxi,
-                                        local_dis.data(), local_idx.data(),
-                                        recall_num);
+                                        item_dis.data() + offset,
+                                        item_ids.data() + offset, recall_num);
           }
         }
-#pragma omp barrier
-#pragma omp single
-        {
-#ifdef PERFORMANCE_TESTING
-          condition->Perf("coarse");
-#endif
-          compute_dis(xi, simi, idxi, recall_simi, recall_idxi);
-
-#ifdef PERFORMANCE_TESTING
-          condition->Perf("reorder");
-#endif
-        }
       }
+      total[i] = ni_total;
+
+      init_result(metric_type, k, simi, idxi);
+      compute_dis(x + i * raw_d, simi, idxi, recall_simi, recall_idxi);
     }
   }  // parallel
 
@@ -954,6 +1753,8 @@ int GammaIVFPQIndex::Search(const VectorQuery *query,
   int raw_d = raw_vec_->GetDimension();
   size_t n = query->value->len / (raw_d * sizeof(float));
 
+  // a retrained index isn't swapped in until the search is finished
+  ReadThreadLock read_lock(shared_mutex_);
   if (condition->metric_type == InnerProduct) {
     metric_type = faiss::METRIC_INNER_PRODUCT;
   } else {
@@ -961,26 +1762,11 @@ int GammaIVFPQIndex::Search(const VectorQuery *query,
   }
   idx_t *idx = reinterpret_cast<idx_t *>(result.docids);
 
-  float *vec_q = nullptr;
-
-  if (d > raw_d) {
-    float *vec = new float[n * d];
-
-    ConvertVectorDim(n, raw_d, d, x, vec);
-
-    vec_q = vec;
-  } else {
-    vec_q = x;
-  }
-
+  // queries keep the raw dimension, the padding is implicit
   if (condition->use_direct_search) {
-    SearchDirectly(n, vec_q, condition, result.dists, idx, result.total.data());
+    SearchDirectly(n, x, condition, result.dists, idx, result.total.data());
   } else {
-    SearchIVFPQ(n, vec_q, condition, result.dists, idx, result.total.data());
-  }
-
-  if (d > raw_d) {
-    delete vec_q;
+    SearchIVFPQ(n, x, condition, result.dists, idx, result.total.data());
   }
 
   for (size_t i = 0; i < n; i++) {
@@ -1276,6 +2062,7 @@ int GammaIVFPQIndex::Dump(const std::string &dir, int max_vid) {
   }
   string vec_name = raw_vec_->GetName();
   string info_file = dir + "/" + vec_name + ".index.param";
+  ReadThreadLock read_lock(shared_mutex_);
   faiss::IOWriter *f = new FileIOWriter(info_file.c_str());
   const IndexIVFPQ *ivpq = static_cast<const IndexIVFPQ *>(this);
   write_ivf_header(ivpq, f);
@@ -1284,6 +2071,22 @@ int GammaIVFPQIndex::Dump(const std::string &dir, int max_vid) {
   tig_gamma::write_ProductQuantizer(&ivpq->pq, f);
   delete f;
 
+  if (sq_codes_) {
+    // only the trained ranges are dumped, codes are rebuilt when loading
+    string sq_file = dir + "/" + vec_name + ".sq8.param";
+    f = new FileIOWriter(sq_file.c_str());
+    WRITEVECTOR(sq_->trained);
+    delete f;
+  }
+
+  if (opq_) {
+    // the quantizers are trained in the rotated space, it must be restored
+    string opq_file = dir + "/" + vec_name + ".opq.param";
+    f = new FileIOWriter(opq_file.c_str());
+    WRITEVECTOR(opq_->A);
+    delete f;
+  }
+
   LOG(INFO) << "dump: d=" << ivpq->d << ", ntotal=" << ivpq->ntotal
             << ", is_trained=" << ivpq->is_trained
             << ", metric_type=" << ivpq->metric_type
@@ -1304,6 +2107,60 @@ int GammaIVFPQIndex::Dump(const std::string &dir, int max_vid) {
   return 0;
 }
 
+int GammaIVFPQIndex::LoadSQ8(const std::string &dir) {
+  string sq_file = dir + "/" + raw_vec_->GetName() + ".sq8.param";
+  if (access(sq_file.c_str(), F_OK) != 0) {
+    // dumped before sq8 rerank was enabled, train it with a sample of the
+    // stored vectors, the same way as IVFPQ is trained
+    long total = raw_vec_->GetVectorNum();
+    long num = std::min(total, 100000L);
+    if (num == 0) return AllocSQ8Codes();
+    std::vector<float> sample;
+    if (SampleTrainingVectors(total, num, sample)) {
+      LOG(ERROR) << "sample sq8 training vectors error";
+      return -1;
+    }
+    LOG(INFO) << sq_file << " isn't existed, train sq8 with " << num << "/"
+              << total << " vectors";
+    return TrainSQ8(num, sample.data());
+  }
+  faiss::IOReader *f = new FileIOReader(sq_file.c_str());
+  READVECTOR(sq_->trained);
+  delete f;
+  if (sq_->trained.size() != 2 * (size_t)sq_->d) {
+    LOG(ERROR) << "invalid sq8 trained size=" << sq_->trained.size()
+               << ", d=" << sq_->d;
+    return -1;
+  }
+  return AllocSQ8Codes();
+}
+
+int GammaIVFPQIndex::LoadOPQ(const std::string &dir) {
+  string opq_file = dir + "/" + raw_vec_->GetName() + ".opq.param";
+  if (access(opq_file.c_str(), F_OK) != 0) {
+    if (opq_) {
+      LOG(WARNING) << opq_file << " isn't existed, the index is trained "
+                   << "without opq, disable it";
+      delete opq_;
+      opq_ = nullptr;
+    }
+    return 0;
+  }
+  if (opq_ == nullptr) {
+    LOG(INFO) << "the index is trained with opq, enable it";
+    EnableOPQ();
+  }
+  faiss::IOReader *f = new FileIOReader(opq_file.c_str());
+  READVECTOR(opq_->A);
+  delete f;
+  if (opq_->A.size() != (size_t)d * d) {
+    LOG(ERROR) << "invalid opq matrix size=" << opq_->A.size() << ", d=" << d;
+    return -1;
+  }
+  opq_->is_trained = true;
+  return 0;
+}
+
 int GammaIVFPQIndex::Load(const std::vector<std::string> &index_dirs) {
   if (!rt_invert_index_ptr_) {
     return -1;
@@ -1319,11 +2176,23 @@ int GammaIVFPQIndex::Load(const std::vector<std::string> &index_dirs) {
 
   faiss::IOReader *f = new FileIOReader(info_file.c_str());
   IndexIVFPQ *ivpq = static_cast<IndexIVFPQ *>(this);
+  faiss::Index *old_quantizer = ivpq->quantizer;
   read_ivf_header(ivpq, f, nullptr);  // not legacy
+  delete old_quantizer;
   READ1(ivpq->by_residual);
   READ1(ivpq->code_size);
   read_ProductQuantizer(&ivpq->pq, f);
 
+  if (quantizer_ef_search_ > 0) {
+    // efSearch of the configuration rather than the dumped one
+    auto hnsw = dynamic_cast<faiss::IndexHNSWFlat *>(ivpq->quantizer);
+    if (hnsw) {
+      hnsw->hnsw.efSearch = quantizer_ef_search_;
+    } else {
+      LOG(WARNING) << "hnsw quantizer is enabled, but the loaded one isn't";
+    }
+  }
+
   // precomputed table not stored. It is cheaper to recompute it
   ivpq->use_precomputed_table = 0;
   if (ivpq->by_residual) ivpq->precompute_table();
@@ -1338,6 +2207,16 @@ int GammaIVFPQIndex::Load(const std::vector<std::string> &index_dirs) {
   /* indexed_vec_count_ = rt_invert_index_ptr_->Load(index_dirs, vec_name); */
   indexed_vec_count_ = 0;
 
+  if (LoadOPQ(index_dirs[index_dirs.size() - 1])) {
+    LOG(ERROR) << "load opq error";
+    return -1;
+  }
+
+  if (sq_ && LoadSQ8(index_dirs[index_dirs.size() - 1])) {
+    LOG(ERROR) << "load sq8 error";
+    return -1;
+  }
+
   LOG(INFO) << "load: d=" << ivpq->d << ", ntotal=" << ivpq->ntotal
             << ", is_trained=" << ivpq->is_trained
             << ", metric_type=" << ivpq->metric_type
@@ -1345,6 +2224,8 @@ int GammaIVFPQIndex::Load(const std::vector<std::string> &index_dirs) {
             << ivpq->nprobe
             // << ", maintain_direct_map=" << ivpq->maintain_direct_map
             << ", by_residual=" << ivpq->by_residual
+            << ", use_precomputed_table=" << ivpq->use_precomputed_table
+            << ", opq=" << (opq_ != nullptr)
             << ", code_size=" << ivpq->code_size << ", pq: d=" << ivpq->pq.d
             << ", M=" << ivpq->pq.M << ", nbits=" << ivpq->pq.nbits
             << ", indexed vector count=" << indexed_vec_count_;
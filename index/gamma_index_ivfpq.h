@@ -20,14 +20,20 @@
 #ifndef GAMMA_INDEX_IVFPQ_H_
 #define GAMMA_INDEX_IVFPQ_H_
 
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <atomic>
+#include <memory>
+#include <thread>
 
 #include "faiss/IndexIVF.h"
 #include "faiss/IndexIVFPQ.h"
 #include "faiss/InvertedLists.h"
+#include "faiss/VectorTransform.h"
 #include "faiss/impl/FaissAssert.h"
+#include "faiss/impl/ScalarQuantizer.h"
 #include "faiss/impl/io.h"
 #include "faiss/index_io.h"
 #include "faiss/utils/Heap.h"
@@ -39,8 +45,11 @@
 #include "gamma_index.h"
 #include "gamma_index_flat.h"
 #include "log.h"
+#include "pq4_fast_scan.h"
+#include "pq8_scan.h"
 #include "raw_vector.h"
 #include "realtime_invert_index.h"
+#include "thread_util.h"
 
 namespace tig_gamma {
 
@@ -81,6 +90,68 @@ static uint64_t get_cycles() {
 #define TIC t0 = get_cycles()
 #define TOC get_cycles() - t0
 
+/** The index dimension d is rounded up to a multiple of M, while the raw
+ * vectors and queries keep raw_d components. The missing components are
+ * taken as zero, so vectors are never copied to padded buffers: only the
+ * centroids and sub-quantizers read past raw_d.
+ */
+
+/** distance (L2) or inner product (IP) tables of x against every
+ * sub-quantizer of pq, x has raw_d components
+ */
+inline void ComputePaddedTable(const faiss::ProductQuantizer &pq,
+                               const float *x, size_t raw_d,
+                               faiss::MetricType metric, float *tab) {
+  bool ip = metric == faiss::METRIC_INNER_PRODUCT;
+  if (raw_d >= pq.d) {
+    if (ip)
+      pq.compute_inner_prod_table(x, tab);
+    else
+      pq.compute_distance_table(x, tab);
+    return;
+  }
+  for (size_t m = 0; m < pq.M; m++) {
+    size_t begin = m * pq.dsub;
+    size_t valid = raw_d > begin ? std::min(raw_d - begin, pq.dsub) : 0;
+    const float *centroids = pq.centroids.data() + m * pq.ksub * pq.dsub;
+    float *tab_m = tab + m * pq.ksub;
+    if (valid == pq.dsub) {
+      if (ip)
+        faiss::fvec_inner_products_ny(tab_m, x + begin, centroids, pq.dsub,
+                                      pq.ksub);
+      else
+        faiss::fvec_L2sqr_ny(tab_m, x + begin, centroids, pq.dsub, pq.ksub);
+      continue;
+    }
+    // the zero tail adds nothing to IP and the centroid tail norm to L2
+    for (size_t j = 0; j < pq.ksub; j++) {
+      const float *c = centroids + j * pq.dsub;
+      float dis = 0;
+      if (ip) {
+        if (valid > 0) dis = faiss::fvec_inner_product(x + begin, c, valid);
+      } else {
+        if (valid > 0) dis = faiss::fvec_L2sqr(x + begin, c, valid);
+        dis += faiss::fvec_norm_L2sqr(c + valid, pq.dsub - valid);
+      }
+      tab_m[j] = dis;
+    }
+  }
+}
+
+/** residual of x (raw_d components) to centroid key, it has d components */
+inline void ComputePaddedResidual(const faiss::Index *quantizer,
+                                  const float *x, size_t raw_d, idx_t key,
+                                  float *residual) {
+  size_t d = quantizer->d;
+  if (raw_d >= d) {
+    quantizer->compute_residual(x, residual, key);
+    return;
+  }
+  quantizer->reconstruct(key, residual);
+  for (size_t j = 0; j < raw_d; j++) residual[j] = x[j] - residual[j];
+  for (size_t j = raw_d; j < d; j++) residual[j] = -residual[j];
+}
+
 /** QueryTables manages the various ways of searching an
  * IndexIVFPQ. The code contains a lot of branches, depending on:
  * - metric_type: are we computing L2 or Inner product similarity?
@@ -98,6 +169,7 @@ struct QueryTables {
 
   // copied from IndexIVFPQ for easier access
   int d;
+  int raw_d;  // components of the queries, d if not padded
   const faiss::ProductQuantizer &pq;
   faiss::MetricType metric_type;
   bool by_residual;
@@ -118,6 +190,7 @@ struct QueryTables {
                        const faiss::IVFSearchParameters *params)
       : ivfpq(ivfpq),
         d(ivfpq.d),
+        raw_d(ivfpq.d),
         pq(ivfpq.pq),
         metric_type(ivfpq.metric_type),
         by_residual(ivfpq.by_residual),
@@ -155,19 +228,28 @@ struct QueryTables {
       init_query_IP();
     else
       init_query_L2();
-    if (!by_residual && polysemous_ht != 0) pq.compute_code(qi, q_code.data());
+    if (!by_residual && polysemous_ht != 0) {
+      if (raw_d == d) {
+        pq.compute_code(qi, q_code.data());
+      } else {
+        // sim_table_2 is not used without residuals
+        ComputePaddedTable(pq, qi, raw_d, faiss::METRIC_L2, sim_table_2);
+        pq.compute_code_from_distance_table(sim_table_2, q_code.data());
+      }
+    }
   }
 
   void init_query_IP() {
     // precompute some tables specific to the query qi
-    pq.compute_inner_prod_table(qi, sim_table);
+    ComputePaddedTable(pq, qi, raw_d, faiss::METRIC_INNER_PRODUCT, sim_table);
   }
 
   void init_query_L2() {
     if (!by_residual) {
-      pq.compute_distance_table(qi, sim_table);
+      ComputePaddedTable(pq, qi, raw_d, faiss::METRIC_L2, sim_table);
     } else if (use_precomputed_table) {
-      pq.compute_inner_prod_table(qi, sim_table_2);
+      ComputePaddedTable(pq, qi, raw_d, faiss::METRIC_INNER_PRODUCT,
+                         sim_table_2);
     }
   }
 
@@ -222,11 +304,11 @@ struct QueryTables {
     // and dis0, the initial value
     ivfpq.quantizer->reconstruct(key, decoded_vec);
     // decoded_vec = centroid
-    float dis0 = faiss::fvec_inner_product(qi, decoded_vec, d);
+    float dis0 = faiss::fvec_inner_product(qi, decoded_vec, raw_d);
 
     if (polysemous_ht) {
       for (int i = 0; i < d; i++) {
-        residual_vec[i] = qi[i] - decoded_vec[i];
+        residual_vec[i] = (i < raw_d ? qi[i] : 0) - decoded_vec[i];
       }
       pq.compute_code(residual_vec, q_code.data());
     }
@@ -241,7 +323,7 @@ struct QueryTables {
     float dis0 = 0;
 
     if (use_precomputed_table == 0 || use_precomputed_table == -1) {
-      ivfpq.quantizer->compute_residual(qi, residual_vec, key);
+      ComputePaddedResidual(ivfpq.quantizer, qi, raw_d, key, residual_vec);
       pq.compute_distance_table(residual_vec, sim_table);
 
       if (polysemous_ht != 0) {
@@ -256,7 +338,7 @@ struct QueryTables {
                        sim_table_2, sim_table);
 
       if (polysemous_ht != 0) {
-        ivfpq.quantizer->compute_residual(qi, residual_vec, key);
+        ComputePaddedResidual(ivfpq.quantizer, qi, raw_d, key, residual_vec);
         pq.compute_code(residual_vec, q_code.data());
       }
 
@@ -388,7 +470,8 @@ struct IVFPQScannerT : QueryTables {
   explicit IVFPQScannerT(const faiss::IndexIVFPQ &ivfpq,
                          const faiss::IVFSearchParameters *params)
       : QueryTables(ivfpq, params) {
-    FAISS_THROW_IF_NOT(pq.nbits == 8);
+    // the scans of this class read 8-bit codes, 4-bit ones only use tables
+    FAISS_THROW_IF_NOT(pq.nbits == 8 || pq.nbits == 4);
     assert(METRIC_TYPE == metric_type);
   }
 
@@ -428,17 +511,20 @@ struct IVFPQScannerT : QueryTables {
   void scan_on_the_fly_dist(size_t ncode, const uint8_t *codes,
                             SearchResultType &res) const {
     const float *dvec;
+    int dvec_d;  // the residual has all d components, the query raw_d
     float dis0 = 0;
     if (by_residual) {
       if (METRIC_TYPE == faiss::METRIC_INNER_PRODUCT) {
         ivfpq.quantizer->reconstruct(key, residual_vec);
-        dis0 = faiss::fvec_inner_product(residual_vec, qi, d);
+        dis0 = faiss::fvec_inner_product(residual_vec, qi, raw_d);
       } else {
-        ivfpq.quantizer->compute_residual(qi, residual_vec, key);
+        ComputePaddedResidual(ivfpq.quantizer, qi, raw_d, key, residual_vec);
       }
       dvec = residual_vec;
+      dvec_d = d;
     } else {
       dvec = qi;
+      dvec_d = raw_d;
       dis0 = 0;
     }
 
@@ -448,9 +534,12 @@ struct IVFPQScannerT : QueryTables {
 
       float dis;
       if (METRIC_TYPE == faiss::METRIC_INNER_PRODUCT) {
-        dis = dis0 + faiss::fvec_inner_product(decoded_vec, qi, d);
+        dis = dis0 + faiss::fvec_inner_product(decoded_vec, qi, raw_d);
       } else {
-        dis = faiss::fvec_L2sqr(decoded_vec, dvec, d);
+        dis = faiss::fvec_L2sqr(decoded_vec, dvec, dvec_d);
+        if (dvec_d < d) {
+          dis += faiss::fvec_norm_L2sqr(decoded_vec + dvec_d, d - dvec_d);
+        }
       }
       res.add(j, dis);
     }
@@ -524,6 +613,9 @@ struct GammaInvertedListScanner : faiss::InvertedListScanner {
     docids_bitmap_ = nullptr;
     raw_vec_ = nullptr;
     range_index_ptr_ = nullptr;
+    vid_bitmap_ = nullptr;
+    vid_begin_ = 0;
+    vid_num_ = 0;
   }
 
   virtual size_t scan_codes_pointer(size_t ncode, const uint8_t **codes,
@@ -552,190 +644,168 @@ struct GammaInvertedListScanner : faiss::InvertedListScanner {
     this->range_index_ptr_ = condition->range_query_result;
   }
 
+  /** allow-list of the search indexed by vid, it replaces the docid
+   * lookups of the range filter and the deleted docs
+   *
+   * @param vid_bitmap  bit vid - vid_begin is set if vid passes the
+   *                    filters, see GammaIVFPQIndex::BuildVidFilter
+   * @param vid_begin   vids before vid_begin are filtered
+   * @param vid_num     vids from vid_begin + vid_num are filtered
+   */
+  inline void set_vid_filter(const char *vid_bitmap, long vid_begin,
+                             long vid_num) {
+    vid_bitmap_ = vid_bitmap;
+    vid_begin_ = vid_begin;
+    vid_num_ = vid_num;
+  }
+
+  /// the vid is recovered from kDelIdxMask
+  inline bool VidAllowed(long vid) const {
+    vid -= vid_begin_;
+    return vid >= 0 && vid < vid_num_ &&
+           ((vid_bitmap_[vid >> 3] >> (vid & 7)) & 1);
+  }
+
+  /// filters of a vid which is not deleted in the inverted lists
+  inline bool IsFiltered(long vid) const {
+    if (vid_bitmap_) return !VidAllowed(vid);
+    int doc_id = raw_vec_->vid_mgr_->VID2DocID(vid);
+    return (range_index_ptr_ != nullptr &&
+            (not range_index_ptr_->Has(doc_id))) ||
+           bitmap::test(docids_bitmap_, doc_id);
+  }
+
   const char *docids_bitmap_;
   const RawVector<float> *raw_vec_;
   MultiRangeQueryResults *range_index_ptr_;
+  const char *vid_bitmap_;
+  long vid_begin_;
+  long vid_num_;
 };
 
 template <faiss::MetricType METRIC_TYPE, class C, int precompute_mode>
 struct GammaIVFPQScanner : IVFPQScannerT<idx_t, METRIC_TYPE>,
                            GammaInvertedListScanner {
   bool store_pairs_;
-
-  GammaIVFPQScanner(const faiss::IndexIVFPQ &ivfpq, bool store_pairs)
+  mutable std::vector<uint8_t> batch_codes_;  // codes of scan_codes_pointer
+
+  /// L2 by residual with precomputed tables, the table of a list is
+  /// coarse_dis + precomputed_table[key] - 2 * query table. Summing them
+  /// costs M * ksub per list, so it is only done for lists of ksub codes
+  /// or more, the codes of shorter lists add the terms from table pointers
+  bool lazy_table_;
+  mutable bool list_table_ready_;
+
+  /**
+   * @param raw_d  components of the queries, the rest are taken as zero
+   */
+  GammaIVFPQScanner(const faiss::IndexIVFPQ &ivfpq, bool store_pairs,
+                    int raw_d)
       : IVFPQScannerT<idx_t, METRIC_TYPE>(ivfpq, nullptr) {
     store_pairs_ = store_pairs;
+    this->raw_d = raw_d;
+    batch_codes_.resize(this->pq.code_size * pq8::kBatchSize);
+    lazy_table_ = precompute_mode == 2 && METRIC_TYPE == faiss::METRIC_L2 &&
+                  this->by_residual && this->use_precomputed_table == 1 &&
+                  this->polysemous_ht == 0;
+    list_table_ready_ = false;
   }
 
-  template <class SearchResultType>
-  void scan_list_with_table(size_t ncode, const uint8_t *codes,
-                            SearchResultType &res) const {
-    assert(this->pq.M % 4 == 0);
-
-    // set filter func
-    std::function<bool(int)> is_filterable;
+  /// @return false if the codes of the list are scanned with table pointers
+  inline bool PrepareListTable(size_t ncode) const {
+    if (!lazy_table_ || list_table_ready_) return true;
+    if (ncode < this->pq.ksub) return false;
+    // sim_table_ptrs[0] is the whole precomputed table of the list
+    faiss::fvec_madd(this->pq.M * this->pq.ksub, this->sim_table_ptrs[0], -2.0,
+                     this->sim_table_2, this->sim_table);
+    list_table_ready_ = true;
+    return true;
+  }
 
-    if (range_index_ptr_ != nullptr) {
-      is_filterable = [this](int doc_id) -> bool {
-        return (bitmap::test(docids_bitmap_, doc_id) ||
-                (not range_index_ptr_->Has(doc_id)));
-      };
-    } else {
-      is_filterable = [this](int doc_id) -> bool {
-        return (bitmap::test(docids_bitmap_, doc_id));
-      };
+  /// distances of n contiguous codes with the table pointers
+  inline void PointerDistances(const uint8_t *codes, size_t n,
+                               float *dis) const {
+    size_t M = this->pq.M;
+    for (size_t j = 0; j < n; j++) {
+      float d = this->dis0;
+      const float *tab = this->sim_table_2;
+      for (size_t m = 0; m < M; m++) {
+        int ci = *codes++;
+        d += this->sim_table_ptrs[m][ci] - 2 * tab[ci];
+        tab += this->pq.ksub;
+      }
+      dis[j] = d;
     }
+  }
 
-    // set compute distance func
-    std::function<float(const uint8_t *)> calc_dis;
-
-    if (this->pq.M % 4 == 0) {
-      calc_dis = [this](const uint8_t *codes) -> float {
-        float dis = this->dis0;
-        const float *tab = this->sim_table;
-
-        for (size_t m = 0; m < this->pq.M; m += 4) {
-          dis += tab[*codes++], tab += this->pq.ksub;
-          dis += tab[*codes++], tab += this->pq.ksub;
-          dis += tab[*codes++], tab += this->pq.ksub;
-          dis += tab[*codes++], tab += this->pq.ksub;
-        }
-
-        return dis;
-      };
-    } else {
-      calc_dis = [this](const uint8_t *codes) -> float {
-        float dis = this->dis0;
-        const float *tab = this->sim_table;
+  /// codes are scanned in batches of pq8::kBatchSize, the distances of a
+  /// batch come from the vectorized kernel and deleted vectors are masked
+  /// out with the ones which can not enter the heap, so the filters which
+  /// look up docids only run for the few candidates left. With a vid
+  /// allow-list the filters are part of the mask too
+  ///
+  /// @param get_batch  get_batch(j0, n) is the n contiguous codes from j0
+  /// @param ids        null if the codes are already filtered
+  template <class GetBatch, class SearchResultType>
+  void scan_batches(size_t ncode, const GetBatch &get_batch, const idx_t *ids,
+                    SearchResultType &res) const {
+    size_t M = this->pq.M;
+    float dis[pq8::kBatchSize];
+    bool less = METRIC_TYPE != faiss::METRIC_INNER_PRODUCT;
+    bool use_table = PrepareListTable(ncode);
+
+    for (size_t j0 = 0; j0 < ncode; j0 += pq8::kBatchSize) {
+      size_t n = std::min(ncode - j0, (size_t)pq8::kBatchSize);
+      const uint8_t *batch = get_batch(j0, n);
+      if (use_table) {
+        pq8::compute_distances(M, this->sim_table, this->dis0, batch, n, dis);
+      } else {
+        PointerDistances(batch, n, dis);
+      }
 
-        for (size_t m = 0; m < this->pq.M; m++) {
-          dis += tab[*codes++], tab += this->pq.ksub;
+      uint64_t skipped =
+          ids ? pq8::skipped(ids + j0, n, vid_bitmap_, vid_begin_, vid_num_)
+              : 0;
+      uint64_t mask = pq8::select(dis, n, res.heap_sim[0], less) & ~skipped;
+
+      while (mask) {
+        int v = __builtin_ctzll(mask);
+        mask &= mask - 1;
+        // the heap top may have moved inside the batch
+        if (!C::cmp(res.heap_sim[0], dis[v])) continue;
+        size_t j = j0 + v;
+        if (ids && !vid_bitmap_ &&
+            IsFiltered(ids[j] & realtime::kRecoverIdxMask)) {
+          continue;
         }
+        res.add(j, dis[v]);
+      }
+    }
+  }
 
-        return dis;
-      };
-    }
-
-#define HANDLE_ONE                                                             \
-  do {                                                                         \
-    if (res.ids[j] & realtime::kDelIdxMask) {                                  \
-      codes += this->pq.M;                                                     \
-      j++;                                                                     \
-      continue;                                                                \
-    }                                                                          \
-    int doc_id =                                                               \
-        raw_vec_->vid_mgr_->VID2DocID(res.ids[j] & realtime::kRecoverIdxMask); \
-    if ((range_index_ptr_ != nullptr &&                                        \
-         (not range_index_ptr_->Has(doc_id))) ||                               \
-        bitmap::test(docids_bitmap_, doc_id)) {                                \
-      codes += this->pq.M; /* increment pointer */                             \
-      j++;                 /* increment j*/                                    \
-      continue;                                                                \
-    }                                                                          \
-                                                                               \
-    float dis = this->dis0;                                                    \
-    const float *tab = this->sim_table;                                        \
-    for (size_t m = 0; m < this->pq.M; m += 4) {                               \
-      dis += tab[*codes++], tab += this->pq.ksub;                              \
-      dis += tab[*codes++], tab += this->pq.ksub;                              \
-      dis += tab[*codes++], tab += this->pq.ksub;                              \
-      dis += tab[*codes++], tab += this->pq.ksub;                              \
-    }                                                                          \
-                                                                               \
-    res.add(j, dis);                                                           \
-                                                                               \
-    j++; /* increment j */                                                     \
-  } while (0)
-    size_t j = 0;
-    size_t loops = ncode / 8;
-    for (size_t i = 0; i < loops; i++) {
-      HANDLE_ONE;  // 1
-      HANDLE_ONE;  // 2
-      HANDLE_ONE;  // 3
-      HANDLE_ONE;  // 4
-      HANDLE_ONE;  // 5
-      HANDLE_ONE;  // 6
-      HANDLE_ONE;  // 7
-      HANDLE_ONE;  // 8
-    }
-
-    switch (ncode % 8) {
-      case 7:
-        HANDLE_ONE;
-      case 6:
-        HANDLE_ONE;
-      case 5:
-        HANDLE_ONE;
-      case 4:
-        HANDLE_ONE;
-      case 3:
-        HANDLE_ONE;
-      case 2:
-        HANDLE_ONE;
-      case 1:
-        HANDLE_ONE;
-    }
-
-    assert(j == ncode);
-
-#undef HANDLE_ONE
+  template <class SearchResultType>
+  void scan_list_with_table(size_t ncode, const uint8_t *codes,
+                            const idx_t *ids, SearchResultType &res) const {
+    size_t M = this->pq.M;
+    auto get_batch = [codes, M](size_t j0, size_t n) -> const uint8_t * {
+      return codes + j0 * M;
+    };
+    scan_batches(ncode, get_batch, ids, res);
   }
 
   template <class SearchResultType>
   void scan_list_with_table(size_t ncode, const uint8_t **codes,
                             SearchResultType &res) const {
-    assert(this->pq.M % 4 == 0);
-
-#define HANDLE_ONE                               \
-  do {                                           \
-    float dis = this->dis0;                      \
-    const float *tab = this->sim_table;          \
-    const uint8_t *code = codes[j];              \
-    for (size_t m = 0; m < this->pq.M; m += 4) { \
-      dis += tab[*code++], tab += this->pq.ksub; \
-      dis += tab[*code++], tab += this->pq.ksub; \
-      dis += tab[*code++], tab += this->pq.ksub; \
-      dis += tab[*code++], tab += this->pq.ksub; \
-    }                                            \
-                                                 \
-    res.add(j, dis);                             \
-                                                 \
-    j++; /* increment j */                       \
-  } while (0)
-
-    size_t j = 0;
-    size_t loops = ncode / 8;
-    for (size_t i = 0; i < loops; i++) {
-      HANDLE_ONE;  // 1
-      HANDLE_ONE;  // 2
-      HANDLE_ONE;  // 3
-      HANDLE_ONE;  // 4
-      HANDLE_ONE;  // 5
-      HANDLE_ONE;  // 6
-      HANDLE_ONE;  // 7
-      HANDLE_ONE;  // 8
-    }
-
-    switch (ncode % 8) {
-      case 7:
-        HANDLE_ONE;
-      case 6:
-        HANDLE_ONE;
-      case 5:
-        HANDLE_ONE;
-      case 4:
-        HANDLE_ONE;
-      case 3:
-        HANDLE_ONE;
-      case 2:
-        HANDLE_ONE;
-      case 1:
-        HANDLE_ONE;
-    }
-
-    assert(j == ncode);
-
-#undef HANDLE_ONE
+    size_t M = this->pq.M;
+    uint8_t *batch = batch_codes_.data();
+    auto get_batch = [codes, M, batch](size_t j0,
+                                       size_t n) -> const uint8_t * {
+      for (size_t v = 0; v < n; v++) {
+        memcpy(batch + v * M, codes[j0 + v], M);
+      }
+      return batch;
+    };
+    scan_batches(ncode, get_batch, nullptr, res);
   }
 
   inline void set_query(const float *query) override {
@@ -743,12 +813,22 @@ struct GammaIVFPQScanner : IVFPQScannerT<idx_t, METRIC_TYPE>,
   }
 
   inline void set_list(idx_t list_no, float coarse_dis) override {
-    this->init_list(list_no, coarse_dis, precompute_mode);
+    if (lazy_table_) {
+      // only pointers and dis0, see PrepareListTable
+      this->init_list(list_no, coarse_dis, 1);
+      list_table_ready_ = false;
+    } else {
+      this->init_list(list_no, coarse_dis, precompute_mode);
+    }
   }
 
   inline float distance_to_code(const uint8_t *code) const override {
     assert(precompute_mode == 2);
     float dis = this->dis0;
+    if (lazy_table_ && !list_table_ready_) {
+      PointerDistances(code, 1, &dis);
+      return dis;
+    }
     const float *tab = this->sim_table;
 
     for (size_t m = 0; m < this->pq.M; m++) {
@@ -772,7 +852,7 @@ struct GammaIVFPQScanner : IVFPQScannerT<idx_t, METRIC_TYPE>,
       assert(precompute_mode == 2);
       this->scan_list_polysemous(ncode, codes, res);
     } else if (precompute_mode == 2) {
-      this->scan_list_with_table(ncode, codes, res);
+      this->scan_list_with_table(ncode, codes, ids, res);
     } else if (precompute_mode == 1) {
       this->scan_list_with_pointer(ncode, codes, res);
     } else if (precompute_mode == 0) {
@@ -802,6 +882,153 @@ struct GammaIVFPQScanner : IVFPQScannerT<idx_t, METRIC_TYPE>,
   }
 };
 
+/** scanner of 4-bit PQ codes (nbits_per_idx = 4), see pq4_fast_scan.h.
+ * The lists keep one code after another as they are appended, updated and
+ * compacted in place, their blocks of 32 transposed codes are kept in a
+ * pq4::BlockCache and only packed again when the codes change. The 16-bit
+ * sums only bound the PQ distances: lanes which may enter the heap are
+ * filtered and get the exact float distance, so results are the same as a
+ * table scan while most codes never reach the filters.
+ */
+template <faiss::MetricType METRIC_TYPE, class C>
+struct GammaIVFPQFastScanScanner : IVFPQScannerT<idx_t, METRIC_TYPE>,
+                                   GammaInvertedListScanner {
+  bool store_pairs_;
+  std::vector<uint8_t> lut_;
+  mutable std::vector<uint8_t> block_;  // transposed codes of one block
+  float lut_bias_;
+  float lut_scale_;
+  pq4::BlockCache *block_cache_;       // null if blocks are not kept
+  realtime::RTInvertIndex *rt_index_;  // versions of the cached lists
+
+  GammaIVFPQFastScanScanner(const faiss::IndexIVFPQ &ivfpq, bool store_pairs,
+                            int raw_d)
+      : IVFPQScannerT<idx_t, METRIC_TYPE>(ivfpq, nullptr) {
+    FAISS_THROW_IF_NOT(this->pq.nbits == 4);
+    FAISS_THROW_IF_NOT_MSG(this->polysemous_ht == 0,
+                           "polysemous is not supported by fast scan");
+    store_pairs_ = store_pairs;
+    this->raw_d = raw_d;
+    lut_.resize(this->pq.M * pq4::kSubCentroids);
+    block_.resize(this->pq.code_size * pq4::kBlockSize);
+    lut_bias_ = 0;
+    lut_scale_ = 1;
+    block_cache_ = nullptr;
+    rt_index_ = nullptr;
+  }
+
+  /// blocks of the lists of rt_index are taken from block_cache
+  inline void set_block_cache(pq4::BlockCache *block_cache,
+                              realtime::RTInvertIndex *rt_index) {
+    block_cache_ = block_cache;
+    rt_index_ = rt_index;
+  }
+
+  inline void set_query(const float *query) override {
+    this->init_query(query);
+  }
+
+  inline void set_list(idx_t list_no, float coarse_dis) override {
+    this->init_list(list_no, coarse_dis, 2);
+    pq4::quantize_lut(this->pq.M, this->sim_table, lut_.data(), &lut_bias_,
+                      &lut_scale_);
+  }
+
+  inline float distance_to_code(const uint8_t *code) const override {
+    return pq4::distance(this->pq.M, code, this->sim_table, this->dis0);
+  }
+
+  /// get_code(j) is the code of the j-th vector, accept(j) the filters,
+  /// blocks the packed codes or null if they are packed here
+  template <class GetCode, class Accept>
+  void scan_blocks(size_t ncode, const GetCode &get_code, const Accept &accept,
+                   const uint8_t *blocks, KnnSearchResults<C> &res) const {
+    size_t M = this->pq.M;
+    size_t block_bytes = this->pq.code_size * pq4::kBlockSize;
+    double bias = (double)this->dis0 + lut_bias_;
+    const uint8_t *rows[pq4::kBlockSize];
+
+    for (size_t j0 = 0; j0 < ncode; j0 += pq4::kBlockSize) {
+      size_t n = std::min(ncode - j0, (size_t)pq4::kBlockSize);
+      const uint8_t *block = nullptr;
+      if (blocks) {
+        block = blocks + j0 / pq4::kBlockSize * block_bytes;
+      } else {
+        for (size_t v = 0; v < n; v++) rows[v] = get_code(j0 + v);
+        pq4::pack_block(rows, this->pq.code_size, n, block_.data());
+        block = block_.data();
+      }
+
+      // the heap top only gets better inside the block
+      uint32_t mask;
+      if (METRIC_TYPE == faiss::METRIC_INNER_PRODUCT) {
+        int threshold =
+            pq4::threshold_greater(M, res.heap_sim[0], bias, lut_scale_);
+        mask = pq4::accumulate_block(M, block, lut_.data(), n, threshold,
+                                     false, nullptr);
+      } else {
+        int threshold = pq4::threshold_less(res.heap_sim[0], bias, lut_scale_);
+        mask = pq4::accumulate_block(M, block, lut_.data(), n, threshold,
+                                     true, nullptr);
+      }
+
+      while (mask) {
+        int v = __builtin_ctz(mask);
+        mask &= mask - 1;
+        size_t j = j0 + v;
+        if (!accept(j)) continue;
+        res.add(j, pq4::distance(M, get_code(j), this->sim_table, this->dis0));
+      }
+    }
+  }
+
+  inline size_t scan_codes(size_t ncode, const uint8_t *codes, const idx_t *ids,
+                           float *heap_sim, idx_t *heap_ids,
+                           size_t k) const override {
+    KnnSearchResults<C> res = {/* key */ this->key,
+                               /* ids */ this->store_pairs_ ? nullptr : ids,
+                               /* k */ k,
+                               /* heap_sim */ heap_sim,
+                               /* heap_ids */ heap_ids,
+                               /* nup */ 0};
+
+    size_t code_size = this->pq.code_size;
+    auto get_code = [codes, code_size](size_t j) -> const uint8_t * {
+      return codes + j * code_size;
+    };
+    // the same filters as the 8-bit scanner, only for candidates
+    auto accept = [this, ids](size_t j) -> bool {
+      if (ids[j] & realtime::kDelIdxMask) return false;
+      return !IsFiltered(ids[j] & realtime::kRecoverIdxMask);
+    };
+    std::shared_ptr<const pq4::PackedList> packed;
+    if (block_cache_) {
+      long version = rt_index_->GetCodeVersion(this->key);
+      packed = block_cache_->get(this->key, codes, ncode, version);
+    }
+    scan_blocks(ncode, get_code, accept,
+                packed ? packed->blocks.data() : nullptr, res);
+    return 0;
+  }
+
+  inline size_t scan_codes_pointer(size_t ncode, const uint8_t **codes,
+                                   const idx_t *ids, float *heap_sim,
+                                   idx_t *heap_ids, size_t k) override {
+    KnnSearchResults<C> res = {/* key */ this->key,
+                               /* ids */ this->store_pairs_ ? nullptr : ids,
+                               /* k */ k,
+                               /* heap_sim */ heap_sim,
+                               /* heap_ids */ heap_ids,
+                               /* nup */ 0};
+
+    // codes are retrieved by vid, they have been filtered
+    auto get_code = [codes](size_t j) -> const uint8_t * { return codes[j]; };
+    auto accept = [](size_t j) -> bool { return true; };
+    scan_blocks(ncode, get_code, accept, nullptr, res);
+    return 0;
+  }
+};
+
 template<faiss::MetricType metric, class C>
 struct GammaIVFFlatScanner: GammaInvertedListScanner {
   size_t d;
@@ -831,20 +1058,6 @@ struct GammaIVFFlatScanner: GammaInvertedListScanner {
                        float *simi, idx_t *idxi,
                        size_t k) const override
   {
-    // set filter func
-    std::function<bool(int)> is_filterable;
-
-    if (range_index_ptr_ != nullptr) {
-      is_filterable = [this](int doc_id) -> bool {
-        return (bitmap::test(docids_bitmap_, doc_id) ||
-                (not range_index_ptr_->Has(doc_id)));
-      };
-    } else {
-      is_filterable = [this](int doc_id) -> bool {
-        return (bitmap::test(docids_bitmap_, doc_id));
-      };
-    }
-
     const float *list_vecs = (const float*)codes;
     size_t nup = 0;
     for (size_t j = 0; j < list_size; j++) {
@@ -853,7 +1066,7 @@ struct GammaIVFFlatScanner: GammaInvertedListScanner {
       if(vid < 0) continue;
       int doc_id = raw_vec_->vid_mgr_->VID2DocID(vid);
       if(doc_id < 0) continue;
-      if(is_filterable(doc_id)) continue;
+      if(IsFiltered(vid)) continue;
 
       const float *yj = list_vecs + d * vid;
       float dis = metric == faiss::METRIC_INNER_PRODUCT ?
@@ -887,19 +1100,131 @@ struct GammaIVFPQIndex : GammaFLATIndex, faiss::IndexIVFPQ {
 
   GammaInvertedListScanner *GetGammaInvertedListScanner(bool store_pairs) const;
 
+  /** train with a uniform random sample of the stored vectors, the coarse
+   * centroids are seeded by k-means++ and PQ is trained with the residuals
+   * to them, training cost and quantization errors are logged
+   */
   int Indexing() override;
 
+  /**
+   * @param training_size    training vectors, 0 means max(100000, 39 * nlist)
+   * @param kmeans_plusplus  seed the coarse centroids by k-means++
+   */
+  void SetTrainingParams(int training_size, bool kmeans_plusplus);
+
+  /** train the quantizer and PQ of ivfpq with a sample of the first total
+   * vectors, the quantizer of ivfpq is reset
+   *
+   * @param opq            rotation trained before the quantizers, the
+   *                       training vectors are rotated by it, it may be null
+   * @param sample(output) training vectors with the raw dimension
+   * @return training vector number, -1 if error
+   */
+  long Train(faiss::IndexIVFPQ &ivfpq, faiss::OPQMatrix *opq, long total,
+             std::vector<float> &sample);
+
+  /** n of total vectors drawn uniformly, with the raw dimension
+   *
+   * @return 0 if successed
+   */
+  int SampleTrainingVectors(long total, long n, std::vector<float> &sample);
+
+  /// k-means of the coarse centroids, they are added to the quantizer
+  void TrainCoarse(faiss::IndexIVFPQ &ivfpq, long n, const float *x);
+
+  /// mean squared errors of the coarse centroids and of PQ
+  void TrainingError(const faiss::IndexIVFPQ &ivfpq, long n, const float *x,
+                     float &coarse_mse, float &pq_mse) const;
+
+  /** retrain the quantizer and PQ with the stored vectors and re-encode all
+   * of them to a shadow realtime index, which is swapped in at last. Searches
+   * go on with the current index meanwhile, they only wait for the swap of
+   * pointers. Vectors added or updated during the rebuild are caught up
+   * before the swap
+   *
+   * @return 0 if successed
+   */
+  int Retrain();
+
+  /// Retrain in a background thread, -1 if one is running
+  int StartRetrain();
+
+  /** start a background retrain when the imbalance factor of the lists
+   * exceeds imbalance, it is checked whenever the indexed vectors grow by a
+   * tenth
+   *
+   * @param imbalance  > 1, 0 disables it
+   */
+  void EnableAutoRetrain(double imbalance);
+
+  /// nlist * sum(list size ^ 2) / total ^ 2, 1 if the lists are even
+  double ImbalanceFactor() const;
+
   int AddRTVecsToIndex() override;
 
+  /** add vectors with the raw dimension to the realtime index, they are
+   * padded to d implicitly
+   */
   bool Add(int n, const float *vec);
 
+  /** encode n vectors with the raw dimension by opq (if not null), the
+   * quantizer and PQ of ivfpq, then add them to rt_index with vids from
+   * start_vid
+   */
+  bool AddToLists(const faiss::IndexIVFPQ &ivfpq, const faiss::OPQMatrix *opq,
+                  realtime::RTInvertIndex *rt_index, long start_vid, int n,
+                  const float *vec) const;
+
+  /// re-encode the updated vectors of vids and move them in rt_index
+  void UpdateLists(const faiss::IndexIVFPQ &ivfpq, const faiss::OPQMatrix *opq,
+                   realtime::RTInvertIndex *rt_index,
+                   const std::vector<long> &vids,
+                   ScopeVectors<float> &vecs) const;
+
+  /** the OPQ rotation is applied to vectors and queries before the coarse
+   * quantizer and PQ. Vectors are padded to d first, the rotation mixes all
+   * components, so the padding isn't implicit any more. Raw vectors and
+   * rerank are not affected, the rotation keeps distances
+   */
+  void EnableOPQ();
+
+  /** vectors of n x raw dimension padded and rotated by opq, x itself if opq
+   * is null
+   *
+   * @param rotated  buffer of the rotated vectors
+   */
+  const float *Rotate(const faiss::OPQMatrix *opq, int n, const float *x,
+                      std::unique_ptr<float[]> &rotated) const;
+
+  /// components of the vectors given to the quantizer and PQ
+  int InputDim() const { return opq_ ? d : raw_vec_->GetDimension(); }
+
+  /** coarse search of vectors with InputDim() components
+   *
+   * @param k  nearest centroids per vector
+   */
+  void CoarseSearch(const faiss::IndexIVFPQ &ivfpq, int n, const float *x,
+                    int k, float *distances, idx_t *labels) const;
+
+  void CoarseSearch(int n, const float *x, int k, float *distances,
+                    idx_t *labels) const {
+    CoarseSearch(*this, n, x, k, distances, labels);
+  }
+
+  /** PQ codes of vectors with InputDim() components, by residual to list_nos
+   * if by_residual
+   */
+  void ComputeCodes(const faiss::IndexIVFPQ &ivfpq, int n, const float *x,
+                    const idx_t *list_nos, uint8_t *codes) const;
+
   int Update(int doc_id, const float *vec) { return -1; }
   int AddUpdatedVecToIndex();
 
   int Search(const VectorQuery *query, GammaSearchCondition *condition,
              VectorResult &result) override;
 
-  void search_preassigned(int n, const float *x,
+  /// xq is x rotated by OPQ for the scanners, x is for rerank
+  void search_preassigned(int n, const float *x, const float *xq,
                           GammaSearchCondition *condition, const idx_t *keys,
                           const float *coarse_dis, float *distances,
                           idx_t *labels, int *total, bool store_pairs,
@@ -915,11 +1240,29 @@ struct GammaIVFPQIndex : GammaFLATIndex, faiss::IndexIVFPQ {
   void SearchIVFPQ(int n, const float *x, GammaSearchCondition *condition,
                    float *distances, idx_t *labels, int *total);
 
+  /** allow-list by vid of the range filter of condition without the deleted
+   * docs, one bit test per code instead of the docid lookups. It is built
+   * once for the n queries, only if there is a range filter and the docs of
+   * its range are not many more than the codes the queries will scan
+   *
+   * @param vid_bitmap(output) bit vid - vid_begin is set if vid is allowed
+   * @param vid_begin(output) first vid of the docs in the range
+   * @param vid_num(output) vids covered by vid_bitmap from vid_begin
+   * @return true if it is built
+   */
+  bool BuildVidFilter(int n, int nprobe, const GammaSearchCondition *condition,
+                      std::vector<char> &vid_bitmap, long &vid_begin,
+                      long &vid_num) const;
+
   long GetTotalMemBytes() override {
+    ReadThreadLock read_lock(shared_mutex_);
     if (!rt_invert_index_ptr_) {
       return 0;
     }
-    return rt_invert_index_ptr_->GetTotalMemBytes();
+    // only pages of the indexed vectors are committed in the sq8 arena
+    long sq_bytes = sq_codes_ ? (long)indexed_vec_count_ * sq_->code_size : 0;
+    long block_bytes = pq4_blocks_ ? pq4_blocks_->mem_bytes() : 0;
+    return rt_invert_index_ptr_->GetTotalMemBytes() + sq_bytes + block_bytes;
   }
 
   int Dump(const std::string &dir, int max_vid) override;
@@ -931,14 +1274,71 @@ struct GammaIVFPQIndex : GammaFLATIndex, faiss::IndexIVFPQ {
 
   int Delete(int docid);
 
+  /** the quantizer is an HNSW graph of the centroids (faiss::IndexHNSWFlat)
+   * for large nlist. k-means assigns with a flat index, the graph is built
+   * once with the trained centroids
+   *
+   * @param ef_search  efSearch of search and Add assignment, it is kept
+   *                   when the quantizer is loaded
+   */
+  void EnableHNSWQuantizer(int ef_search);
+
+  /** keep an 8-bit scalar quantized copy of raw vectors, the rerank becomes
+   * PQ recall -> SQ8 -> raw vectors, only sq8_rerank_num candidates are
+   * fetched from raw vectors
+   *
+   * @param sq8_rerank_num candidates kept by SQ8, 0 means 2 * topn
+   */
+  void EnableSQ8Rerank(int sq8_rerank_num);
+
+  /** train per dimension min/max of SQ8 with raw vectors
+   *
+   * @return 0 if successed
+   */
+  int TrainSQ8(size_t n, const float *x);
+
+  int AllocSQ8Codes();
+
+  int LoadSQ8(const std::string &dir);
+
+  int LoadOPQ(const std::string &dir);
+
+  /// empty IndexIVFPQ with the structure of this one, it owns the quantizer
+  faiss::IndexIVFPQ *NewShadowIndex() const;
+
+  int DoRetrain();
+
   int indexed_vec_count_;
   realtime::RTInvertIndex *rt_invert_index_ptr_;
+  pq4::BlockCache *pq4_blocks_;  // null if nbits_per_idx isn't 4
   bool compaction_;
   size_t compact_bucket_no_;
   uint64_t compacted_num_;
   GammaCounters *gamma_counters_;
   uint64_t updated_num_;
 
+  int quantizer_ef_search_;  // 0 if the quantizer is not HNSW
+  int training_size_;
+  bool kmeans_plusplus_;
+
+  // searches hold the read lock, the swap of a retrained index the write one
+  pthread_rwlock_t shared_mutex_;
+  // adds to the realtime index and the catch-up of a retrain
+  pthread_mutex_t add_mutex_;
+  std::thread retrain_thread_;
+  std::atomic<bool> retraining_;
+  std::vector<long> retrain_updated_vids_;  // updated during a retrain
+  pthread_mutex_t retrain_del_mutex_;
+  std::vector<int> retrain_deleted_vids_;  // deleted during a retrain
+  double retrain_imbalance_;  // 0 if the automatic retrain is disabled
+  int retrain_check_count_;   // indexed vectors of the next imbalance check
+
+  faiss::OPQMatrix *opq_;       // null if OPQ is disabled
+  faiss::ScalarQuantizer *sq_;  // null if SQ8 rerank is disabled
+  uint8_t *sq_codes_;           // SQ8 codes indexed by vector id
+  size_t sq_codes_size_;        // reserved bytes of sq_codes_
+  int sq8_rerank_num_;
+
 #ifdef PERFORMANCE_TESTING
   std::atomic<uint64_t> search_count_;
   int add_count_;
@@ -13,6 +13,7 @@
 #include <fstream>
 #include <string>
 
+#include "memory_policy.h"
 #include "utils.h"
 
 using std::move;
@@ -50,11 +51,11 @@ Profile::Profile(const int max_doc_size, const string &root_path) {
 
 Profile::~Profile() {
   if (mem_ != nullptr) {
-    delete[] mem_;
+    utils::FreeLarge(mem_, (size_t)max_profile_size_ * item_length_);
   }
 
   if (str_mem_ != nullptr) {
-    delete[] str_mem_;
+    utils::FreeLarge(str_mem_, max_str_size_);
   }
 
 #ifdef WITH_ROCKSDB
@@ -183,14 +184,19 @@ int Profile::CreateTable(const Table *table) {
   id_type_ = table->id_type;
 
   if (mem_) {
-    delete[] mem_;
+    utils::FreeLarge(mem_, (size_t)max_profile_size_ * item_length_);
   }
   if (str_mem_) {
-    delete[] str_mem_;
+    utils::FreeLarge(str_mem_, max_str_size_);
   }
 
-  mem_ = new char[max_profile_size_ * item_length_];
-  str_mem_ = new char[max_str_size_];
+  mem_ = (char *)utils::AllocLarge((size_t)max_profile_size_ * item_length_,
+                                   "profile");
+  str_mem_ = (char *)utils::AllocLarge(max_str_size_, "profile string");
+  if (mem_ == nullptr || str_mem_ == nullptr) {
+    LOG(ERROR) << "alloc profile memory error!";
+    return -1;
+  }
 
 #ifdef WITH_ROCKSDB
   // open DB
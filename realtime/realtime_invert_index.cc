@@ -114,6 +114,14 @@ int RTInvertIndex::Delete(int *vids, int n) {
   return cur_ptr_->Delete(vids, n);
 }
 
+int RTInvertIndex::RecountDeleted(int *vids, int n) {
+  return cur_ptr_->RecountDeleted(vids, n);
+}
+
+long RTInvertIndex::GetCodeVersion(int bucket_no) {
+  return cur_ptr_->GetCodeVersion(bucket_no);
+}
+
 RTInvertedLists::RTInvertedLists(realtime::RTInvertIndex *rt_invert_index_ptr,
                                  size_t nlist, size_t code_size)
     : InvertedLists(nlist, code_size),
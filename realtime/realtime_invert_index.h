@@ -63,6 +63,8 @@ struct RTInvertIndex {
   void PrintBucketSize();
   int CompactIfNeed();
   int Delete(int *vids, int n);
+  int RecountDeleted(int *vids, int n);
+  long GetCodeVersion(int bucket_no);
 
  private:
   size_t nlist_;
@@ -10,8 +10,10 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <set>
 #include "bitmap.h"
 #include "log.h"
+#include "memory_policy.h"
 #include "utils.h"
 
 namespace tig_gamma {
@@ -27,6 +29,7 @@ RTInvertBucketData::RTInvertBucketData(RTInvertBucketData *other) {
   docids_bitmap_ = other->docids_bitmap_;
   vid_bucket_no_pos_ = other->vid_bucket_no_pos_;
   deleted_nums_ = other->deleted_nums_;
+  code_versions_ = other->code_versions_;
   compacted_num_ = other->compacted_num_;
   buckets_num_ = other->buckets_num_;
 }
@@ -42,6 +45,7 @@ RTInvertBucketData::RTInvertBucketData(VIDMgr *vid_mgr,
   docids_bitmap_ = docids_bitmap;
   vid_bucket_no_pos_ = nullptr;
   deleted_nums_ = nullptr;
+  code_versions_ = nullptr;
   compacted_num_ = 0;
   buckets_num_ = 0;
 }
@@ -57,18 +61,25 @@ bool RTInvertBucketData::Init(const size_t &buckets_num,
   codes_array_ = new (std::nothrow) uint8_t *[buckets_num];
   cur_bucket_keys_ = new (std::nothrow) int[buckets_num];
   deleted_nums_ = new (std::nothrow) std::atomic<int>[buckets_num];
+  code_versions_ = new (std::nothrow) std::atomic<long>[buckets_num];
   if (idx_array_ == nullptr || codes_array_ == nullptr ||
-      cur_bucket_keys_ == nullptr || deleted_nums_ == nullptr)
+      cur_bucket_keys_ == nullptr || deleted_nums_ == nullptr ||
+      code_versions_ == nullptr)
     return false;
   for (size_t i = 0; i < buckets_num; i++) {
     idx_array_[i] = new (std::nothrow) long[bucket_keys];
     codes_array_[i] =
         new (std::nothrow) uint8_t[bucket_keys * code_bytes_per_vec];
     if (idx_array_[i] == nullptr || codes_array_[i] == nullptr) return false;
+    utils::AdviseLarge(idx_array_[i], bucket_keys * sizeof(long));
+    utils::AdviseLarge(codes_array_[i], bucket_keys * code_bytes_per_vec);
     cur_bucket_keys_[i] = bucket_keys;
     deleted_nums_[i] = 0;
+    code_versions_[i] = 0;
   }
-  vid_bucket_no_pos_ = new std::atomic<long>[max_vec_size];
+  vid_bucket_no_pos_ = (std::atomic<long> *)utils::AllocLarge(
+      max_vec_size * sizeof(std::atomic<long>), "vid bucket pos");
+  if (vid_bucket_no_pos_ == nullptr) return false;
   for (int i = 0; i < max_vec_size; i++) vid_bucket_no_pos_[i] = -1;
 
   total_mem_bytes += buckets_num * bucket_keys * sizeof(long);
@@ -158,6 +169,7 @@ bool RTInvertBucketData::ExtendBucketMem(const size_t &bucket_no,
   memcpy((void *)extend_code_bytes_array, (void *)codes_array_[bucket_no],
          sizeof(uint8_t) * cur_bucket_keys_[bucket_no] * code_bytes_per_vec);
   codes_array_[bucket_no] = extend_code_bytes_array;
+  utils::AdviseLarge(extend_code_bytes_array, extend_size * code_bytes_per_vec);
   total_mem_bytes += extend_size * code_bytes_per_vec * sizeof(uint8_t);
 
   long *extend_idx_array = new (std::nothrow) long[extend_size];
@@ -168,6 +180,7 @@ bool RTInvertBucketData::ExtendBucketMem(const size_t &bucket_no,
   memcpy((void *)extend_idx_array, (void *)idx_array_[bucket_no],
          sizeof(long) * cur_bucket_keys_[bucket_no]);
   idx_array_[bucket_no] = extend_idx_array;
+  utils::AdviseLarge(extend_idx_array, extend_size * sizeof(long));
   total_mem_bytes += extend_size * sizeof(long);
 
   cur_bucket_keys_[bucket_no] = extend_size;
@@ -206,6 +219,18 @@ void RTInvertBucketData::Delete(int vid) {
   deleted_nums_[bucket_no]++;
 }
 
+void RTInvertBucketData::RecountDeleted(const size_t &bucket_no) {
+  long *idx_array = idx_array_[bucket_no];
+  int num = 0;
+  for (int i = 0; i < retrieve_idx_pos_[bucket_no]; i++) {
+    if (idx_array[i] & kDelIdxMask ||
+        bitmap::test(docids_bitmap_, vid_mgr_->VID2DocID(idx_array[i]))) {
+      num++;
+    }
+  }
+  deleted_nums_[bucket_no] = num;
+}
+
 RealTimeMemData::RealTimeMemData(size_t buckets_num, long max_vec_size,
                                  VIDMgr *vid_mgr, const char *docids_bitmap,
                                  size_t bucket_keys, size_t bucket_keys_limit,
@@ -235,8 +260,11 @@ RealTimeMemData::~RealTimeMemData() {
     CHECK_DELETE_ARRAY(cur_invert_ptr_->cur_bucket_keys_);
     CHECK_DELETE_ARRAY(cur_invert_ptr_->codes_array_);
     CHECK_DELETE_ARRAY(cur_invert_ptr_->dump_latest_pos_);
-    CHECK_DELETE_ARRAY(cur_invert_ptr_->vid_bucket_no_pos_);
+    utils::FreeLarge(cur_invert_ptr_->vid_bucket_no_pos_,
+                     max_vec_size_ * sizeof(std::atomic<long>));
+    cur_invert_ptr_->vid_bucket_no_pos_ = nullptr;
     CHECK_DELETE_ARRAY(cur_invert_ptr_->deleted_nums_);
+    CHECK_DELETE_ARRAY(cur_invert_ptr_->code_versions_);
   }
   CHECK_DELETE(cur_invert_ptr_);
   CHECK_DELETE(extend_invert_ptr_);
@@ -303,6 +331,7 @@ int RealTimeMemData::Update(int bucket_no, int vid,
     uint8_t *codes_array = cur_invert_ptr_->codes_array_[old_bucket_no];
     memcpy(codes_array + old_pos * code_bytes_per_vec_, codes.data(),
            codes.size() * sizeof(uint8_t));
+    cur_invert_ptr_->code_versions_[old_bucket_no]++;
     return 0;
   }
 
@@ -323,6 +352,19 @@ int RealTimeMemData::Delete(int *vids, int n) {
   return 0;
 }
 
+int RealTimeMemData::RecountDeleted(int *vids, int n) {
+  std::set<int> buckets;
+  for (int i = 0; i < n; i++) {
+    long bucket_no_pos = cur_invert_ptr_->vid_bucket_no_pos_[vids[i]];
+    if (bucket_no_pos == -1) continue;
+    buckets.insert(bucket_no_pos >> 32);
+  }
+  for (int bucket_no : buckets) {
+    cur_invert_ptr_->RecountDeleted(bucket_no);
+  }
+  return 0;
+}
+
 void RealTimeMemData::FreeOldData(long *idx, uint8_t *codes,
                                   RTInvertBucketData *invert, long size) {
   if (idx) {
@@ -444,6 +486,8 @@ bool RealTimeMemData::AdjustBucketMem(const size_t &bucket_no, int type) {
 
   RTInvertBucketData *old_invert_ptr = cur_invert_ptr_;
   cur_invert_ptr_ = extend_invert_ptr_;
+  // the old codes array may be reused by a later compaction
+  if (type != 0) cur_invert_ptr_->code_versions_[bucket_no]++;
 
   std::function<void(long *, uint8_t *, RTInvertBucketData *, long)> func_free =
       std::bind(&RealTimeMemData::FreeOldData, this, std::placeholders::_1,
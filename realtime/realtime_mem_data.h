@@ -42,6 +42,9 @@ struct RTInvertBucketData {
 
   void Delete(int vid);
 
+  // count the masked and deleted vectors of the bucket again
+  void RecountDeleted(const size_t &bucket_no);
+
   long **idx_array_;
   int *retrieve_idx_pos_;  // total nb of realtime added indexed vectors
   int *cur_bucket_keys_;
@@ -51,6 +54,8 @@ struct RTInvertBucketData {
   const char *docids_bitmap_;
   std::atomic<long> *vid_bucket_no_pos_;
   std::atomic<int> *deleted_nums_;
+  // changed after codes of a bucket are changed in place or compacted
+  std::atomic<long> *code_versions_;
   long compacted_num_;
   size_t buckets_num_;
 };
@@ -98,6 +103,13 @@ struct RealTimeMemData {
   bool Compactable(int bucket_no);
   bool CompactBucket(int bucket_no);
   int Delete(int *vids, int n);
+  // recount the deleted vectors of the buckets holding vids, so deletes
+  // which raced with AddKeys are counted once
+  int RecountDeleted(int *vids, int n);
+
+  long GetCodeVersion(int bucket_no) {
+    return cur_invert_ptr_->code_versions_[bucket_no];
+  }
 
   RTInvertBucketData *cur_invert_ptr_;
   RTInvertBucketData *extend_invert_ptr_;
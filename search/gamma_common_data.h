@@ -330,12 +330,32 @@ struct RetrievalParams {
 struct IVFPQRetrievalParams : RetrievalParams {
   int ncentroids;     // coarse cluster center number
   int nsubvector;     // number of sub cluster center
-  int nbits_per_idx;  // bit number of sub cluster center
+  int nbits_per_idx;  // bit number of sub cluster center, 4 for fast scan
+  int rerank_sq8;     // 1: narrow reranked candidates with SQ8 codes first
+  int sq8_rerank_num;  // candidates kept by SQ8 stage, 0 means 2 * topn
+  int hnsw_quantizer;  // 1: centroids are searched in an HNSW graph
+  int quantizer_nlinks;          // link number of the centroid graph
+  int quantizer_efSearch;        // efSearch of coarse assignment
+  int quantizer_efConstruction;  // efConstruction of the centroid graph
+  int training_size;    // training vectors, 0 means max(100000, 39 * nlist)
+  int kmeans_plusplus;  // 1: seed the coarse centroids by k-means++
+  double retrain_imbalance;  // retrain if lists are imbalanced, 0: disabled
+  int opq;  // 1: rotate vectors by OPQ before the quantizers
 
   IVFPQRetrievalParams() : RetrievalParams() {
     ncentroids = 256;
     nsubvector = 64;
     nbits_per_idx = 8;
+    rerank_sq8 = 0;
+    sq8_rerank_num = 0;
+    hnsw_quantizer = 0;
+    quantizer_nlinks = 32;
+    quantizer_efSearch = 64;
+    quantizer_efConstruction = 40;
+    training_size = 0;
+    kmeans_plusplus = 1;
+    retrain_imbalance = 0;
+    opq = 0;
   }
 
   int Parse(const char *str) {
@@ -396,6 +416,58 @@ struct IVFPQRetrievalParams : RetrievalParams {
       }
       if (nbits_per_idx > 0) this->nbits_per_idx = nbits_per_idx;
     }
+
+    int rerank_sq8;
+    if (!jp.GetInt("rerank_sq8", rerank_sq8)) {
+      this->rerank_sq8 = rerank_sq8 ? 1 : 0;
+    }
+
+    int sq8_rerank_num;
+    if (!jp.GetInt("sq8_rerank_num", sq8_rerank_num)) {
+      if (sq8_rerank_num < 0) {
+        LOG(ERROR) << "invalid sq8_rerank_num =" << sq8_rerank_num;
+        return -1;
+      }
+      this->sq8_rerank_num = sq8_rerank_num;
+    }
+
+    int hnsw_quantizer;
+    if (!jp.GetInt("hnsw_quantizer", hnsw_quantizer)) {
+      this->hnsw_quantizer = hnsw_quantizer ? 1 : 0;
+    }
+    int quantizer_nlinks;
+    if (!jp.GetInt("quantizer_nlinks", quantizer_nlinks)) {
+      this->quantizer_nlinks = quantizer_nlinks;
+    }
+    int quantizer_efSearch;
+    if (!jp.GetInt("quantizer_efSearch", quantizer_efSearch)) {
+      this->quantizer_efSearch = quantizer_efSearch;
+    }
+    int quantizer_efConstruction;
+    if (!jp.GetInt("quantizer_efConstruction", quantizer_efConstruction)) {
+      this->quantizer_efConstruction = quantizer_efConstruction;
+    }
+
+    int training_size;
+    if (!jp.GetInt("training_size", training_size)) {
+      if (training_size < 0) {
+        LOG(ERROR) << "invalid training_size =" << training_size;
+        return -1;
+      }
+      this->training_size = training_size;
+    }
+    int kmeans_plusplus;
+    if (!jp.GetInt("kmeans_plusplus", kmeans_plusplus)) {
+      this->kmeans_plusplus = kmeans_plusplus ? 1 : 0;
+    }
+    double retrain_imbalance;
+    if (!jp.GetDouble("retrain_imbalance", retrain_imbalance)) {
+      this->retrain_imbalance = retrain_imbalance;
+    }
+    int opq;
+    if (!jp.GetInt("opq", opq)) {
+      this->opq = opq ? 1 : 0;
+    }
     if(!Validate())
       return -1;
     return 0;
@@ -409,8 +481,21 @@ struct IVFPQRetrievalParams : RetrievalParams {
       LOG(ERROR) << "only support multiple of 4 now, nsubvector=" << nsubvector;
       return false;
     }
-    if (nbits_per_idx != 8) {
-      LOG(ERROR) << "only support 8 now, nbits_per_idx=" << nbits_per_idx;
+    // 4 bits codes are scanned by PQ4 fast scan
+    if (nbits_per_idx != 8 && nbits_per_idx != 4) {
+      LOG(ERROR) << "only support 8 or 4 now, nbits_per_idx=" << nbits_per_idx;
+      return false;
+    }
+    if (hnsw_quantizer && (quantizer_nlinks <= 0 || quantizer_efSearch <= 0 ||
+                           quantizer_efConstruction <= 0)) {
+      LOG(ERROR) << "invalid hnsw quantizer parameters, nlinks="
+                 << quantizer_nlinks << ", efSearch=" << quantizer_efSearch
+                 << ", efConstruction=" << quantizer_efConstruction;
+      return false;
+    }
+    // the imbalance factor is 1 if the lists are even
+    if (retrain_imbalance != 0 && !(retrain_imbalance > 1)) {
+      LOG(ERROR) << "invalid retrain_imbalance =" << retrain_imbalance;
       return false;
     }
     return true;
@@ -421,7 +506,17 @@ struct IVFPQRetrievalParams : RetrievalParams {
     ss << "metric_type = " << metric_type << ", ";
     ss << "ncentroids =" << ncentroids << ", ";
     ss << "nsubvector =" << nsubvector << ", ";
-    ss << "nbits_per_idx =" << nbits_per_idx;
+    ss << "nbits_per_idx =" << nbits_per_idx << ", ";
+    ss << "rerank_sq8 =" << rerank_sq8 << ", ";
+    ss << "sq8_rerank_num =" << sq8_rerank_num << ", ";
+    ss << "hnsw_quantizer =" << hnsw_quantizer << ", ";
+    ss << "quantizer_nlinks =" << quantizer_nlinks << ", ";
+    ss << "quantizer_efSearch =" << quantizer_efSearch << ", ";
+    ss << "quantizer_efConstruction =" << quantizer_efConstruction << ", ";
+    ss << "training_size =" << training_size << ", ";
+    ss << "kmeans_plusplus =" << kmeans_plusplus << ", ";
+    ss << "retrain_imbalance =" << retrain_imbalance << ", ";
+    ss << "opq =" << opq;
     return ss.str();
   }
 };
@@ -25,6 +25,7 @@
 #include "cJSON.h"
 #include "gamma_common_data.h"
 #include "log.h"
+#include "memory_policy.h"
 #include "utils.h"
 
 using std::string;
@@ -111,6 +112,7 @@ struct TableIO {
     WriteRetrievalType(table);
     WriteRetrievalParam(table);
     WriteIdType(table);
+    WriteVectorRetrievals(table);
     return 0;
   }
 
@@ -157,6 +159,27 @@ struct TableIO {
     fio->Write((void *)&table->id_type, sizeof(table->id_type), 1);
   }
 
+  // per vector retrieval model and parameters, appended after id type so
+  // that schemas written by older versions can still be read
+  void WriteVectorRetrievals(const Table *table) {
+    for (int i = 0; i < table->vectors_num; i++) {
+      VectorInfo *vi = table->vectors_info[i];
+      WriteOptionalByteArray(vi->retrieval_type);
+      WriteOptionalByteArray(vi->retrieval_param);
+    }
+  }
+
+  void WriteOptionalByteArray(ByteArray *ba) {
+    if (ba && ba->len > 0) {
+      FWriteByteArray(fio, ba);
+    } else {
+      ByteArray *placeholder =
+          MakeByteArray(kPlaceHolder, strlen(kPlaceHolder));
+      FWriteByteArray(fio, placeholder);
+      DestroyByteArray(placeholder);
+    }
+  }
+
   int Read(std::string &name, Table *&table) {
     if (!fio->IsOpen() && fio->Open("rb")) {
       LOG(INFO) << "open error, file path=" << fio->Path();
@@ -170,6 +193,7 @@ struct TableIO {
     ReadRetrievalType(table);
     ReadRetrievalParam(table);
     ReadIdType(table);
+    ReadVectorRetrievals(table);
     return 0;
   }
 
@@ -190,6 +214,7 @@ struct TableIO {
     table->vectors_info = MakeVectorInfos(table->vectors_num);
     for (int i = 0; i < table->vectors_num; i++) {
       VectorInfo *vi = static_cast<VectorInfo *>(malloc(sizeof(VectorInfo)));
+      memset(vi, 0, sizeof(VectorInfo));
       FReadByteArray(fio, vi->name);
       fio->Read((void *)&vi->data_type, sizeof(vi->data_type), 1);
       fio->Read((void *)&vi->is_index, sizeof(vi->is_index), 1);
@@ -223,6 +248,35 @@ struct TableIO {
       table->id_type = 0;
     }
   }
+
+  void ReadVectorRetrievals(Table *&table) {
+    for (int i = 0; i < table->vectors_num; i++) {
+      VectorInfo *vi = table->vectors_info[i];
+      if (ReadOptionalByteArray(vi->retrieval_type) ||
+          ReadOptionalByteArray(vi->retrieval_param)) {
+        break;  // schema written by an older version
+      }
+    }
+  }
+
+  int ReadOptionalByteArray(ByteArray *&ba) {
+    int len = 0;
+    if (fio->Read((void *)&len, sizeof(len), 1) != 1 || len < 0) return -1;
+    ba = static_cast<ByteArray *>(malloc(sizeof(ByteArray)));
+    ba->len = len;
+    ba->value = static_cast<char *>(malloc(len));
+    if (len > 0 && fio->Read((void *)ba->value, len, 1) != 1) {
+      DestroyByteArray(ba);
+      ba = nullptr;
+      return -1;
+    }
+    int plen = strlen(kPlaceHolder);
+    if (len == plen && !strncasecmp(ba->value, kPlaceHolder, plen)) {
+      DestroyByteArray(ba);
+      ba = nullptr;
+    }
+    return 0;
+  }
 };
 
 GammaEngine::GammaEngine(const string &index_root_path)
@@ -273,7 +327,7 @@ GammaEngine::~GammaEngine() {
   }
 
   if (docids_bitmap_) {
-    delete docids_bitmap_;
+    utils::FreeLarge(docids_bitmap_, bitmap_bytes_size_);
     docids_bitmap_ = nullptr;
   }
 
@@ -318,7 +372,10 @@ int GammaEngine::Setup(int max_doc_size) {
   utils::make_dir(dump_backup_path_.c_str());
 
   if (!docids_bitmap_) {
-    if (bitmap::create(docids_bitmap_, bitmap_bytes_size_, max_doc_size) != 0) {
+    bitmap_bytes_size_ = (max_doc_size >> 3) + 1;
+    docids_bitmap_ =
+        (char *)utils::AllocLarge(bitmap_bytes_size_, "docids bitmap");
+    if (docids_bitmap_ == nullptr) {
       LOG(ERROR) << "Cannot create bitmap!";
       return -1;
     }
@@ -518,7 +575,7 @@ Response *GammaEngine::Search(const Request *request) {
       if (fields_ids.size() > 0) {
         gamma_result.init(request->topn, vec_names.data(), fields_ids.size());
         std::vector<string> vec;
-        int ret = vec_manager_->GetVector(fields_ids, vec);
+        int ret = vec_manager_->GetVectorText(fields_ids, vec);
         if (ret == 0) {
           int idx = 0;
           VectorDoc *doc = gamma_result.docs[gamma_result.results_count];
@@ -662,6 +719,7 @@ int GammaEngine::CreateTable(const Table *table) {
   }
 
   LOG(INFO) << "create table [" << table_name << "] success!";
+  LOG(INFO) << "memory policy: " << utils::MemoryPolicyReport();
   created_table_ = true;
   return 0;
 }
@@ -898,8 +956,8 @@ Doc *GammaEngine::GetDoc(ByteArray *id) {
     vec_fields_ids.emplace_back(std::make_pair(index_names[i], docid));
   }
 
-  std::vector<std::string> vec;
-  ret = vec_manager_->GetVector(vec_fields_ids, vec, true);
+  std::vector<ByteArray *> vec;
+  ret = vec_manager_->GetVector(vec_fields_ids, vec);
   if (ret == 0 && vec.size() == vec_fields_ids.size()) {
     int j = 0;
     for (int i = profile_->FieldsNum(); i < doc->fields_num; ++i) {
@@ -908,10 +966,12 @@ Doc *GammaEngine::GetDoc(ByteArray *id) {
       memset(doc->fields[i], 0, sizeof(Field));
       doc->fields[i]->name =
           MakeByteArray(field_name.c_str(), field_name.length());
-      doc->fields[i]->value = MakeByteArray(vec[j].c_str(), vec[j].length());
+      doc->fields[i]->value = vec[j];
       doc->fields[i]->data_type = DataType::VECTOR;
       ++j;
     }
+  } else {
+    for (ByteArray *ba : vec) DestroyByteArray(ba);
   }
   return doc;
 }
@@ -1283,8 +1343,8 @@ ResultItem *GammaEngine::PackResultItem(const VectorDoc *vec_doc,
       }
     }
 
-    std::vector<string> vec;
-    int ret = vec_manager_->GetVector(vec_fields_ids, vec, true);
+    std::vector<ByteArray *> vec;
+    int ret = vec_manager_->GetVector(vec_fields_ids, vec);
 
     int profile_fields_num = 0;
     doc = static_cast<Doc *>(malloc(sizeof(Doc)));
@@ -1318,13 +1378,14 @@ ResultItem *GammaEngine::PackResultItem(const VectorDoc *vec_doc,
         memset(doc->fields[i], 0, sizeof(Field));
         doc->fields[i]->name =
             MakeByteArray(field_name.c_str(), field_name.length());
-        doc->fields[i]->value = MakeByteArray(vec[j].c_str(), vec[j].length());
+        doc->fields[i]->value = vec[j];
         doc->fields[i]->data_type = DataType::VECTOR;
         ++j;
       }
     } else {
       // get vector error
       // TODO : release extra field
+      for (ByteArray *ba : vec) DestroyByteArray(ba);
       doc->fields_num = profile_fields_num;
     }
   } else {
@@ -11,6 +11,7 @@
 #include <cmath>
 #include <fstream>
 #include <functional>
+#include <iterator>
 #include <future>
 #include "test.h"
 
@@ -69,8 +70,10 @@ static struct Options opt;
 string profile_file = "./profile_10w.txt";
 string feature_file = "./feat_10w.dat";
 
+// the feature is also stored to each of extra_vectors
 int AddDoc(void *engine, int start_id, int end_id, int interval = 0,
-           long fet_offset = 0) {
+           long fet_offset = 0,
+           const std::vector<string> &extra_vectors = std::vector<string>()) {
   FILE *fet_fp = fopen(feature_file.c_str(), "rb");
   if (fet_fp == nullptr) {
     LOG(ERROR) << "open feature file error";
@@ -117,7 +120,8 @@ int AddDoc(void *engine, int start_id, int end_id, int interval = 0,
              sizeof(float) * opt.d);
     }
 
-    Field **fields = MakeFields(opt.fields_vec.size() + 1);
+    int field_num = opt.fields_vec.size() + 1 + extra_vectors.size();
+    Field **fields = MakeFields(field_num);
     for (size_t j = 0; j < opt.fields_vec.size(); ++j) {
       enum DataType data_type = opt.fields_type[j];
       ByteArray *name = StringToByteArray(opt.fields_vec[j]);
@@ -156,8 +160,13 @@ int AddDoc(void *engine, int start_id, int end_id, int interval = 0,
         "jfs/t1/46413/10/6998/121644/5d493cfaE53b7c078/c4e2526e8f8a698f.jpg"));
     Field *field = MakeField(name, value, source, VECTOR);
     SetField(fields, opt.fields_vec.size(), field);
+    for (size_t j = 0; j < extra_vectors.size(); ++j) {
+      field = MakeField(StringToByteArray(extra_vectors[j]),
+                        FloatToByteArray(vector, opt.d), nullptr, VECTOR);
+      SetField(fields, opt.fields_vec.size() + 1 + j, field);
+    }
 
-    Doc *doc = MakeDoc(fields, opt.fields_vec.size() + 1);
+    Doc *doc = MakeDoc(fields, field_num);
     AddOrUpdateDoc(engine, doc);
     DestroyDoc(doc);
     ++opt.doc_id;
@@ -210,7 +219,8 @@ int DeleteDoc(void *engine, int start_id, int end_id) {
   return 0;
 }
 
-int SearchThread(void *engine, int num, int start_id, long fet_offset = 0) {
+int SearchThread(void *engine, int num, int start_id, long fet_offset = 0,
+                 const string &vector_name = opt.vector_name) {
   FILE *fet_fp = fopen(feature_file.c_str(), "rb");
   if (fet_fp == nullptr) {
     LOG(ERROR) << "open feature file error";
@@ -242,7 +252,7 @@ int SearchThread(void *engine, int num, int start_id, long fet_offset = 0) {
     }
     ByteArray *value = FloatToByteArray(feature, opt.d * req_num);
     VectorQuery *vector_query = MakeVectorQuery(
-        StringToByteArray(opt.vector_name), value, 0, 10000, 0.1, 0);
+        StringToByteArray(vector_name), value, 0, 10000, 0.1, 0);
     SetVectorQuery(vector_querys, 0, vector_query);
 
     string c3_lower = opt.profiles[docid * (opt.fields_vec.size()) + 4];
@@ -319,7 +329,8 @@ void *CreateEngine(string &path, int max_doc_size) {
   return engine;
 }
 
-int CreateTable(void *engine, string &name, string store_type = "Mmap") {
+int CreateTable(void *engine, string &name, string store_type = "Mmap",
+                const string &retrieval_param = "") {
   ByteArray *table_name = MakeByteArray(name.c_str(), name.size());
   FieldInfo **field_infos = MakeFieldInfos(opt.fields_vec.size());
 
@@ -339,9 +350,12 @@ int CreateTable(void *engine, string &name, string store_type = "Mmap") {
   SetVectorInfo(vectors_info, 0, vector_info);
 
   Table *table = MakeTable(table_name, field_infos, opt.fields_vec.size(),
-                           vectors_info, 1, 
+                           vectors_info, 1,
                            StringToByteArray(opt.retrieval_type),
-                           GetIVFPQParam());
+                           retrieval_param.empty()
+                               ? GetIVFPQParam()
+                               : StringToByteArray(retrieval_param),
+                           0);
   enum ResponseCode ret = ::CreateTable(engine, table);
   DestroyTable(table);
   return ret;
@@ -645,6 +659,195 @@ TEST(Engine, UpdateAndCompactIndex) {
   engine = nullptr;
 }
 
+TEST(Engine, SQ8Rerank) {
+  string case_name = GetCurrentCaseName();
+  string table_name = "test_sq8_rerank";
+  int max_doc_size = 10000 * 10;
+  utils::remove_dir(case_name.c_str());
+  utils::make_dir(case_name.c_str());
+  string root_path = "./" + case_name;
+  // 20 of the recalled candidates are kept by SQ8 and reranked with raw
+  // vectors, so the query vector itself must still be the top result
+  string retrieval_param =
+      "{\"nprobe\" : 10, \"metric_type\" : \"InnerProduct\", "
+      "\"ncentroids\" : 256,\"nsubvector\" : 64, \"rerank_sq8\" : 1, "
+      "\"sq8_rerank_num\" : 20}";
+
+  LOG(INFO) << "------------------add doc and build--------------------";
+  void *engine = CreateEngine(root_path, max_doc_size);
+  ASSERT_NE(nullptr, engine);
+  ASSERT_EQ(0, CreateTable(engine, table_name, "Mmap", retrieval_param));
+  EXPECT_EQ(0, AddDoc(engine, 0, 1 * 10000));
+  BuildIdx(engine);
+  Sleep(1000);
+  ASSERT_EQ(0, SearchThread(engine, 1 * 10000, 0));
+  ASSERT_EQ(0, Dump(engine));
+  Close(engine);
+  engine = nullptr;
+
+  LOG(INFO) << "------------------reload sq8 param--------------------";
+  engine = CreateEngine(root_path, max_doc_size);
+  ASSERT_NE(nullptr, engine);
+  ASSERT_EQ(0, CreateTable(engine, table_name, "Mmap", retrieval_param));
+  ASSERT_EQ(0, Load(engine));
+  BuildIdx(engine);
+  ASSERT_EQ(0, SearchThread(engine, 1 * 10000, 0));
+  Close(engine);
+  engine = nullptr;
+
+  LOG(INFO) << "------------------reload without sq8 param---------------";
+  // as dumped before sq8 rerank was enabled, it is trained at load
+  string dump_path = root_path + "/dump";
+  for (const string &folder : utils::ls_folder(dump_path)) {
+    string sq_file =
+        dump_path + "/" + folder + "/" + opt.vector_name + ".sq8.param";
+    remove(sq_file.c_str());
+  }
+  engine = CreateEngine(root_path, max_doc_size);
+  ASSERT_NE(nullptr, engine);
+  ASSERT_EQ(0, CreateTable(engine, table_name, "Mmap", retrieval_param));
+  ASSERT_EQ(0, Load(engine));
+  BuildIdx(engine);
+  ASSERT_EQ(0, SearchThread(engine, 1 * 10000, 0));
+  Close(engine);
+  engine = nullptr;
+}
+
+// search the feature of docid in all of vector_names, returns the result
+// code of the first request
+int SearchFields(void *engine, int docid,
+                 const std::vector<string> &vector_names) {
+  int field_num = vector_names.size();
+  VectorQuery **vector_querys = MakeVectorQuerys(field_num);
+  for (int i = 0; i < field_num; ++i) {
+    ByteArray *value = FloatToByteArray(opt.feature + docid * opt.d, opt.d);
+    VectorQuery *vector_query = MakeVectorQuery(
+        StringToByteArray(vector_names[i]), value, 0, 10000, 0.1, 0);
+    SetVectorQuery(vector_querys, i, vector_query);
+  }
+  Request *request = MakeRequest(100, vector_querys, field_num, nullptr, 0,
+                                 nullptr, 0, nullptr, 0, 1, 0, nullptr, TRUE,
+                                 0, FALSE, FALSE, 20, FALSE);
+  Response *response = Search(engine, request);
+  SearchResult *results = GetSearchResult(response, 0);
+  int code = results->result_code;
+  if (code == SUCCESS && results->result_num <= 0) code = -1;
+  DestroyRequest(request);
+  DestroyResponse(response);
+  return code;
+}
+
+int CreateMixedTable(void *engine, string &name,
+                     const std::vector<string> &vector_names,
+                     const std::vector<string> &retrieval_types,
+                     const std::vector<string> &retrieval_params) {
+  ByteArray *table_name = MakeByteArray(name.c_str(), name.size());
+  FieldInfo **field_infos = MakeFieldInfos(opt.fields_vec.size());
+  for (size_t i = 0; i < opt.fields_vec.size(); ++i) {
+    BOOL do_index = TRUE;
+    if (opt.fields_type[i] == STRING) do_index = FALSE;
+    FieldInfo *field_info = MakeFieldInfo(StringToByteArray(opt.fields_vec[i]),
+                                          opt.fields_type[i], do_index);
+    SetFieldInfo(field_infos, i, field_info);
+  }
+
+  int vectors_num = vector_names.size();
+  VectorInfo **vectors_info = MakeVectorInfos(vectors_num);
+  for (int i = 0; i < vectors_num; ++i) {
+    // HNSW needs all vectors in memory, so the fields with their own model
+    // keep the default cache size
+    ByteArray *store_param =
+        retrieval_types[i].empty() ? StringToByteArray(opt.store_param)
+                                   : nullptr;
+    VectorInfo *vector_info = MakeVectorInfo(
+        StringToByteArray(vector_names[i]), FLOAT, TRUE, opt.d,
+        StringToByteArray(opt.model_id), StringToByteArray("Mmap"),
+        store_param, FALSE);
+    if (!retrieval_types[i].empty()) {
+      SetVectorInfoRetrieval(vector_info,
+                             StringToByteArray(retrieval_types[i]),
+                             StringToByteArray(retrieval_params[i]));
+    }
+    SetVectorInfo(vectors_info, i, vector_info);
+  }
+
+  Table *table = MakeTable(table_name, field_infos, opt.fields_vec.size(),
+                           vectors_info, vectors_num,
+                           StringToByteArray(opt.retrieval_type),
+                           GetIVFPQParam(), 0);
+  enum ResponseCode ret = ::CreateTable(engine, table);
+  DestroyTable(table);
+  return ret;
+}
+
+TEST(Engine, MixedFieldModels) {
+  string case_name = GetCurrentCaseName();
+  string table_name = "test_mixed_models";
+  int max_doc_size = 10000 * 2;
+  utils::remove_dir(case_name.c_str());
+  utils::make_dir(case_name.c_str());
+  string root_path = "./" + case_name;
+  // the first field inherits IVFPQ of the table, the others are HNSW, the
+  // last one with L2 so that it can't be searched together with the others
+  string hnsw_name = opt.vector_name + "_hnsw";
+  string l2_name = opt.vector_name + "_l2";
+  string l2_param =
+      "{\"nlinks\" : 32, \"metric_type\" : \"L2\", \"efSearch\" : "
+      "64,\"efConstruction\" : 40}";
+  std::vector<string> vector_names = {opt.vector_name, hnsw_name, l2_name};
+  std::vector<string> retrieval_types = {"", "HNSW", "HNSW"};
+  std::vector<string> retrieval_params = {"", kHNSWParam_str, l2_param};
+  std::vector<string> extra_vectors = {hnsw_name, l2_name};
+
+  LOG(INFO) << "------------------add doc and build--------------------";
+  void *engine = CreateEngine(root_path, max_doc_size);
+  ASSERT_NE(nullptr, engine);
+  ASSERT_EQ(0, CreateMixedTable(engine, table_name, vector_names,
+                                retrieval_types, retrieval_params));
+  EXPECT_EQ(0, AddDoc(engine, 0, 1 * 10000, 0, 0, extra_vectors));
+  BuildIdx(engine);
+  Sleep(1000);
+  ASSERT_EQ(0, SearchThread(engine, 1 * 10000, 0, 0, opt.vector_name));
+  ASSERT_EQ(0, SearchThread(engine, 1 * 10000, 0, 0, hnsw_name));
+  ASSERT_EQ(SUCCESS, SearchFields(engine, 6, {opt.vector_name, hnsw_name}));
+  ASSERT_EQ(SEARCH_ERROR, SearchFields(engine, 6, {opt.vector_name, l2_name}));
+  ASSERT_EQ(0, Dump(engine));
+  Close(engine);
+  engine = nullptr;
+
+  LOG(INFO) << "------------------check schema--------------------";
+  string schema_file = root_path + "/" + table_name + ".schema";
+  std::ifstream schema_in(schema_file.c_str(), std::ios::binary);
+  ASSERT_TRUE(schema_in.good());
+  string schema((std::istreambuf_iterator<char>(schema_in)),
+                std::istreambuf_iterator<char>());
+  size_t hnsw_pos = schema.find(kHNSWParam_str);
+  size_t l2_pos = schema.find(l2_param);
+  ASSERT_NE(string::npos, hnsw_pos);
+  ASSERT_NE(string::npos, l2_pos);
+  ASSERT_LT(hnsw_pos, l2_pos);
+  ASSERT_NE(string::npos, schema.rfind("HNSW", hnsw_pos));
+
+  LOG(INFO) << "------------------reload from local schema-----------------";
+  engine = CreateEngine(root_path, max_doc_size);
+  ASSERT_NE(nullptr, engine);
+  ASSERT_EQ(0, Load(engine));
+  BuildIdx(engine);
+  ASSERT_EQ(0, SearchThread(engine, 1 * 10000, 0, 0, opt.vector_name));
+  ASSERT_EQ(0, SearchThread(engine, 1 * 10000, 0, 0, hnsw_name));
+  ASSERT_EQ(SUCCESS, SearchFields(engine, 6, {opt.vector_name, hnsw_name}));
+  // l2 field would inherit InnerProduct if its parameters were lost
+  ASSERT_EQ(SEARCH_ERROR, SearchFields(engine, 6, {opt.vector_name, l2_name}));
+  ASSERT_EQ(SEARCH_ERROR, SearchFields(engine, 6, {l2_name, hnsw_name}));
+
+  LOG(INFO) << "------------------add doc after reload-----------------";
+  EXPECT_EQ(0, AddDoc(engine, 1 * 10000, 15000, 0, 0, extra_vectors));
+  Sleep(5000);
+  ASSERT_EQ(0, SearchThread(engine, 5000, 1 * 10000, 0, hnsw_name));
+  Close(engine);
+  engine = nullptr;
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,349 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+#include "pq4_fast_scan.h"
+#include "pq8_scan.h"
+
+using namespace std;
+
+namespace {
+
+// distance tables of M sub-quantizers like the sim_table of a query
+vector<float> RandomTables(size_t M, size_t ksub, float low, float high,
+                           mt19937 &rng) {
+  uniform_real_distribution<float> uniform(low, high);
+  vector<float> tab(M * ksub);
+  for (float &t : tab) t = uniform(rng);
+  return tab;
+}
+
+vector<uint8_t> RandomCodes(size_t n, size_t code_size, mt19937 &rng) {
+  vector<uint8_t> codes(n * code_size);
+  for (uint8_t &c : codes) c = rng() & 0xff;
+  return codes;
+}
+
+// masks of all blocks of the codes, bit j % 32 of masks[j / 32]
+vector<uint32_t> ScanPQ4(size_t M, const vector<uint8_t> &codes,
+                         const uint8_t *lut, int threshold, bool less) {
+  size_t code_size = M / 2;
+  size_t ncode = codes.size() / code_size;
+  vector<uint8_t> block(code_size * pq4::kBlockSize);
+  vector<uint32_t> masks;
+  const uint8_t *rows[pq4::kBlockSize];
+  for (size_t j0 = 0; j0 < ncode; j0 += pq4::kBlockSize) {
+    size_t n = std::min(ncode - j0, (size_t)pq4::kBlockSize);
+    for (size_t v = 0; v < n; v++) {
+      rows[v] = codes.data() + (j0 + v) * code_size;
+    }
+    pq4::pack_block(rows, code_size, n, block.data());
+    masks.push_back(pq4::accumulate_block(M, block.data(), lut, n, threshold,
+                                          less, nullptr));
+  }
+  return masks;
+}
+
+// every code which can enter a heap of top is selected by the bound filter
+void CheckBounds(size_t M, bool ip, mt19937 &rng) {
+  size_t code_size = M / 2;
+  size_t ncode = 100 * pq4::kBlockSize + 7;
+  vector<float> tab = ip ? RandomTables(M, pq4::kSubCentroids, -1, 1, rng)
+                         : RandomTables(M, pq4::kSubCentroids, 0, 10, rng);
+  float dis0 = ip ? -0.25f : 3.7f;
+  vector<uint8_t> codes = RandomCodes(ncode, code_size, rng);
+  vector<float> dis(ncode);
+  for (size_t j = 0; j < ncode; j++) {
+    dis[j] = pq4::distance(M, codes.data() + j * code_size, tab.data(), dis0);
+  }
+
+  vector<uint8_t> lut(M * pq4::kSubCentroids);
+  float lut_bias = 0, lut_scale = 1;
+  pq4::quantize_lut(M, tab.data(), lut.data(), &lut_bias, &lut_scale);
+  double bias = (double)dis0 + lut_bias;
+
+  vector<float> sorted = dis;
+  // the best first, so a top at rank r lets r codes into the heap
+  if (ip) {
+    std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+  } else {
+    std::sort(sorted.begin(), sorted.end());
+  }
+  vector<float> tops = {sorted[0], sorted[10], sorted[100], sorted[ncode / 2],
+                        sorted[ncode - 1]};
+  // a code at the same distance as top isn't better, the next one is
+  tops.push_back(std::nextafter(sorted[10], ip ? -INFINITY : INFINITY));
+  // the initial heap top
+  tops.push_back(ip ? -std::numeric_limits<float>::max()
+                    : std::numeric_limits<float>::max());
+
+  for (float top : tops) {
+    int threshold = ip ? pq4::threshold_greater(M, top, bias, lut_scale)
+                       : pq4::threshold_less(top, bias, lut_scale);
+    vector<uint32_t> masks = ScanPQ4(M, codes, lut.data(), threshold, !ip);
+    size_t selected = 0;
+    for (size_t j = 0; j < ncode; j++) {
+      bool lane = (masks[j / pq4::kBlockSize] >> (j % pq4::kBlockSize)) & 1;
+      bool better = ip ? dis[j] > top : dis[j] < top;
+      if (better) {
+        ASSERT_TRUE(lane) << "M=" << M << ", ip=" << ip << ", top=" << top
+                          << ", dis=" << dis[j] << ", j=" << j;
+      }
+      selected += lane;
+    }
+    // the filter prunes most codes of a good top
+    if (top == sorted[10]) {
+      EXPECT_LT(selected, ncode / 4) << "M=" << M << ", ip=" << ip;
+    }
+  }
+}
+
+}  // namespace
+
+TEST(PQ4FastScan, PackBlock) {
+  mt19937 rng(7);
+  size_t code_size = 8;
+  vector<uint8_t> codes = RandomCodes(pq4::kBlockSize, code_size, rng);
+  const uint8_t *rows[pq4::kBlockSize];
+  for (int v = 0; v < pq4::kBlockSize; v++) {
+    rows[v] = codes.data() + v * code_size;
+  }
+  vector<uint8_t> block(code_size * pq4::kBlockSize);
+  for (size_t n : {32, 20, 1}) {
+    std::fill(block.begin(), block.end(), 0xff);
+    pq4::pack_block(rows, code_size, n, block.data());
+    // byte i of code v is at row i, column v
+    for (size_t i = 0; i < code_size; i++) {
+      for (size_t v = 0; v < pq4::kBlockSize; v++) {
+        uint8_t expect = v < n ? rows[v][i] : 0;
+        ASSERT_EQ(expect, block[i * pq4::kBlockSize + v])
+            << "n=" << n << ", i=" << i << ", v=" << v;
+      }
+    }
+  }
+}
+
+// the blocks of a cached list are the blocks packed from its codes
+void CheckPacked(const pq4::PackedList &list, const vector<uint8_t> &codes,
+                 size_t code_size, size_t n) {
+  ASSERT_LE(n, list.n);
+  size_t block_bytes = code_size * pq4::kBlockSize;
+  vector<uint8_t> block(block_bytes);
+  const uint8_t *rows[pq4::kBlockSize];
+  for (size_t j0 = 0; j0 < list.n; j0 += pq4::kBlockSize) {
+    size_t nb = std::min(list.n - j0, (size_t)pq4::kBlockSize);
+    for (size_t v = 0; v < nb; v++) {
+      rows[v] = codes.data() + (j0 + v) * code_size;
+    }
+    pq4::pack_block(rows, code_size, nb, block.data());
+    ASSERT_EQ(0, memcmp(block.data(),
+                        list.blocks.data() + j0 / pq4::kBlockSize * block_bytes,
+                        block_bytes))
+        << "j0=" << j0;
+  }
+}
+
+TEST(PQ4FastScan, BlockCache) {
+  mt19937 rng(5);
+  size_t code_size = 8, nlist = 2;
+  vector<uint8_t> codes = RandomCodes(200, code_size, rng);
+  pq4::BlockCache cache(nlist, code_size);
+
+  auto list = cache.get(1, codes.data(), 50, 0);
+  CheckPacked(*list, codes, code_size, 50);
+  ASSERT_EQ(64 * code_size, cache.mem_bytes());
+  // fewer codes of the same version reuse the blocks
+  ASSERT_EQ(list, cache.get(1, codes.data(), 40, 0));
+  ASSERT_EQ(list, cache.get(1, codes.data(), 50, 0));
+
+  // appended codes extend the blocks, the partial one is packed again
+  auto extended = cache.get(1, codes.data(), 130, 0);
+  ASSERT_NE(list, extended);
+  CheckPacked(*extended, codes, code_size, 130);
+  ASSERT_EQ(160 * code_size, cache.mem_bytes());
+  CheckPacked(*list, codes, code_size, 50);  // kept by its scan
+
+  // a code changed in place comes with a new version
+  codes[3 * code_size] ^= 0xff;
+  ASSERT_EQ(extended, cache.get(1, codes.data(), 130, 0));
+  auto updated = cache.get(1, codes.data(), 130, 1);
+  ASSERT_NE(extended, updated);
+  CheckPacked(*updated, codes, code_size, 130);
+
+  // a compacted list has another codes array
+  vector<uint8_t> compacted(codes.begin() + 10 * code_size, codes.end());
+  auto repacked = cache.get(1, compacted.data(), 100, 1);
+  CheckPacked(*repacked, compacted, code_size, 100);
+
+  cache.get(0, codes.data(), 1, 0);
+  ASSERT_EQ((128 + 32) * code_size, cache.mem_bytes());
+}
+
+TEST(PQ4FastScan, AccumulateMatchesScalar) {
+  mt19937 rng(11);
+  for (size_t M : {2, 4, 8, 16, 32, 64}) {
+    size_t code_size = M / 2;
+    vector<float> tab = RandomTables(M, pq4::kSubCentroids, 0, 10, rng);
+    vector<uint8_t> lut(M * pq4::kSubCentroids);
+    float bias = 0, scale = 1;
+    pq4::quantize_lut(M, tab.data(), lut.data(), &bias, &scale);
+
+    vector<uint8_t> codes = RandomCodes(pq4::kBlockSize, code_size, rng);
+    const uint8_t *rows[pq4::kBlockSize];
+    for (int v = 0; v < pq4::kBlockSize; v++) {
+      rows[v] = codes.data() + v * code_size;
+    }
+    vector<uint8_t> block(code_size * pq4::kBlockSize);
+    pq4::pack_block(rows, code_size, pq4::kBlockSize, block.data());
+
+    uint16_t acc[pq4::kBlockSize], ref[pq4::kBlockSize];
+    pq4::accumulate_block_scalar(M, block.data(), lut.data(), pq4::kBlockSize,
+                                 0, true, ref);
+    for (int v = 0; v < pq4::kBlockSize; v++) {
+      int sum = 0;
+      for (size_t i = 0; i < code_size; i++) {
+        uint8_t c = rows[v][i];
+        sum += lut[2 * i * pq4::kSubCentroids + (c & 15)];
+        sum += lut[(2 * i + 1) * pq4::kSubCentroids + (c >> 4)];
+      }
+      ASSERT_EQ(sum, ref[v]) << "M=" << M << ", v=" << v;
+    }
+    std::vector<uint16_t> sorted(ref, ref + pq4::kBlockSize);
+    std::sort(sorted.begin(), sorted.end());
+
+    for (int threshold : {-1, 0, (int)sorted[0], (int)sorted[16],
+                          (int)sorted[31], 32767}) {
+      for (bool less : {true, false}) {
+        for (size_t n : {32, 17}) {
+          uint32_t mask = pq4::accumulate_block(M, block.data(), lut.data(), n,
+                                                threshold, less, acc);
+          uint32_t ref_mask = pq4::accumulate_block_scalar(
+              M, block.data(), lut.data(), n, threshold, less, ref);
+          ASSERT_EQ(ref_mask, mask) << "M=" << M << ", threshold="
+                                    << threshold << ", less=" << less
+                                    << ", n=" << n;
+          for (int v = 0; v < pq4::kBlockSize; v++) {
+            ASSERT_EQ(ref[v], acc[v]) << "M=" << M << ", v=" << v;
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(PQ4FastScan, BoundsL2) {
+  mt19937 rng(13);
+  for (size_t M : {2, 8, 16, 32, 64}) {
+    CheckBounds(M, false, rng);
+  }
+}
+
+TEST(PQ4FastScan, BoundsInnerProduct) {
+  mt19937 rng(17);
+  for (size_t M : {2, 8, 16, 32, 64}) {
+    CheckBounds(M, true, rng);
+  }
+}
+
+TEST(PQ8Scan, Kernels) {
+  mt19937 rng(19);
+  std::string saved = pq8::kernel_name();
+  size_t ncode = 3 * pq8::kBatchSize + 13;
+  for (size_t M : {4, 8, 12, 16, 32, 64}) {
+    vector<float> tab = RandomTables(M, 256, -1, 1, rng);
+    vector<uint8_t> codes = RandomCodes(ncode, M, rng);
+    float dis0 = 0.5f;
+    // one more for the check that nothing is written past n
+    vector<float> ref(ncode), dis(ncode + 1);
+    ASSERT_EQ(0, pq8::set_kernel("scalar"));
+    pq8::compute_distances(M, tab.data(), dis0, codes.data(), ncode,
+                           ref.data());
+    for (size_t j = 0; j < ncode; j++) {
+      float d = dis0;
+      for (size_t m = 0; m < M; m++) d += tab[m * 256 + codes[j * M + m]];
+      ASSERT_EQ(d, ref[j]) << "M=" << M << ", j=" << j;
+    }
+
+    for (const char *kernel : {"avx2", "avx512"}) {
+      if (pq8::set_kernel(kernel)) continue;  // the cpu doesn't support it
+      // whole batches, a tail shorter than a vector register and one code
+      for (size_t n : {ncode, (size_t)7, (size_t)1}) {
+        std::fill(dis.begin(), dis.end(), -1);
+        pq8::compute_distances(M, tab.data(), dis0, codes.data(), n,
+                               dis.data());
+        for (size_t j = 0; j < n; j++) {
+          ASSERT_EQ(ref[j], dis[j])
+              << "kernel=" << kernel << ", M=" << M << ", n=" << n
+              << ", j=" << j;
+        }
+        ASSERT_EQ(-1, dis[n]) << "kernel=" << kernel << ", M=" << M;
+      }
+    }
+  }
+  ASSERT_EQ(0, pq8::set_kernel(saved.c_str()));
+  ASSERT_NE(0, pq8::set_kernel("avx1024"));
+}
+
+TEST(PQ8Scan, FilteredBatch) {
+  mt19937 rng(23);
+  size_t M = 16;
+  size_t n = pq8::kBatchSize;
+  vector<float> tab = RandomTables(M, 256, 0, 1, rng);
+  vector<uint8_t> codes = RandomCodes(n, M, rng);
+  float dis[pq8::kBatchSize];
+  pq8::compute_distances(M, tab.data(), 0, codes.data(), n, dis);
+  vector<float> sorted(dis, dis + n);
+  std::sort(sorted.begin(), sorted.end());
+  float top = sorted[n / 2];
+
+  // every third vector is deleted, vids of the batch are 100 + j. The
+  // bitmap covers the vids from vid_begin, the first and the last ones of
+  // the batch are out of it
+  long vid_begin = 105, vid_end = 100 + n - 5;
+  long vid_num = vid_end - vid_begin;
+  vector<char> vid_bitmap((vid_num + 7) / 8, 0);
+  vector<int64_t> ids(n);
+  for (size_t j = 0; j < n; j++) {
+    int64_t vid = 100 + j;
+    ids[j] = j % 3 == 0 ? vid | INT64_MIN : vid;
+    // even vids are allowed
+    int64_t bit = vid - vid_begin;
+    if (vid % 2 == 0 && bit >= 0 && bit < vid_num) {
+      vid_bitmap[bit >> 3] |= 1 << (bit & 7);
+    }
+  }
+
+  for (bool allow_list : {false, true}) {
+    for (bool less : {true, false}) {
+      uint64_t skipped =
+          pq8::skipped(ids.data(), n, allow_list ? vid_bitmap.data() : nullptr,
+                       vid_begin, vid_num);
+      uint64_t mask = pq8::select(dis, n, top, less) & ~skipped;
+      for (size_t j = 0; j < n; j++) {
+        int64_t vid = 100 + j;
+        bool deleted = j % 3 == 0;
+        bool allowed = !allow_list ||
+                       (vid % 2 == 0 && vid >= vid_begin && vid < vid_end);
+        bool better = less ? dis[j] < top : dis[j] > top;
+        ASSERT_EQ(!deleted && allowed, !((skipped >> j) & 1))
+            << "j=" << j << ", allow_list=" << allow_list;
+        ASSERT_EQ(!deleted && allowed && better, (bool)((mask >> j) & 1))
+            << "j=" << j << ", allow_list=" << allow_list << ", less=" << less;
+      }
+    }
+  }
+  // a partial batch has no bits past n
+  ASSERT_EQ(0, pq8::skipped(ids.data(), 10, vid_bitmap.data(), vid_begin,
+                            vid_num) >> 10);
+}
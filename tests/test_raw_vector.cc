@@ -17,6 +17,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
@@ -24,9 +25,13 @@
 #include <iostream>
 #include <string>
 #include <thread>
+#include "float16.h"
+#include "memory_policy.h"
 #include "raw_vector_factory.h"
+#include "source_store.h"
 #include "test.h"
 #include "utils.h"
+#include "vector_cache.h"
 #include "vector_file_mapper.h"
 
 using namespace tig_gamma;
@@ -235,6 +240,251 @@ TEST(MmapRawVector, Update) {
   delete raw_vector;
 }
 
+TEST(MmapRawVector, UpdateDiskMode) {
+  string root_path = "./" + GetCurrentCaseName();
+  string name = "abc";
+  int max_size = 100000;
+  int dimension = 511;
+  utils::remove_dir(root_path.c_str());
+  utils::make_dir(root_path.c_str());
+
+  // the buffer keeps 2048 vectors, so most of them are only in file
+  StoreParams store_params;
+  store_params.cache_size_ = 2048 * dimension * sizeof(float);
+  RawVector<float> *raw_vector =
+      new MmapRawVector<float>(name, dimension, max_size, root_path, store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  int doc_num = 10000;
+  AddToRawVector(raw_vector, 0, doc_num, dimension);
+  float addition = 0.5f;
+  int update_num = 100;
+  UpdateToRawVector(raw_vector, 0, update_num, dimension, addition);
+  // buffered vectors
+  UpdateToRawVector(raw_vector, doc_num - update_num, update_num, dimension,
+                    addition);
+  ValidateVector(raw_vector, 0, update_num, dimension, addition);
+  ValidateVector(raw_vector, doc_num - update_num, doc_num, dimension,
+                 addition);
+  ValidateVector(raw_vector, update_num, doc_num - update_num, dimension);
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+}
+
+TEST(MmapRawVector, PrefetchFlushed) {
+  string root_path = "./" + GetCurrentCaseName();
+  string name = "abc";
+  int max_size = 100000;
+  int dimension = 512;
+  utils::remove_dir(root_path.c_str());
+  utils::make_dir(root_path.c_str());
+
+  StoreParams store_params;
+  store_params.cache_size_ = 2048 * dimension * sizeof(float);
+  MmapRawVector<float> *raw_vector = new MmapRawVector<float>(
+      name, dimension, max_size, root_path, store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  int doc_num = 5000;
+  AddToRawVector(raw_vector, 0, doc_num, dimension);
+  ASSERT_EQ(0, raw_vector->Dump("", 0, doc_num - 1));
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+
+  raw_vector = new MmapRawVector<float>(name, dimension, max_size, root_path,
+                                        store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  vector<string> paths;
+  ASSERT_EQ(0, raw_vector->Load(paths, doc_num));
+  // the buffer wraps, vectors added after load are only in file
+  AddToRawVector(raw_vector, doc_num, doc_num, dimension);
+  raw_vector->Until(2 * doc_num);
+
+  int k = 10;
+  vector<long> ids;
+  for (int i = 0; i < k; i++) ids.push_back(doc_num + i * 200);
+  {
+    ScopeVectors<float> vecs(k);
+    ASSERT_EQ(0, raw_vector->Gets(k, ids.data(), vecs));
+    // vectors far from each other are advised one range each
+    ASSERT_EQ(k, raw_vector->GetPrefetchedRanges());
+    for (int i = 0; i < k; i++) {
+      float *expect = BuildVector(dimension, ids[i]);
+      ASSERT_TRUE(
+          floatArrayEquals(expect, dimension, vecs.Get()[i], dimension))
+          << "vid=" << ids[i];
+      delete[] expect;
+    }
+  }
+
+  // vectors in buffer are read from memory, they aren't advised
+  ids.clear();
+  for (int i = 0; i < k; i++) ids.push_back(2 * doc_num - 1 - i * 100);
+  {
+    ScopeVectors<float> buffered_vecs(k);
+    ASSERT_EQ(0, raw_vector->Gets(k, ids.data(), buffered_vecs));
+    ASSERT_EQ(k, raw_vector->GetPrefetchedRanges());
+    for (int i = 0; i < k; i++) {
+      float *expect = BuildVector(dimension, ids[i]);
+      ASSERT_TRUE(floatArrayEquals(expect, dimension, buffered_vecs.Get()[i],
+                                   dimension))
+          << "vid=" << ids[i];
+      delete[] expect;
+    }
+  }
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+}
+
+TEST(MmapRawVector, PinnedWhileWrapping) {
+  string root_path = "./" + GetCurrentCaseName();
+  string name = "abc";
+  int max_size = 100000;
+  int dimension = 128;
+  utils::remove_dir(root_path.c_str());
+  utils::make_dir(root_path.c_str());
+
+  StoreParams store_params;
+  store_params.cache_size_ = 1024 * dimension * sizeof(float);
+  MmapRawVector<float> *raw_vector = new MmapRawVector<float>(
+      name, dimension, max_size, root_path, store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  int doc_num = 600;
+  AddToRawVector(raw_vector, 0, doc_num, dimension);
+  raw_vector->Until(doc_num);
+
+  int vid = 300;
+  float *expect = BuildVector(dimension, vid);
+  std::atomic<int> added(doc_num);
+  std::thread *adder = nullptr;
+  {
+    ScopeVector<float> vec;
+    RawVector<float> *base = raw_vector;
+    ASSERT_EQ(0, base->GetVector(vid, vec));
+    ASSERT_FALSE(vec.deletable_);  // read in place
+
+    // ingest wraps the buffer over the held vector
+    adder = new std::thread([&]() {
+      for (int i = doc_num; i < doc_num + 1024; i++) {
+        Field *field = BuildVectorField(dimension, i);
+        raw_vector->Add(i, field);
+        DestroyField(field);
+        added++;
+      }
+    });
+    Sleep(500);
+    EXPECT_LT(added, doc_num + 1024);
+    EXPECT_TRUE(floatArrayEquals(expect, dimension, vec.Get(), dimension));
+  }
+  adder->join();
+  delete adder;
+  ASSERT_EQ(doc_num + 1024, added);
+  raw_vector->Until(doc_num + 1024);
+  ValidateVector(raw_vector, 0, doc_num + 1024, dimension);
+
+  delete[] expect;
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+}
+
+TEST(MmapRawVector, FileHeader) {
+  string root_path = "./" + GetCurrentCaseName();
+  string name = "abc";
+  string file_path = root_path + "/" + name + ".fet";
+  int max_size = 100000;
+  int dimension = 128;
+  utils::remove_dir(root_path.c_str());
+  utils::make_dir(root_path.c_str());
+
+  StoreParams store_params;
+  store_params.cache_size_ = max_size * dimension * sizeof(float);
+  store_params.verify_checksum_ = true;
+  RawVector<float> *raw_vector = new MmapRawVector<float>(
+      name, dimension, max_size, root_path, store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  int doc_num = 5000;
+  AddToRawVector(raw_vector, 0, doc_num, dimension);
+  ASSERT_EQ(0, raw_vector->Dump(root_path + "/dump", 0, doc_num - 1));
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+
+  VectorFileHeader header;
+  ASSERT_EQ(0, ReadVectorFileHeader(file_path, header));
+  ASSERT_EQ((uint64_t)doc_num, header.vector_num);
+  ASSERT_EQ((uint32_t)dimension, header.dimension);
+  ASSERT_TRUE(header.flags & VectorFileHeader::kChecksumValid);
+
+  // memory mode maps the file instead of reading it
+  vector<string> paths;
+  raw_vector = new MmapRawVector<float>(name, dimension, max_size, root_path,
+                                        store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  ASSERT_EQ(0, raw_vector->Load(paths, doc_num));
+  ValidateVector(raw_vector, 0, doc_num, dimension);
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+
+  int fd = open(file_path.c_str(), O_WRONLY);
+  float broken = -1;
+  ASSERT_EQ((ssize_t)sizeof(float),
+            pwrite(fd, &broken, sizeof(float),
+                   header.header_size + 100 * dimension * sizeof(float)));
+  close(fd);
+  raw_vector = new MmapRawVector<float>(name, dimension, max_size, root_path,
+                                        store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  ASSERT_NE(0, raw_vector->Load(paths, doc_num));
+  delete raw_vector;
+}
+
+TEST(MmapRawVector, DirectIO) {
+  string root_path = "./" + GetCurrentCaseName();
+  string name = "abc";
+  int max_size = 100000;
+  // vectors are not aligned to blocks
+  int dimension = 127;
+  utils::remove_dir(root_path.c_str());
+  utils::make_dir(root_path.c_str());
+
+  StoreParams store_params;
+  store_params.cache_size_ = 2048 * dimension * sizeof(float);
+  store_params.direct_io_ = true;
+  store_params.flush_chunk_size_ = 100 * 1024;
+  MmapRawVector<float> *mmap_vector = new MmapRawVector<float>(
+      name, dimension, max_size, root_path, store_params);
+  RawVector<float> *raw_vector = mmap_vector;
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  int doc_num = 5000;
+  AddToRawVector(raw_vector, 0, doc_num, dimension);
+  ASSERT_EQ(0, raw_vector->Dump(root_path + "/dump", 0, doc_num - 1));
+  ASSERT_EQ(0, mmap_vector->GetFlushLag());
+  // it is in the partial block which is written again
+  UpdateToRawVector(raw_vector, doc_num - 1, 1, dimension, 0.5f);
+  AddToRawVector(raw_vector, doc_num, 1, dimension);
+  ASSERT_EQ(0, raw_vector->Dump(root_path + "/dump", doc_num, doc_num));
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+
+  vector<string> paths;
+  raw_vector = new MmapRawVector<float>(name, dimension, max_size, root_path,
+                                        store_params);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  ASSERT_EQ(0, raw_vector->Load(paths, doc_num + 1));
+  ValidateVector(raw_vector, 0, doc_num - 1, dimension);
+  ValidateVector(raw_vector, doc_num - 1, doc_num, dimension, 0.5f);
+  ASSERT_EQ(VectorFileHeader::kHeaderSize +
+                (doc_num + 1) * dimension * sizeof(float),
+            utils::get_file_size(root_path + "/" + name + ".fet"));
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+}
+
 TEST(MmapRawVector, Normal) {
   string root_path = "./" + GetCurrentCaseName();
   string name = "abc";
@@ -352,7 +602,7 @@ TEST(MmapRawVector, DumpLoad) {
   ASSERT_EQ(load_num, raw_vector->GetVectorNum());
   // ASSERT_EQ(load_num * sizeof(int),
   //           utils::get_file_size(root_path + "/" + name + ".docid"));
-  ASSERT_EQ(load_num * dimension * sizeof(float),
+  ASSERT_EQ(VectorFileHeader::kHeaderSize + load_num * dimension * sizeof(float),
             utils::get_file_size(root_path + "/" + name + ".fet"));
   ASSERT_EQ(update_num * (dimension * sizeof(float) + sizeof(int)),
             utils::get_file_size(root_path + "/" + name + "_updated.fet"));
@@ -392,6 +642,209 @@ TEST(MmapRawVector, DumpLoad) {
   delete raw_vector;
 }
 
+TEST(MmapRawVector, DumpLoadSources) {
+  string root_path = GetCurrentCaseName();
+  string name = "abc";
+  int max_size = 10000;
+  int dimension = 8;
+
+  utils::remove_dir(root_path.c_str());
+  utils::make_dir(root_path.c_str());
+
+  // sources of 2000 docs are several chunks of the load
+  int doc_num = 2000;
+  auto make_source = [](int docid) {
+    return string(docid % 7 == 0 ? 0 : 1000 + docid * 37 % 5000,
+                  'a' + docid % 26);
+  };
+  RawVector<float> *raw_vector =
+      RawVectorFactory::Create(Mmap, name, dimension, max_size, root_path, "");
+  ASSERT_EQ(0, raw_vector->Init(true, true));
+  StartFlushingIfNeed(raw_vector);
+  for (int i = 0; i < doc_num; i++) {
+    float *data = BuildVector(dimension, i);
+    string source = make_source(i);
+    Field *field = MakeField(
+        nullptr, MakeByteArray((char *)data, sizeof(float) * dimension),
+        MakeByteArray(source.c_str(), source.size()), VECTOR);
+    delete[] data;
+    ASSERT_EQ(0, raw_vector->Add(i, field));
+    DestroyField(field);
+  }
+  ASSERT_EQ(0, raw_vector->Dump(root_path + "/dump", 0, doc_num - 1));
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+
+  raw_vector =
+      RawVectorFactory::Create(Mmap, name, dimension, max_size, root_path, "");
+  ASSERT_EQ(0, raw_vector->Init(true, true));
+  StartFlushingIfNeed(raw_vector);
+  vector<string> paths;
+  ASSERT_EQ(0, raw_vector->Load(paths, doc_num));
+  ASSERT_EQ(doc_num, raw_vector->GetVectorNum());
+  for (int i = 0; i < doc_num; i++) {
+    char *str = nullptr;
+    int len = 0;
+    raw_vector->GetSource(i, str, len);
+    ASSERT_EQ(make_source(i), string(str ? str : "", len)) << "vid=" << i;
+  }
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+}
+
+uint16_t EncodeHalf(float f) {
+  // 8 values go through the F16C path, the 9th through the scalar one
+  float x[9];
+  uint16_t h[9];
+  for (int i = 0; i < 9; i++) x[i] = f;
+  float16::encode(x, h, 9);
+  EXPECT_EQ(h[0], h[8]) << "vector and scalar encode differ, f=" << f;
+  return h[8];
+}
+
+TEST(Float16, EncodeDecode) {
+  // exact values
+  ASSERT_EQ(0x0000, EncodeHalf(0.0f));
+  ASSERT_EQ(0x8000, EncodeHalf(-0.0f));
+  ASSERT_EQ(0x3c00, EncodeHalf(1.0f));
+  ASSERT_EQ(0xc100, EncodeHalf(-2.5f));
+  ASSERT_EQ(0x7bff, EncodeHalf(65504.0f));  // largest normal
+
+  // subnormals
+  ASSERT_EQ(0x0001, EncodeHalf(ldexpf(1, -24)));
+  ASSERT_EQ(0x03ff, EncodeHalf(ldexpf(1, -14) - ldexpf(1, -24)));
+  ASSERT_EQ(0x0400, EncodeHalf(ldexpf(1, -14)));  // smallest normal
+  ASSERT_EQ(0x0000, EncodeHalf(ldexpf(1, -25)));  // tie to even zero
+  ASSERT_EQ(0x0002, EncodeHalf(3 * ldexpf(1, -25)));
+  ASSERT_EQ(0x8001, EncodeHalf(-ldexpf(1, -24)));
+
+  // ties round to even
+  ASSERT_EQ(0x3c00, EncodeHalf(1.0f + ldexpf(1, -11)));
+  ASSERT_EQ(0x3c02, EncodeHalf(1.0f + 3 * ldexpf(1, -11)));
+  ASSERT_EQ(0x3c01, EncodeHalf(1.0f + ldexpf(1, -11) + ldexpf(1, -20)));
+
+  // overflow to inf
+  ASSERT_EQ(0x7bff, EncodeHalf(65519.0f));
+  ASSERT_EQ(0x7c00, EncodeHalf(65520.0f));
+  ASSERT_EQ(0x7c00, EncodeHalf(1e10f));
+  ASSERT_EQ(0xfc00, EncodeHalf(-1e10f));
+  ASSERT_EQ(0x7c00, EncodeHalf(INFINITY));
+  ASSERT_EQ(0xfc00, EncodeHalf(-INFINITY));
+
+  uint16_t nan = EncodeHalf(NAN);
+  ASSERT_EQ(0x7c00, nan & 0x7c00);
+  ASSERT_NE(0, nan & 0x3ff);
+
+  // every half value decodes to a float which encodes back to it, the
+  // 65536 values are decoded 8 at a time and the last ones by the tail
+  vector<uint16_t> halves(65536 + 3);
+  for (size_t i = 0; i < halves.size(); i++) halves[i] = (uint16_t)i;
+  vector<float> floats(halves.size());
+  float16::decode(halves.data(), floats.data(), halves.size());
+  vector<uint16_t> encoded(halves.size());
+  float16::encode(floats.data(), encoded.data(), floats.size());
+  for (size_t i = 0; i < halves.size(); i++) {
+    uint16_t h = halves[i];
+    float one = 0;
+    float16::decode(&h, &one, 1);
+    if ((h & 0x7c00) == 0x7c00 && (h & 0x3ff)) {
+      ASSERT_TRUE(std::isnan(floats[i])) << "h=" << h;
+      ASSERT_TRUE(std::isnan(one)) << "h=" << h;
+      continue;
+    }
+    ASSERT_EQ(0, memcmp(&floats[i], &one, sizeof(float))) << "h=" << h;
+    ASSERT_EQ(h, encoded[i]) << "f=" << floats[i];
+  }
+  ASSERT_EQ(1.0f, floats[0x3c00]);
+  ASSERT_EQ(ldexpf(1, -24), floats[0x0001]);
+  ASSERT_EQ(65504.0f, floats[0x7bff]);
+  ASSERT_EQ(INFINITY, floats[0x7c00]);
+  ASSERT_EQ(-INFINITY, floats[0xfc00]);
+}
+
+TEST(Float16, Distance) {
+  int d = 37;  // 16 + 8 + a scalar tail
+  vector<float> x(d), y(d);
+  for (int i = 0; i < d; i++) {
+    x[i] = 0.25f * i - 3;
+    y[i] = 0.5f * (d - i);
+  }
+  vector<uint16_t> hx(d), hy(d);
+  float16::encode(x.data(), hx.data(), d);
+  float16::encode(y.data(), hy.data(), d);
+  // all values are exact in half precision
+  float l2 = 0, ip = 0;
+  for (int i = 0; i < d; i++) {
+    l2 += (x[i] - y[i]) * (x[i] - y[i]);
+    ip += x[i] * y[i];
+  }
+  ASSERT_FLOAT_EQ(l2, float16::L2sqr(x.data(), hy.data(), d));
+  ASSERT_FLOAT_EQ(ip, float16::inner_product(x.data(), hy.data(), d));
+  ASSERT_FLOAT_EQ(l2, float16::L2sqr(hx.data(), hy.data(), d));
+  ASSERT_FLOAT_EQ(ip, float16::inner_product(hx.data(), hy.data(), d));
+}
+
+TEST(Float16RawVector, DumpLoad) {
+  string root_path = GetCurrentCaseName();
+  string name = "abc";
+  int max_size = 10000;
+  // the values of BuildVector are exact in half precision below 1024
+  int dimension = 64;
+  string store_param = "{\"precision\": \"fp16\"}";
+
+  utils::remove_dir(root_path.c_str());
+  utils::make_dir(root_path.c_str());
+
+  RawVector<float> *raw_vector = RawVectorFactory::Create(
+      Mmap, name, dimension, max_size, root_path, store_param);
+  ASSERT_NE(nullptr, raw_vector);
+  ASSERT_NE(nullptr, dynamic_cast<Float16RawVector *>(raw_vector));
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+
+  int doc_num = 500;
+  AddToRawVector(raw_vector, 0, doc_num, dimension);
+  ASSERT_EQ(doc_num, raw_vector->GetVectorNum());
+  ValidateVector(raw_vector, 0, doc_num, dimension);
+  ValidateVectorHeader(raw_vector, 0, doc_num, dimension);
+
+  int update_num = 100;
+  UpdateToRawVector(raw_vector, 0, update_num, dimension, 0.5f);
+  ValidateVector(raw_vector, 0, update_num, dimension, 0.5f);
+
+  // half vectors are the encoded floats
+  Float16RawVector *fp16_vector = dynamic_cast<Float16RawVector *>(raw_vector);
+  vector<uint16_t> expect(dimension);
+  float *v = BuildVector(dimension, 200);
+  float16::encode(v, expect.data(), dimension);
+  delete[] v;
+  ScopeVector<uint16_t> half;
+  ASSERT_EQ(0, fp16_vector->GetFP16Vector(200, half));
+  ASSERT_EQ(0, memcmp(expect.data(), half.Get(),
+                      dimension * sizeof(uint16_t)));
+
+  ASSERT_EQ(0, raw_vector->Dump(root_path + "/dump", 0, doc_num - 1));
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+
+  raw_vector = RawVectorFactory::Create(Mmap, name, dimension, max_size,
+                                        root_path, store_param);
+  ASSERT_NE(nullptr, raw_vector);
+  ASSERT_EQ(0, raw_vector->Init(false, false));
+  StartFlushingIfNeed(raw_vector);
+  vector<string> paths;
+  ASSERT_EQ(0, raw_vector->Load(paths, doc_num));
+  ASSERT_EQ(doc_num, raw_vector->GetVectorNum());
+  ValidateVector(raw_vector, 0, update_num, dimension, 0.5f);
+  ValidateVector(raw_vector, update_num, doc_num, dimension);
+  // 2 bytes per dimension on disk
+  ASSERT_EQ(VectorFileHeader::kHeaderSize +
+                doc_num * dimension * sizeof(uint16_t),
+            utils::get_file_size(root_path + "/" + name + "_fp16.fet"));
+  StopFlushingIfNeed(raw_vector);
+  delete raw_vector;
+}
+
 int CreateFeatureFile(string file_path, int max_size, int dimension) {
   int fd = open(file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 00777);
   assert(-1 != fd);
@@ -619,6 +1072,297 @@ TEST(VectorBufferQueue, BatchPush) {
   delete queue;
 }
 
+TEST(VectorBufferQueue, GetVectorRef) {
+  int dimension = 4;
+  int max_buffer_size = 80;
+  int chunk_num = 8;
+
+  VectorBufferQueue<float> *queue =
+      new VectorBufferQueue<float>(max_buffer_size, dimension, chunk_num);
+  ASSERT_EQ(0, queue->Init());
+  float *vecs = BuildVectors(max_buffer_size * 2, dimension, 0);
+  ASSERT_EQ(0, queue->Push(vecs, dimension, 70, -1));
+  float *pop_vecs = new float[max_buffer_size * dimension];
+  ASSERT_EQ(0, queue->Pop(pop_vecs, dimension, 70, -1));
+
+  std::atomic<int> *pin = nullptr;
+  const float *ref = queue->GetVectorRef(5, pin);
+  ASSERT_NE(nullptr, ref);
+  ASSERT_NE(nullptr, pin);
+  ASSERT_TRUE(floatArrayEquals(vecs + 5 * dimension, dimension, ref, dimension));
+  (*pin)--;
+  ASSERT_EQ(nullptr, queue->GetVectorRef(70, pin));  // not pushed
+
+  // the first chunk is overwritten
+  ASSERT_EQ(0, queue->Push(vecs + 70 * dimension, dimension, 15, -1));
+  ASSERT_EQ(nullptr, queue->GetVectorRef(5, pin));
+  // in the safe window of next pushes
+  ASSERT_EQ(nullptr, queue->GetVectorRef(12, pin));
+  ref = queue->GetVectorRef(20, pin);
+  ASSERT_NE(nullptr, ref);
+  ASSERT_TRUE(
+      floatArrayEquals(vecs + 20 * dimension, dimension, ref, dimension));
+  (*pin)--;
+
+  delete[] pop_vecs;
+  delete[] vecs;
+  delete queue;
+}
+
+TEST(VectorBufferQueue, PinnedRef) {
+  int dimension = 4;
+  int max_buffer_size = 80;
+  int chunk_num = 8;
+
+  VectorBufferQueue<float> *queue =
+      new VectorBufferQueue<float>(max_buffer_size, dimension, chunk_num);
+  ASSERT_EQ(0, queue->Init());
+  float *vecs = BuildVectors(max_buffer_size * 2, dimension, 0);
+  float *pop_vecs = new float[max_buffer_size * dimension];
+  ASSERT_EQ(0, queue->Push(vecs, dimension, 70, -1));
+  ASSERT_EQ(0, queue->Pop(pop_vecs, dimension, 70, -1));
+
+  std::atomic<int> *pin = nullptr;
+  const float *ref = queue->GetVectorRef(20, pin);
+  ASSERT_NE(nullptr, ref);
+
+  // the ring wraps up to the pinned chunk
+  std::atomic<int> pushed(0);
+  std::thread pusher([&]() {
+    for (int i = 70; i < 110; i++) {
+      queue->Push(vecs + i * dimension, dimension, -1);
+      pushed++;
+    }
+  });
+  Sleep(200);
+  EXPECT_EQ(30, pushed);
+  EXPECT_TRUE(
+      floatArrayEquals(vecs + 20 * dimension, dimension, ref, dimension));
+  (*pin)--;
+  pusher.join();
+  ASSERT_EQ(40, pushed);
+  ASSERT_EQ(nullptr, queue->GetVectorRef(20, pin));
+  float v[4];
+  ASSERT_EQ(0, queue->GetVector(100, v, dimension));
+  ASSERT_TRUE(floatArrayEquals(vecs + 100 * dimension, dimension, v, dimension));
+
+  delete[] pop_vecs;
+  delete[] vecs;
+  delete queue;
+}
+
+TEST(SourceStore, SetOverwrite) {
+  int max_num = 1000;
+  // small segments, so sources span several of them, overwritten space is
+  // reused at once
+  SourceStore *store = new SourceStore(max_num, "", 4096, 0);
+  ASSERT_EQ(0, store->Init());
+  for (int i = 0; i < max_num; i++) {
+    string source = "source_" + std::to_string(i);
+    ASSERT_EQ(0, store->Set(i, source.c_str(), source.size()));
+  }
+  int segment_num = store->GetSegmentNum();
+  ASSERT_LT(1, segment_num);
+
+  // sources with the same length reuse the space of overwritten ones
+  for (int i = 0; i < max_num; i++) {
+    string source = "SOURCE_" + std::to_string(i);
+    ASSERT_EQ(0, store->Set(i, source.c_str(), source.size()));
+  }
+  ASSERT_EQ(segment_num, store->GetSegmentNum());
+  for (int i = 0; i < max_num; i++) {
+    char *str = nullptr;
+    int len = 0;
+    ASSERT_EQ(0, store->Get(i, str, len));
+    ASSERT_EQ("SOURCE_" + std::to_string(i), string(str, len));
+  }
+
+  char *str = nullptr;
+  int len = -1;
+  ASSERT_EQ(0, store->Set(0, nullptr, 0));
+  ASSERT_EQ(0, store->Get(0, str, len));
+  ASSERT_EQ(nullptr, str);
+  ASSERT_EQ(0, len);
+  delete store;
+}
+
+TEST(SourceStore, OverwriteVaryingLength) {
+  int max_num = 1000, max_len = 300;
+  SourceStore *store = new SourceStore(max_num, "", 4096, 0);
+  ASSERT_EQ(0, store->Init());
+  unsigned int state = 7;
+  vector<string> sources(max_num);
+  auto set = [&](int id) {
+    sources[id] = string(rand_r(&state) % max_len + 1, 'a' + id % 26);
+    return store->Set(id, sources[id].c_str(), sources[id].size());
+  };
+  for (int i = 0; i < max_num; i++) ASSERT_EQ(0, set(i));
+  int segment_num = store->GetSegmentNum();
+
+  // freed blocks are split for shorter sources and merged for longer ones,
+  // so the segments stay near the live bytes
+  for (int round = 0; round < 50; round++) {
+    for (int i = 0; i < max_num; i++) {
+      ASSERT_EQ(0, set(rand_r(&state) % max_num));
+    }
+  }
+  ASSERT_GE(segment_num * 5 / 4, store->GetSegmentNum());
+  for (int i = 0; i < max_num; i++) {
+    char *str = nullptr;
+    int len = 0;
+    ASSERT_EQ(0, store->Get(i, str, len));
+    ASSERT_EQ(sources[i], string(str, len));
+  }
+  delete store;
+}
+
+TEST(SourceStore, ReuseDelay) {
+  int max_num = 1000;
+  int reuse_delay = 200;
+  SourceStore *store = new SourceStore(max_num, "", 4096, reuse_delay);
+  ASSERT_EQ(0, store->Init());
+  for (int i = 0; i < max_num; i++) {
+    string source = "source_" + std::to_string(i);
+    ASSERT_EQ(0, store->Set(i, source.c_str(), source.size()));
+  }
+  int segment_num = store->GetSegmentNum();
+
+  // overwritten space isn't reused before the delay
+  for (int i = 0; i < max_num; i++) {
+    string source = "SOURCE_" + std::to_string(i);
+    ASSERT_EQ(0, store->Set(i, source.c_str(), source.size()));
+  }
+  ASSERT_LT(segment_num, store->GetSegmentNum());
+  ASSERT_LT(0, store->GetRetiredBytes());
+
+  // and it is reused after
+  segment_num = store->GetSegmentNum();
+  std::this_thread::sleep_for(std::chrono::milliseconds(reuse_delay + 50));
+  for (int i = 0; i < max_num; i++) {
+    string source = "source_" + std::to_string(i);
+    ASSERT_EQ(0, store->Set(i, source.c_str(), source.size()));
+  }
+  ASSERT_EQ(segment_num, store->GetSegmentNum());
+  delete store;
+}
+
+TEST(SourceStore, ConcurrentSetGet) {
+  int max_num = 1000;
+  int reuse_delay = 50;
+  SourceStore *store = new SourceStore(max_num, "", 64 * 1024, reuse_delay);
+  ASSERT_EQ(0, store->Init());
+  // sources of the same length, so overwritten space of any id fits others
+  auto make_source = [](int id, int round) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%06d_%06d", id, round);
+    return string(buf);
+  };
+  for (int i = 0; i < max_num; i++) {
+    string source = make_source(i, 0);
+    ASSERT_EQ(0, store->Set(i, source.c_str(), source.size()));
+  }
+
+  std::atomic<bool> stop(false);
+  std::atomic<long> errors(0);
+  std::atomic<long> reads(0);
+  auto reader = [&](int seed) {
+    unsigned int state = seed;
+    while (!stop) {
+      int id = rand_r(&state) % max_num;
+      char *str = nullptr;
+      int len = 0;
+      if (store->Get(id, str, len) || str == nullptr) {
+        errors++;
+        continue;
+      }
+      // the copy is made after Get, as the callers of GetSource do
+      string copy(str, len);
+      if (copy.compare(0, 6, make_source(id, 0), 0, 6) != 0) errors++;
+      reads++;
+    }
+  };
+  vector<std::thread> readers;
+  for (int i = 0; i < 4; i++) readers.emplace_back(reader, i + 1);
+
+  // overwrite for several reuse delays, so space is reused under the readers
+  int run_ms = 500;
+  double start = utils::getmillisecs();
+  int round = 1;
+  while (utils::getmillisecs() - start < run_ms) {
+    for (int i = 0; i < max_num; i++) {
+      string source = make_source(i, round);
+      ASSERT_EQ(0, store->Set(i, source.c_str(), source.size()));
+    }
+    round++;
+  }
+  stop = true;
+  for (std::thread &t : readers) t.join();
+  ASSERT_EQ(0, errors);
+  ASSERT_LT(0, reads);
+  for (int i = 0; i < max_num; i++) {
+    char *str = nullptr;
+    int len = 0;
+    ASSERT_EQ(0, store->Get(i, str, len));
+    ASSERT_EQ(make_source(i, round - 1), string(str, len));
+  }
+  delete store;
+}
+
+TEST(VIDMgr, CSR) {
+  VIDMgr vid_mgr(true);
+  long mem_bytes = 0;
+  ASSERT_EQ(0, vid_mgr.Init(100, mem_bytes));
+  // doc 0 has 3 vectors, doc 1 and 3 none, doc 2 one, doc 4 two
+  ASSERT_EQ(0, vid_mgr.Add(0, 0));
+  ASSERT_EQ(0, vid_mgr.Add(1, 0));
+  ASSERT_EQ(0, vid_mgr.Add(2, 0));
+  ASSERT_EQ(0, vid_mgr.Add(3, 2));
+  ASSERT_EQ(0, vid_mgr.Add(4, 4));
+  ASSERT_EQ(0, vid_mgr.Add(5, 4));
+
+  int expect_start[] = {0, 3, 3, 4, 4};
+  int expect_num[] = {3, 0, 1, 0, 2};
+  for (int docid = 0; docid < 5; docid++) {
+    int start = -1;
+    ASSERT_EQ(expect_num[docid], vid_mgr.GetVIDRange(docid, start));
+    ASSERT_EQ(expect_start[docid], start) << "docid=" << docid;
+    vector<int> vids;
+    vid_mgr.DocID2VID(docid, vids);
+    ASSERT_EQ((size_t)expect_num[docid], vids.size());
+    for (int i = 0; i < expect_num[docid]; i++) {
+      ASSERT_EQ(expect_start[docid] + i, vids[i]);
+      ASSERT_EQ(docid, vid_mgr.VID2DocID(vids[i]));
+    }
+  }
+  ASSERT_EQ(0, vid_mgr.GetFirstVID(0));
+  ASSERT_EQ(2, vid_mgr.GetLastVID(0));
+  ASSERT_EQ(-1, vid_mgr.GetFirstVID(1));
+  ASSERT_EQ(-1, vid_mgr.GetLastVID(3));
+  ASSERT_EQ(5, vid_mgr.GetLastVID(4));
+
+  // docs after the last one have no vector
+  int start = 0;
+  ASSERT_EQ(0, vid_mgr.GetVIDRange(5, start));
+  ASSERT_EQ(-1, start);
+  ASSERT_EQ(-1, vid_mgr.GetFirstVID(-1));
+
+  // vector ids must be continuous and doc ids must not decrease
+  ASSERT_NE(0, vid_mgr.Add(7, 5));
+  ASSERT_NE(0, vid_mgr.Add(6, 3));
+  ASSERT_NE(0, vid_mgr.Add(6, 100));
+  ASSERT_EQ(0, vid_mgr.Add(6, 5));
+  ASSERT_EQ(1, vid_mgr.GetVIDRange(5, start));
+  ASSERT_EQ(6, start);
+
+  // one vector per doc is identity
+  VIDMgr single(false);
+  ASSERT_EQ(0, single.Init(100, mem_bytes));
+  ASSERT_EQ(0, single.Add(7, 7));
+  ASSERT_EQ(7, single.VID2DocID(7));
+  ASSERT_EQ(1, single.GetVIDRange(7, start));
+  ASSERT_EQ(7, start);
+}
+
 int added_num = 0;
 void AddFunc(VectorBufferQueue<float> *qu, int check_num, int dim) {
   cerr << "****AddFunc: check num=" << check_num << ", dimension=" << dim
@@ -733,6 +1477,97 @@ void TestVectorBufferQueueTwoThreads() {
   delete queue;
 }
 
+TEST(MemoryPolicy, Parse) {
+  utils::MemoryPolicy policy;
+  ASSERT_EQ(utils::HUGEPAGE_NONE, policy.hugepage);
+  ASSERT_EQ(utils::NUMA_NONE, policy.numa);
+
+  ASSERT_EQ(0, policy.Parse("{\"hugepage\":\"thp\",\"numa\":\"interleave\"}"));
+  ASSERT_EQ(utils::HUGEPAGE_THP, policy.hugepage);
+  ASSERT_EQ(utils::NUMA_INTERLEAVE, policy.numa);
+  ASSERT_EQ("hugepage=thp, numa=interleave", policy.ToString());
+
+  // names are case insensitive and a missing key is kept
+  ASSERT_EQ(0, policy.Parse("{\"hugepage\":\"HugeTLB\"}"));
+  ASSERT_EQ(utils::HUGEPAGE_HUGETLB, policy.hugepage);
+  ASSERT_EQ(utils::NUMA_INTERLEAVE, policy.numa);
+  ASSERT_EQ(0, policy.Parse("{\"numa\":\"local\"}"));
+  ASSERT_EQ(utils::HUGEPAGE_HUGETLB, policy.hugepage);
+  ASSERT_EQ(utils::NUMA_LOCAL, policy.numa);
+  ASSERT_EQ(0, policy.Parse("{\"hugepage\":\"none\",\"numa\":\"none\"}"));
+  ASSERT_EQ("hugepage=none, numa=none", policy.ToString());
+
+  ASSERT_NE(0, policy.Parse("{\"hugepage\":\"1g\"}"));
+  ASSERT_NE(0, policy.Parse("{\"numa\":\"preferred\"}"));
+  ASSERT_NE(0, policy.Parse("hugepage=thp"));
+}
+
+TEST(MemoryPolicy, AllocLarge) {
+  utils::MemoryPolicy old_policy = utils::GetMemoryPolicy();
+  utils::MemoryPolicy policy;
+  ASSERT_EQ(0, policy.Parse("{\"hugepage\":\"thp\",\"numa\":\"local\"}"));
+  ASSERT_EQ(0, utils::SetMemoryPolicy(policy));
+  ASSERT_EQ(utils::HUGEPAGE_THP, utils::GetMemoryPolicy().hugepage);
+
+  // small arenas come from calloc
+  size_t small_size = 4096;
+  char *small = (char *)utils::AllocLarge(small_size, "small");
+  ASSERT_NE(nullptr, small);
+  for (size_t i = 0; i < small_size; i++) ASSERT_EQ(0, small[i]);
+  utils::FreeLarge(small, small_size);
+
+  size_t size = 3 * utils::kLargeArenaBytes + 100;
+  char *arena = (char *)utils::AllocLarge(size, "large");
+  ASSERT_NE(nullptr, arena);
+  // mapped at a huge page boundary and zero filled
+  ASSERT_EQ(0, (size_t)arena % utils::kLargeArenaBytes);
+  for (size_t i = 0; i < size; i += 4096) ASSERT_EQ(0, arena[i]);
+  ASSERT_EQ(0, arena[size - 1]);
+  memset(arena, 1, size);
+  utils::FreeLarge(arena, size);
+
+  string report = utils::MemoryPolicyReport();
+  LOG(INFO) << report;
+  ASSERT_EQ(0, report.find("hugepage=thp, numa=local"));
+  ASSERT_NE(string::npos, report.find("thp arenas="));
+
+  utils::SetMemoryPolicy(old_policy);
+}
+
+TEST(VectorCache, Clock) {
+  int dimension = 4;
+  int capacity = VectorCache<float>::kShardNum * 2;
+  VectorCache<float> cache(dimension, capacity * dimension * sizeof(float));
+  ASSERT_EQ(0, cache.Init());
+  ASSERT_EQ(capacity, cache.GetCapacity());
+
+  float v[4], out[4];
+  for (int i = 0; i < capacity; i++) {
+    for (int j = 0; j < dimension; j++) v[j] = i;
+    cache.Put(i, v);
+  }
+  for (int i = 0; i < capacity; i++) {
+    ASSERT_TRUE(cache.Get(i, out));
+    ASSERT_EQ(i, out[0]);
+  }
+  // vid 0 is hot, the others are read only once
+  for (int i = 0; i < 3; i++) cache.Get(0, out);
+  for (int i = capacity; i < capacity * 2; i++) {
+    for (int j = 0; j < dimension; j++) v[j] = i;
+    cache.Put(i, v);
+  }
+  ASSERT_TRUE(cache.Get(0, out));
+  ASSERT_EQ(0, out[0]);
+  ASSERT_LT(0, cache.GetEvictions());
+
+  for (int j = 0; j < dimension; j++) v[j] = -1;
+  cache.Update(0, v);
+  ASSERT_TRUE(cache.Get(0, out));
+  ASSERT_EQ(-1, out[0]);
+  ASSERT_FALSE(cache.Get(capacity * 10, out));
+  ASSERT_LT(0, cache.GetMisses());
+}
+
 #ifdef WITH_ROCKSDB
 
 TEST(RocksDBRawVector, Normal) {
@@ -156,4 +156,60 @@ TEST_F(RealTimeMemDataTest, ExtendBucket) {
   ASSERT_EQ(num - 1, GetVid(bucket_no, num - 1));
   ASSERT_EQ(num - 1, GetCode(bucket_no, num - 1)[0]);
 }
+TEST_F(RealTimeMemDataTest, RecountDeleted) {
+  int num = 50;
+  std::vector<long> keys;
+  std::vector<uint8_t> codes;
+  CreateData(num, keys, codes, code_byte_size);
+  // deleted before it is added, counted by AddKeys
+  bitmap::set(docids_bitmap, 10);
+  ASSERT_TRUE(realtime_data->AddKeys(0, num, keys, codes));
+  ASSERT_EQ(1, GetDeletedNum(0));
+
+  // the old position of an updated vector is masked and counted
+  std::vector<uint8_t> code(code_byte_size, 0);
+  realtime_data->Update(1, 30, code);
+  ASSERT_EQ(2, GetDeletedNum(0));
+  ASSERT_EQ(0, GetDeletedNum(1));
+
+  // the delete of vid 10 counted twice
+  int vids[] = {10, 20};
+  realtime_data->Delete(vids, 1);
+  ASSERT_EQ(3, GetDeletedNum(0));
+  realtime_data->RecountDeleted(vids, 1);
+  ASSERT_EQ(2, GetDeletedNum(0));
+
+  // vid 20 deleted but never counted
+  bitmap::set(docids_bitmap, 20);
+  realtime_data->RecountDeleted(vids, 2);
+  ASSERT_EQ(3, GetDeletedNum(0));
+  ASSERT_EQ(0, GetDeletedNum(1));
+
+  bitmap::set(docids_bitmap, 30);
+  int updated_vid = 30;
+  realtime_data->RecountDeleted(&updated_vid, 1);
+  ASSERT_EQ(1, GetDeletedNum(1));
+  ASSERT_EQ(3, GetDeletedNum(0));
+}
+TEST_F(RealTimeMemDataTest, CodeVersion) {
+  int num = 50;
+  std::vector<long> keys;
+  std::vector<uint8_t> codes;
+  CreateData(num, keys, codes, code_byte_size);
+  ASSERT_TRUE(realtime_data->AddKeys(0, num, keys, codes));
+  // appended codes keep the version, packed blocks are only extended
+  ASSERT_EQ(0, realtime_data->GetCodeVersion(0));
+
+  std::vector<uint8_t> code(code_byte_size, 1);
+  realtime_data->Update(0, 5, code);
+  ASSERT_EQ(1, realtime_data->GetCodeVersion(0));
+  // moved to another bucket, the old code is only masked
+  realtime_data->Update(1, 6, code);
+  ASSERT_EQ(1, realtime_data->GetCodeVersion(0));
+  ASSERT_EQ(0, realtime_data->GetCodeVersion(1));
+
+  ASSERT_TRUE(realtime_data->CompactBucket(0));
+  ASSERT_EQ(2, realtime_data->GetCodeVersion(0));
+  ASSERT_EQ(0, realtime_data->GetCodeVersion(1));
+}
 }  // namespace Test
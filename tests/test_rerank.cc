@@ -0,0 +1,126 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <vector>
+#include "rerank.h"
+
+using namespace std;
+
+namespace {
+
+// exact distances in double and the order of a full sort, ties broken by id.
+// mag is the sum of the absolute terms, which bounds the rounding error
+void BruteForce(bool inner_product, const vector<float> &x,
+                const vector<vector<float>> &ys, vector<double> &dis,
+                vector<double> &mag, vector<int> &order) {
+  dis.resize(ys.size());
+  mag.resize(ys.size());
+  for (size_t j = 0; j < ys.size(); j++) {
+    double s = 0, m = 0;
+    for (size_t i = 0; i < x.size(); i++) {
+      double t = inner_product ? (double)x[i] * ys[j][i] : x[i] - ys[j][i];
+      s += inner_product ? t : t * t;
+      m += inner_product ? fabs(t) : t * t;
+    }
+    dis[j] = s;
+    mag[j] = m;
+  }
+  order.resize(ys.size());
+  for (size_t j = 0; j < ys.size(); j++) order[j] = j;
+  sort(order.begin(), order.end(), [&](int a, int b) {
+    if (dis[a] != dis[b])
+      return inner_product ? dis[a] > dis[b] : dis[a] < dis[b];
+    return a < b;
+  });
+}
+
+// vectors are offset + N(0, scale), a large offset and a small scale are
+// a tight cluster far from the origin, where |x|^2 + |y|^2 - 2 <x, y> loses
+// the distance to cancellation
+void CheckRerank(bool inner_product, int d, int n, int k, float offset = 0,
+                 float scale = 1) {
+  mt19937 rng(d * 1000 + n);
+  normal_distribution<float> normal(0, scale);
+  vector<float> x(d);
+  for (float &v : x) v = offset + normal(rng);
+  // vectors are read in place from separate buffers, as from the raw vector
+  vector<vector<float>> ys(n, vector<float>(d));
+  for (auto &y : ys) {
+    for (float &v : y) v = offset + normal(rng);
+  }
+  if (n > 9) {
+    ys[3] = x;  // the nearest one by L2
+    ys[9] = x;  // a tie of 3, it follows by id
+  }
+  vector<const float *> ptrs(n);
+  for (int j = 0; j < n; j++) ptrs[j] = ys[j].data();
+
+  vector<float> dis(n);
+  rerank::compute_distances(inner_product, x.data(), d, n, ptrs.data(),
+                            dis.data());
+  vector<double> ref_dis, mag;
+  vector<int> order;
+  BruteForce(inner_product, x, ys, ref_dis, mag, order);
+  for (int j = 0; j < n; j++) {
+    ASSERT_NEAR(ref_dis[j], dis[j], 1e-5 * mag[j])
+        << "j=" << j;
+  }
+
+  vector<int64_t> ids(n);
+  for (int j = 0; j < n; j++) ids[j] = j;
+  vector<float> simi(k, -1);
+  vector<int64_t> idxi(k, -1);
+  rerank::select(inner_product, n, dis.data(), ids.data(), k, simi.data(),
+                 idxi.data());
+  int num = min(n, k);
+  for (int j = 0; j < num; j++) {
+    ASSERT_EQ(order[j], idxi[j]) << "j=" << j;
+    ASSERT_EQ(dis[order[j]], simi[j]);
+  }
+  for (int j = num; j < k; j++) {
+    ASSERT_EQ(-1, idxi[j]);
+    ASSERT_EQ(-1, simi[j]);
+  }
+}
+
+}  // namespace
+
+TEST(Rerank, L2) {
+  for (int d : {8, 100, 512}) {
+    CheckRerank(false, d, 1000, 10);
+    CheckRerank(false, d, 1000, 100);
+    CheckRerank(false, d, 5, 10);
+    CheckRerank(false, d, 1000, 10, 10, 0.01);
+  }
+}
+
+TEST(Rerank, InnerProduct) {
+  for (int d : {8, 100, 512}) {
+    CheckRerank(true, d, 1000, 10);
+    CheckRerank(true, d, 1000, 100);
+    CheckRerank(true, d, 5, 10);
+  }
+}
+
+TEST(Rerank, SelectTies) {
+  float dis[] = {0.5, 0.1, 0.5, 0.1, 0.3};
+  int64_t ids[] = {40, 30, 20, 10, 0};
+  float simi[4];
+  int64_t idxi[4];
+  rerank::select(false, 5, dis, ids, 4, simi, idxi);
+  int64_t expect_l2[] = {10, 30, 0, 20};
+  for (int j = 0; j < 4; j++) ASSERT_EQ(expect_l2[j], idxi[j]);
+  rerank::select(true, 5, dis, ids, 4, simi, idxi);
+  int64_t expect_ip[] = {20, 40, 0, 10};
+  for (int j = 0; j < 4; j++) ASSERT_EQ(expect_ip[j], idxi[j]);
+  ASSERT_EQ(0.5f, simi[0]);
+  ASSERT_EQ(0.1f, simi[3]);
+}
@@ -0,0 +1,30 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <float.h>
+#include <string>
+#include "utils.h"
+
+using namespace std;
+
+TEST(Utils, AppendNumber) {
+  string str;
+  utils::append(str, 1.5f, ',');
+  utils::append(str, -3, ',');
+  utils::append(str, (uint8_t)255, ',');
+  ASSERT_EQ("1.500000,-3,255,", str);
+
+  // wider than any fixed small buffer, the text is not cut
+  for (float value : {FLT_MAX, -FLT_MAX}) {
+    str = "x";
+    utils::append(str, value, ',');
+    string expect = "x" + to_string(value) + ",";
+    ASSERT_EQ(expect, str);
+    ASSERT_EQ(value > 0 ? 48u : 49u, str.size());
+  }
+}
@@ -0,0 +1,187 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "float16.h"
+#include <string.h>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace float16 {
+
+namespace {
+
+inline uint16_t EncodeOne(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t abs = x & 0x7fffffff;
+
+  if (abs >= 0x7f800000) {  // inf or nan
+    return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+  }
+  if (abs >= 0x477ff000) {  // rounds to inf
+    return sign | 0x7c00;
+  }
+  if (abs < 0x38800000) {  // zero or subnormal half
+    float fa;
+    memcpy(&fa, &abs, sizeof(fa));
+    fa += 0.5f;  // align the half subnormal lsb to the float lsb
+    uint32_t r;
+    memcpy(&r, &fa, sizeof(r));
+    return sign | (r - 0x3f000000);
+  }
+  // rebias exponent and round to nearest even
+  uint32_t mant_odd = (abs >> 13) & 1;
+  abs += 0xc8000fff + mant_odd;
+  return sign | (abs >> 13);
+}
+
+inline float DecodeOne(uint16_t h) {
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exp = (h >> 10) & 0x1f;
+  uint32_t mant = h & 0x3ff;
+  uint32_t x;
+  if (exp == 0) {
+    float f = (float)mant * (1.0f / 16777216.0f);  // mant * 2^-24
+    memcpy(&x, &f, sizeof(x));
+    x |= sign;
+  } else if (exp == 31) {
+    x = sign | 0x7f800000 | (mant << 13);
+  } else {
+    x = sign | ((exp + 112) << 23) | (mant << 13);
+  }
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+#ifdef __F16C__
+inline float HorizontalSum(__m256 v) {
+  __m128 lo = _mm256_castps256_ps128(v);
+  __m128 hi = _mm256_extractf128_ps(v, 1);
+  lo = _mm_add_ps(lo, hi);
+  lo = _mm_hadd_ps(lo, lo);
+  lo = _mm_hadd_ps(lo, lo);
+  return _mm_cvtss_f32(lo);
+}
+
+inline __m256 LoadHalf(const uint16_t *p) {
+  return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)p));
+}
+#endif
+
+}  // namespace
+
+void encode(const float *x, uint16_t *y, size_t n) {
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8) {
+    __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i *)(y + i), h);
+  }
+#endif
+  for (; i < n; i++) y[i] = EncodeOne(x[i]);
+}
+
+void decode(const uint16_t *x, float *y, size_t n) {
+  size_t i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, LoadHalf(x + i));
+  }
+#endif
+  for (; i < n; i++) y[i] = DecodeOne(x[i]);
+}
+
+float L2sqr(const float *x, const uint16_t *y, size_t d) {
+  size_t i = 0;
+  float res = 0;
+#ifdef __F16C__
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (; i + 16 <= d; i += 16) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + i), LoadHalf(y + i));
+    __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(x + i + 8), LoadHalf(y + i + 8));
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+    acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(d1, d1));
+  }
+  if (i + 8 <= d) {
+    __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(x + i), LoadHalf(y + i));
+    acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(d0, d0));
+    i += 8;
+  }
+  res = HorizontalSum(_mm256_add_ps(acc0, acc1));
+#endif
+  for (; i < d; i++) {
+    float diff = x[i] - DecodeOne(y[i]);
+    res += diff * diff;
+  }
+  return res;
+}
+
+float inner_product(const float *x, const uint16_t *y, size_t d) {
+  size_t i = 0;
+  float res = 0;
+#ifdef __F16C__
+  __m256 acc0 = _mm256_setzero_ps();
+  __m256 acc1 = _mm256_setzero_ps();
+  for (; i + 16 <= d; i += 16) {
+    acc0 = _mm256_add_ps(
+        acc0, _mm256_mul_ps(_mm256_loadu_ps(x + i), LoadHalf(y + i)));
+    acc1 = _mm256_add_ps(
+        acc1, _mm256_mul_ps(_mm256_loadu_ps(x + i + 8), LoadHalf(y + i + 8)));
+  }
+  if (i + 8 <= d) {
+    acc0 = _mm256_add_ps(
+        acc0, _mm256_mul_ps(_mm256_loadu_ps(x + i), LoadHalf(y + i)));
+    i += 8;
+  }
+  res = HorizontalSum(_mm256_add_ps(acc0, acc1));
+#endif
+  for (; i < d; i++) {
+    res += x[i] * DecodeOne(y[i]);
+  }
+  return res;
+}
+
+float L2sqr(const uint16_t *x, const uint16_t *y, size_t d) {
+  size_t i = 0;
+  float res = 0;
+#ifdef __F16C__
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= d; i += 8) {
+    __m256 diff = _mm256_sub_ps(LoadHalf(x + i), LoadHalf(y + i));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(diff, diff));
+  }
+  res = HorizontalSum(acc);
+#endif
+  for (; i < d; i++) {
+    float diff = DecodeOne(x[i]) - DecodeOne(y[i]);
+    res += diff * diff;
+  }
+  return res;
+}
+
+float inner_product(const uint16_t *x, const uint16_t *y, size_t d) {
+  size_t i = 0;
+  float res = 0;
+#ifdef __F16C__
+  __m256 acc = _mm256_setzero_ps();
+  for (; i + 8 <= d; i += 8) {
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(LoadHalf(x + i), LoadHalf(y + i)));
+  }
+  res = HorizontalSum(acc);
+#endif
+  for (; i < d; i++) {
+    res += DecodeOne(x[i]) * DecodeOne(y[i]);
+  }
+  return res;
+}
+
+}  // namespace float16
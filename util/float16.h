@@ -0,0 +1,38 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef FLOAT16_H_
+#define FLOAT16_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* IEEE 754 half precision vectors, it uses F16C and AVX2 if they are
+ * enabled at compile time, otherwise falls back to scalar conversion */
+namespace float16 {
+
+/* convert n floats to half precision, rounding to nearest even */
+void encode(const float *x, uint16_t *y, size_t n);
+
+/* convert n half precision values to floats */
+void decode(const uint16_t *x, float *y, size_t n);
+
+/* squared L2 distance between a float query and a half vector */
+float L2sqr(const float *x, const uint16_t *y, size_t d);
+
+/* inner product between a float query and a half vector */
+float inner_product(const float *x, const uint16_t *y, size_t d);
+
+/* squared L2 distance between two half vectors */
+float L2sqr(const uint16_t *x, const uint16_t *y, size_t d);
+
+/* inner product between two half vectors */
+float inner_product(const uint16_t *x, const uint16_t *y, size_t d);
+
+}  // namespace float16
+
+#endif
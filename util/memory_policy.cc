@@ -0,0 +1,253 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "memory_policy.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+#include "log.h"
+#include "utils.h"
+
+namespace utils {
+
+namespace {
+
+// from linux/mempolicy.h, libnuma is not required
+const int kMpolInterleave = 3;
+const int kMpolLocal = 4;
+const unsigned kMpolMfMove = 1 << 1;
+const int kMaxNumaNodes = 1024;
+
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+MemoryPolicy g_policy;
+
+std::atomic<long> g_hugetlb_arenas(0);
+std::atomic<long> g_hugetlb_fallbacks(0);
+std::atomic<long> g_thp_arenas(0);
+std::atomic<long> g_numa_bound(0);
+std::atomic<long> g_numa_failed(0);
+
+inline size_t RoundUp(size_t v, size_t align) {
+  return (v + align - 1) / align * align;
+}
+
+struct NumaNodes {
+  unsigned long mask[kMaxNumaNodes / (8 * sizeof(unsigned long))];
+  int num;
+
+  NumaNodes() : num(0) {
+    memset(mask, 0, sizeof(mask));
+    std::ifstream ifs("/sys/devices/system/node/online");
+    std::string line;
+    if (!ifs.is_open() || !std::getline(ifs, line)) return;
+    // the format is like "0-1,3"
+    for (const std::string &range : split(line, ",")) {
+      int first = -1, last = -1;
+      if (sscanf(range.c_str(), "%d-%d", &first, &last) == 1) last = first;
+      for (int node = first; node >= 0 && node <= last && node < kMaxNumaNodes;
+           node++) {
+        mask[node / (8 * sizeof(unsigned long))] |=
+            1UL << (node % (8 * sizeof(unsigned long)));
+        num++;
+      }
+    }
+  }
+};
+
+const NumaNodes &GetNumaNodes() {
+  static NumaNodes nodes;
+  return nodes;
+}
+
+std::string GetTHPMode() {
+  std::ifstream ifs("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string line;
+  if (!ifs.is_open() || !std::getline(ifs, line)) return "unknown";
+  size_t begin = line.find('[');
+  size_t end = line.find(']');
+  if (begin == std::string::npos || end == std::string::npos || end < begin)
+    return "unknown";
+  return line.substr(begin + 1, end - begin - 1);
+}
+
+void Bind(void *ptr, size_t len, unsigned flags) {
+  const NumaNodes &nodes = GetNumaNodes();
+  long ret = 0;
+  if (g_policy.numa == NUMA_INTERLEAVE) {
+    if (nodes.num <= 1) return;
+    ret = syscall(SYS_mbind, ptr, len, kMpolInterleave, nodes.mask,
+                  kMaxNumaNodes + 1, flags);
+  } else if (g_policy.numa == NUMA_LOCAL) {
+    ret = syscall(SYS_mbind, ptr, len, kMpolLocal, nullptr, 0, flags);
+  } else {
+    return;
+  }
+  if (ret != 0) {
+    g_numa_failed++;
+    LOG(WARNING) << "mbind error, len=" << len << ", error:" << strerror(errno);
+  } else {
+    g_numa_bound++;
+  }
+}
+
+void *MapAligned(size_t len) {
+  // over map then trim, transparent huge pages need 2MB aligned ranges
+  size_t map_len = len + kHugePageSize;
+  void *buf = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (buf == MAP_FAILED) return nullptr;
+  char *raw = (char *)buf;
+  char *aligned = (char *)RoundUp((size_t)raw, kHugePageSize);
+  if (aligned > raw) munmap(raw, aligned - raw);
+  size_t tail = raw + map_len - (aligned + len);
+  if (tail > 0) munmap(aligned + len, tail);
+  return aligned;
+}
+
+}  // namespace
+
+int MemoryPolicy::Parse(const char *str) {
+  JsonParser jp;
+  if (jp.Parse(str)) {
+    LOG(ERROR) << "parse memory policy error: " << str;
+    return -1;
+  }
+  std::string value;
+  if (!jp.GetString("hugepage", value)) {
+    if (!strcasecmp(value.c_str(), "none")) {
+      hugepage = HUGEPAGE_NONE;
+    } else if (!strcasecmp(value.c_str(), "thp")) {
+      hugepage = HUGEPAGE_THP;
+    } else if (!strcasecmp(value.c_str(), "hugetlb")) {
+      hugepage = HUGEPAGE_HUGETLB;
+    } else {
+      LOG(ERROR) << "invalid hugepage=" << value;
+      return -1;
+    }
+  }
+  if (!jp.GetString("numa", value)) {
+    if (!strcasecmp(value.c_str(), "none")) {
+      numa = NUMA_NONE;
+    } else if (!strcasecmp(value.c_str(), "interleave")) {
+      numa = NUMA_INTERLEAVE;
+    } else if (!strcasecmp(value.c_str(), "local")) {
+      numa = NUMA_LOCAL;
+    } else {
+      LOG(ERROR) << "invalid numa=" << value;
+      return -1;
+    }
+  }
+  return 0;
+}
+
+std::string MemoryPolicy::ToString() const {
+  static const char *hugepage_names[] = {"none", "thp", "hugetlb"};
+  static const char *numa_names[] = {"none", "interleave", "local"};
+  std::stringstream ss;
+  ss << "hugepage=" << hugepage_names[hugepage]
+     << ", numa=" << numa_names[numa];
+  return ss.str();
+}
+
+int SetMemoryPolicy(const MemoryPolicy &policy) {
+  g_policy = policy;
+  LOG(INFO) << "set memory policy, " << policy.ToString();
+  return 0;
+}
+
+const MemoryPolicy &GetMemoryPolicy() { return g_policy; }
+
+std::string MemoryPolicyReport() {
+  std::stringstream ss;
+  ss << g_policy.ToString() << ", thp enabled=" << GetTHPMode()
+     << ", numa nodes=" << GetNumaNodes().num
+     << ", hugetlb arenas=" << g_hugetlb_arenas
+     << ", hugetlb fallbacks=" << g_hugetlb_fallbacks
+     << ", thp arenas=" << g_thp_arenas << ", numa bound=" << g_numa_bound
+     << ", numa failed=" << g_numa_failed;
+  if (g_policy.numa == NUMA_INTERLEAVE && GetNumaNodes().num <= 1) {
+    ss << " (single node, interleave has no effect)";
+  }
+  return ss.str();
+}
+
+void *AllocLarge(size_t size, const char *name) {
+  if (size < kLargeArenaBytes) {
+    return calloc(1, size > 0 ? size : 1);
+  }
+  size_t len = RoundUp(size, kHugePageSize);
+  void *ptr = nullptr;
+  bool thp = g_policy.hugepage == HUGEPAGE_THP;
+  if (g_policy.hugepage == HUGEPAGE_HUGETLB) {
+    void *buf = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (buf != MAP_FAILED) {
+      ptr = buf;
+      g_hugetlb_arenas++;
+    } else {
+      LOG(WARNING) << "map hugetlb arena [" << name << "] error, size=" << len
+                   << ", error:" << strerror(errno) << ", fall back to thp";
+      g_hugetlb_fallbacks++;
+      thp = true;
+    }
+  }
+  if (ptr == nullptr) {
+    ptr = MapAligned(len);
+    if (ptr == nullptr) {
+      LOG(ERROR) << "map arena [" << name << "] error, size=" << len
+                 << ", error:" << strerror(errno);
+      return nullptr;
+    }
+    if (thp) {
+      if (madvise(ptr, len, MADV_HUGEPAGE) == 0) {
+        g_thp_arenas++;
+      } else {
+        LOG(WARNING) << "madvise hugepage [" << name
+                     << "] error:" << strerror(errno);
+      }
+    }
+  }
+  // nothing is touched yet, so no page has to be moved
+  Bind(ptr, len, 0);
+  LOG(INFO) << "alloc arena [" << name << "] size=" << len << ", "
+            << g_policy.ToString();
+  return ptr;
+}
+
+void FreeLarge(void *ptr, size_t size) {
+  if (ptr == nullptr) return;
+  if (size < kLargeArenaBytes) {
+    free(ptr);
+    return;
+  }
+  munmap(ptr, RoundUp(size, kHugePageSize));
+}
+
+void AdviseLarge(void *ptr, size_t size) {
+  if (ptr == nullptr || size < kLargeArenaBytes) return;
+  if (g_policy.hugepage == HUGEPAGE_NONE && g_policy.numa == NUMA_NONE) return;
+  size_t begin = RoundUp((size_t)ptr, kHugePageSize);
+  size_t end = ((size_t)ptr + size) / kHugePageSize * kHugePageSize;
+  if (end <= begin) return;
+  if (g_policy.hugepage != HUGEPAGE_NONE) {
+    // heap memory can not be remapped from the hugetlb pool
+    if (madvise((void *)begin, end - begin, MADV_HUGEPAGE) == 0) {
+      g_thp_arenas++;
+    }
+  }
+  Bind((void *)begin, end - begin, kMpolMfMove);
+}
+
+}  // namespace utils
@@ -0,0 +1,71 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef MEMORY_POLICY_H_
+#define MEMORY_POLICY_H_
+
+#include <stddef.h>
+#include <string>
+
+namespace utils {
+
+enum HugePageMode { HUGEPAGE_NONE = 0, HUGEPAGE_THP, HUGEPAGE_HUGETLB };
+
+enum NumaMode { NUMA_NONE = 0, NUMA_INTERLEAVE, NUMA_LOCAL };
+
+/** allocation policy of the large arenas (profile memory, vector buffers,
+ * docids bitmap and the realtime index arrays), it is process wide.
+ * hugepage: "none", "thp" (madvise MADV_HUGEPAGE) or "hugetlb" (MAP_HUGETLB
+ *           from the reserved pool, falls back to thp if the pool is empty)
+ * numa:     "none" (first touch), "interleave" (all online nodes) or
+ *           "local" (the node of the touching thread)
+ */
+struct MemoryPolicy {
+  HugePageMode hugepage;
+  NumaMode numa;
+
+  MemoryPolicy() : hugepage(HUGEPAGE_NONE), numa(NUMA_NONE) {}
+
+  /** parse the policy from json, eg. {"hugepage":"thp","numa":"interleave"}
+   *
+   * @return 0 if successed
+   */
+  int Parse(const char *str);
+
+  std::string ToString() const;
+};
+
+int SetMemoryPolicy(const MemoryPolicy &policy);
+
+const MemoryPolicy &GetMemoryPolicy();
+
+/** report of the requested policy and what the kernel actually gave */
+std::string MemoryPolicyReport();
+
+/** allocate a zero filled arena according to the memory policy, arenas
+ * smaller than kLargeArenaBytes come from calloc.
+ *
+ * @param size  bytes of the arena
+ * @param name  used in logs
+ * @return arena pointer, nullptr if failed
+ */
+void *AllocLarge(size_t size, const char *name);
+
+/** free an arena from AllocLarge, size must be the allocated size */
+void FreeLarge(void *ptr, size_t size);
+
+/** apply the memory policy to an existing heap buffer, only the 2MB
+ * aligned part inside the buffer is advised and pages which have been
+ * touched are migrated according to the numa mode.
+ */
+void AdviseLarge(void *ptr, size_t size);
+
+static const size_t kLargeArenaBytes = 2 * 1024 * 1024;
+
+}  // namespace utils
+
+#endif  // MEMORY_POLICY_H_
@@ -0,0 +1,193 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "pq4_fast_scan.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace pq4 {
+
+namespace {
+
+// the largest sum must fit a signed 16-bit lane
+inline int MaxEntry(size_t M) {
+  return std::min(255, (int)(32766 / (M > 0 ? M : 1)));
+}
+
+// float sums of the exact distances may differ from the bounds in the last
+// bits, it is relative to the magnitude of the distances
+inline double Tolerance(float top, double bias) {
+  return 1e-5 * (fabs((double)top) + fabs(bias));
+}
+
+}  // namespace
+
+void quantize_lut(size_t M, const float *tab, uint8_t *lut, float *bias,
+                  float *scale) {
+  std::vector<float> mins(M);
+  float range = 0;
+  double sum = 0;
+  for (size_t m = 0; m < M; m++) {
+    const float *t = tab + m * kSubCentroids;
+    float min = t[0], max = t[0];
+    for (int i = 1; i < kSubCentroids; i++) {
+      min = std::min(min, t[i]);
+      max = std::max(max, t[i]);
+    }
+    mins[m] = min;
+    range = std::max(range, max - min);
+    sum += min;
+  }
+  int max_entry = MaxEntry(M);
+  float s = range > 0 ? max_entry / range : 1;
+  for (size_t m = 0; m < M; m++) {
+    const float *t = tab + m * kSubCentroids;
+    uint8_t *l = lut + m * kSubCentroids;
+    for (int i = 0; i < kSubCentroids; i++) {
+      // floor keeps acc / scale a lower bound
+      int q = (int)floorf((t[i] - mins[m]) * s);
+      l[i] = (uint8_t)std::max(0, std::min(max_entry, q));
+    }
+  }
+  *bias = (float)sum;
+  *scale = s;
+}
+
+void pack_block(const uint8_t *const *codes, size_t code_size, size_t n,
+                uint8_t *block) {
+  if (n < (size_t)kBlockSize) memset(block, 0, code_size * kBlockSize);
+  for (size_t v = 0; v < n; v++) {
+    const uint8_t *code = codes[v];
+    uint8_t *b = block + v;
+    for (size_t i = 0; i < code_size; i++) {
+      b[i * kBlockSize] = code[i];
+    }
+  }
+}
+
+BlockCache::BlockCache(size_t nlist, size_t code_size)
+    : code_size_(code_size), lists_(nlist), mem_bytes_(0) {}
+
+std::shared_ptr<const PackedList> BlockCache::get(size_t list_no,
+                                                  const uint8_t *codes,
+                                                  size_t n, long version) {
+  std::shared_ptr<const PackedList> cur = std::atomic_load(&lists_[list_no]);
+  bool same = cur && cur->codes == codes && cur->version == version;
+  if (same && cur->n >= n) return cur;
+
+  std::shared_ptr<PackedList> list = std::make_shared<PackedList>();
+  list->codes = codes;
+  list->version = version;
+  list->n = n;
+  size_t block_bytes = code_size_ * kBlockSize;
+  list->blocks.resize((n + kBlockSize - 1) / kBlockSize * block_bytes);
+  // only the codes appended since are packed, the last block may be partial
+  size_t b0 = same ? cur->n / kBlockSize : 0;
+  if (b0 > 0) memcpy(list->blocks.data(), cur->blocks.data(), b0 * block_bytes);
+  const uint8_t *rows[kBlockSize];
+  for (size_t j0 = b0 * kBlockSize; j0 < n; j0 += kBlockSize) {
+    size_t nb = std::min(n - j0, (size_t)kBlockSize);
+    for (size_t v = 0; v < nb; v++) rows[v] = codes + (j0 + v) * code_size_;
+    pack_block(rows, code_size_, nb, list->blocks.data() + j0 * code_size_);
+  }
+
+  mem_bytes_ += list->blocks.size();
+  std::shared_ptr<const PackedList> old = std::atomic_exchange(
+      &lists_[list_no], std::shared_ptr<const PackedList>(list));
+  if (old) mem_bytes_ -= old->blocks.size();
+  return list;
+}
+
+uint32_t accumulate_block_scalar(size_t M, const uint8_t *block,
+                                 const uint8_t *lut, size_t n, int threshold,
+                                 bool less, uint16_t *acc) {
+  uint32_t mask = 0;
+  uint16_t sums[kBlockSize];
+  memset(sums, 0, sizeof(sums));
+  for (size_t m = 0; m < M; m += 2) {
+    for (int v = 0; v < kBlockSize; v++) {
+      uint8_t c = block[v];
+      sums[v] += lut[c & 15] + lut[kSubCentroids + (c >> 4)];
+    }
+    block += kBlockSize;
+    lut += 2 * kSubCentroids;
+  }
+  for (int v = 0; v < kBlockSize; v++) {
+    bool selected = less ? sums[v] < threshold : sums[v] > threshold;
+    if (selected) mask |= 1u << v;
+  }
+  if (acc) memcpy(acc, sums, sizeof(sums));
+  if (n < (size_t)kBlockSize) mask &= (1u << n) - 1;
+  return mask;
+}
+
+uint32_t accumulate_block(size_t M, const uint8_t *block, const uint8_t *lut,
+                          size_t n, int threshold, bool less, uint16_t *acc) {
+#ifdef __AVX2__
+  uint32_t mask = 0;
+  const __m256i low4 = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  // lanes of acc0 are codes 0-7 and 16-23, acc1 8-15 and 24-31
+  __m256i acc0 = zero, acc1 = zero;
+  for (size_t m = 0; m < M; m += 2) {
+    __m256i c = _mm256_loadu_si256((const __m256i *)block);
+    __m256i lo = _mm256_and_si256(c, low4);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(c, 4), low4);
+    __m256i lut_lo = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)lut));
+    __m256i lut_hi = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i *)(lut + kSubCentroids)));
+    __m256i v0 = _mm256_shuffle_epi8(lut_lo, lo);
+    __m256i v1 = _mm256_shuffle_epi8(lut_hi, hi);
+    acc0 = _mm256_add_epi16(acc0, _mm256_unpacklo_epi8(v0, zero));
+    acc0 = _mm256_add_epi16(acc0, _mm256_unpacklo_epi8(v1, zero));
+    acc1 = _mm256_add_epi16(acc1, _mm256_unpackhi_epi8(v0, zero));
+    acc1 = _mm256_add_epi16(acc1, _mm256_unpackhi_epi8(v1, zero));
+    block += kBlockSize;
+    lut += 2 * kSubCentroids;
+  }
+  __m256i thr = _mm256_set1_epi16((short)threshold);
+  __m256i sel0 = less ? _mm256_cmpgt_epi16(thr, acc0)
+                      : _mm256_cmpgt_epi16(acc0, thr);
+  __m256i sel1 = less ? _mm256_cmpgt_epi16(thr, acc1)
+                      : _mm256_cmpgt_epi16(acc1, thr);
+  // packing interleaves the lanes back to code order
+  mask = (uint32_t)_mm256_movemask_epi8(_mm256_packs_epi16(sel0, sel1));
+  if (acc) {
+    _mm256_storeu_si256((__m256i *)acc,
+                        _mm256_permute2x128_si256(acc0, acc1, 0x20));
+    _mm256_storeu_si256((__m256i *)(acc + 16),
+                        _mm256_permute2x128_si256(acc0, acc1, 0x31));
+  }
+  if (n < (size_t)kBlockSize) mask &= (1u << n) - 1;
+  return mask;
+#else
+  return accumulate_block_scalar(M, block, lut, n, threshold, less, acc);
+#endif
+}
+
+int threshold_less(float top, double bias, float scale) {
+  double t = ((double)top - bias + Tolerance(top, bias)) * scale;
+  if (!(t < 32766)) return 32767;  // all lanes, also for nan
+  if (t < 0) return 0;
+  return (int)ceil(t) + 1;
+}
+
+int threshold_greater(size_t M, float top, double bias, float scale) {
+  double t = ((double)top - bias - Tolerance(top, bias)) * scale - M;
+  if (!(t > 0)) return -1;  // all lanes, also for nan
+  if (t >= 32767) return 32767;
+  return (int)floor(t) - 1;
+}
+
+}  // namespace pq4
@@ -0,0 +1,109 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef PQ4_FAST_SCAN_H_
+#define PQ4_FAST_SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/* scanning of 4-bit PQ codes, two sub-quantizer codes per byte with the
+ * first one in the low nibble. Codes are transposed in blocks of 32, so one
+ * byte position of the whole block is a register, and the distance tables
+ * quantized to 8 bits are looked up 32 codes at a time with a byte shuffle
+ * (AVX2 if it is enabled at compile time, otherwise scalar). The sums in
+ * 16-bit lanes are bounds of the float distances:
+ *   bias + acc / scale <= distance < bias + (acc + M) / scale
+ */
+namespace pq4 {
+
+static const int kBlockSize = 32;
+static const int kSubCentroids = 16;
+
+/* quantize float tables of M x 16 entries to lut, M is even.
+ * bias gets the sum of the per sub-quantizer minimums */
+void quantize_lut(size_t M, const float *tab, uint8_t *lut, float *bias,
+                  float *scale);
+
+/* transpose n <= 32 codes of code_size bytes to a block of code_size * 32
+ * bytes, lanes from n are zero */
+void pack_block(const uint8_t *const *codes, size_t code_size, size_t n,
+                uint8_t *block);
+
+/* accumulate lut entries of the codes in a block
+ *
+ * @param n          valid lanes of the block
+ * @param threshold  a lane is selected if acc < threshold (less) or
+ *                   acc > threshold (!less)
+ * @param acc        32 sums if it is not null
+ * @return bit i is set if lane i is selected
+ */
+uint32_t accumulate_block(size_t M, const uint8_t *block, const uint8_t *lut,
+                          size_t n, int threshold, bool less, uint16_t *acc);
+
+/* scalar accumulate_block, it is the reference of the AVX2 one */
+uint32_t accumulate_block_scalar(size_t M, const uint8_t *block,
+                                 const uint8_t *lut, size_t n, int threshold,
+                                 bool less, uint16_t *acc);
+
+/* threshold of lanes which may be less than top (L2) */
+int threshold_less(float top, double bias, float scale);
+
+/* threshold of lanes which may be greater than top (inner product) */
+int threshold_greater(size_t M, float top, double bias, float scale);
+
+/* exact distance of one code with the float tables */
+inline float distance(size_t M, const uint8_t *code, const float *tab,
+                      float dis0) {
+  float dis = dis0;
+  for (size_t m = 0; m < M; m += 2) {
+    uint8_t c = *code++;
+    dis += tab[c & 15];
+    dis += tab[kSubCentroids + (c >> 4)];
+    tab += 2 * kSubCentroids;
+  }
+  return dis;
+}
+
+/* codes of an inverted list packed to blocks, it is valid for the codes
+ * array and the version of the list it is packed from */
+struct PackedList {
+  const uint8_t *codes;
+  long version;
+  size_t n;                     // packed codes
+  std::vector<uint8_t> blocks;  // (n + 31) / 32 blocks
+};
+
+/* packed blocks of the lists of an index. A list is packed when it is
+ * scanned and reused by later scans until its codes array is replaced or
+ * its version changes, codes appended since are packed by the next scan.
+ * The search threads share it without lock, a list is replaced atomically
+ * and a scan keeps the one it got.
+ */
+class BlockCache {
+ public:
+  BlockCache(size_t nlist, size_t code_size);
+
+  /* blocks of the first n codes of a list, the version must be read before
+   * the codes, so the blocks of changed codes never get a newer version */
+  std::shared_ptr<const PackedList> get(size_t list_no, const uint8_t *codes,
+                                        size_t n, long version);
+
+  long mem_bytes() const { return mem_bytes_; }
+
+ private:
+  size_t code_size_;
+  std::vector<std::shared_ptr<const PackedList>> lists_;
+  std::atomic<long> mem_bytes_;
+};
+
+}  // namespace pq4
+
+#endif
@@ -0,0 +1,178 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "pq8_scan.h"
+#include <string.h>
+#include <atomic>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define PQ8_X86_KERNELS
+#endif
+
+namespace pq8 {
+
+namespace {
+
+enum KernelLevel { KERNEL_SCALAR = 0, KERNEL_AVX2, KERNEL_AVX512 };
+
+const char *kKernelNames[] = {"scalar", "avx2", "avx512"};
+
+const int kSubCentroids = 256;
+
+int SupportedLevel() {
+#ifdef PQ8_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return KERNEL_AVX512;
+  if (__builtin_cpu_supports("avx2")) return KERNEL_AVX2;
+#endif
+  return KERNEL_SCALAR;
+}
+
+std::atomic<int> &Level() {
+  static std::atomic<int> level(SupportedLevel());
+  return level;
+}
+
+void DistancesScalar(size_t M, const float *tab, float dis0,
+                     const uint8_t *codes, size_t n, float *dis) {
+  for (size_t j = 0; j < n; j++) {
+    float d = dis0;
+    const float *t = tab;
+    for (size_t m = 0; m < M; m++) {
+      d += t[*codes++];
+      t += kSubCentroids;
+    }
+    dis[j] = d;
+  }
+}
+
+#ifdef PQ8_X86_KERNELS
+
+// kM is the specialized M, 0 for any multiple of 4
+template <size_t kM>
+__attribute__((target("avx2"))) void DistancesAVX2(size_t M_, const float *tab,
+                                                   float dis0,
+                                                   const uint8_t *codes,
+                                                   size_t n, float *dis) {
+  const size_t M = kM ? kM : M_;
+  const int stride = (int)M;
+  // byte offsets of the codes of 8 lanes
+  const __m256i offsets =
+      _mm256_setr_epi32(0, stride, 2 * stride, 3 * stride, 4 * stride,
+                        5 * stride, 6 * stride, 7 * stride);
+  const __m256i low8 = _mm256_set1_epi32(0xff);
+  size_t j = 0;
+  for (; j + 8 <= n; j += 8) {
+    const uint8_t *c = codes + j * M;
+    const float *t = tab;
+    __m256 acc = _mm256_set1_ps(dis0);
+    for (size_t m = 0; m < M; m += 4) {
+      __m256i c4 = _mm256_i32gather_epi32((const int *)(c + m), offsets, 1);
+      __m256i i0 = _mm256_and_si256(c4, low8);
+      __m256i i1 = _mm256_and_si256(_mm256_srli_epi32(c4, 8), low8);
+      __m256i i2 = _mm256_and_si256(_mm256_srli_epi32(c4, 16), low8);
+      __m256i i3 = _mm256_srli_epi32(c4, 24);
+      acc = _mm256_add_ps(acc, _mm256_i32gather_ps(t, i0, 4));
+      acc = _mm256_add_ps(acc, _mm256_i32gather_ps(t + kSubCentroids, i1, 4));
+      acc = _mm256_add_ps(acc,
+                          _mm256_i32gather_ps(t + 2 * kSubCentroids, i2, 4));
+      acc = _mm256_add_ps(acc,
+                          _mm256_i32gather_ps(t + 3 * kSubCentroids, i3, 4));
+      t += 4 * kSubCentroids;
+    }
+    _mm256_storeu_ps(dis + j, acc);
+  }
+  DistancesScalar(M, tab, dis0, codes + j * M, n - j, dis + j);
+}
+
+// the avx512f intrinsics start from self-initialized registers, gcc warns
+// about them when they are inlined into a target function
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+template <size_t kM>
+__attribute__((target("avx512f"))) void DistancesAVX512(
+    size_t M_, const float *tab, float dis0, const uint8_t *codes, size_t n,
+    float *dis) {
+  const size_t M = kM ? kM : M_;
+  const int stride = (int)M;
+  const __m512i offsets = _mm512_mullo_epi32(
+      _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15),
+      _mm512_set1_epi32(stride));
+  const __m512i low8 = _mm512_set1_epi32(0xff);
+  size_t j = 0;
+  for (; j + 16 <= n; j += 16) {
+    const uint8_t *c = codes + j * M;
+    const float *t = tab;
+    __m512 acc = _mm512_set1_ps(dis0);
+    for (size_t m = 0; m < M; m += 4) {
+      __m512i c4 = _mm512_i32gather_epi32(offsets, (const void *)(c + m), 1);
+      __m512i i0 = _mm512_and_si512(c4, low8);
+      __m512i i1 = _mm512_and_si512(_mm512_srli_epi32(c4, 8), low8);
+      __m512i i2 = _mm512_and_si512(_mm512_srli_epi32(c4, 16), low8);
+      __m512i i3 = _mm512_srli_epi32(c4, 24);
+      acc = _mm512_add_ps(acc, _mm512_i32gather_ps(i0, t, 4));
+      acc = _mm512_add_ps(acc, _mm512_i32gather_ps(i1, t + kSubCentroids, 4));
+      acc = _mm512_add_ps(acc,
+                          _mm512_i32gather_ps(i2, t + 2 * kSubCentroids, 4));
+      acc = _mm512_add_ps(acc,
+                          _mm512_i32gather_ps(i3, t + 3 * kSubCentroids, 4));
+      t += 4 * kSubCentroids;
+    }
+    _mm512_storeu_ps(dis + j, acc);
+  }
+  // the tail of less than 16 codes
+  DistancesAVX2<kM>(M, tab, dis0, codes + j * M, n - j, dis + j);
+}
+#pragma GCC diagnostic pop
+
+#define PQ8_DISPATCH_M(kernel)                                \
+  switch (M) {                                                \
+    case 8:                                                   \
+      return kernel<8>(M, tab, dis0, codes, n, dis);          \
+    case 16:                                                  \
+      return kernel<16>(M, tab, dis0, codes, n, dis);         \
+    case 32:                                                  \
+      return kernel<32>(M, tab, dis0, codes, n, dis);         \
+    case 64:                                                  \
+      return kernel<64>(M, tab, dis0, codes, n, dis);         \
+    default:                                                  \
+      return kernel<0>(M, tab, dis0, codes, n, dis);          \
+  }
+
+#endif  // PQ8_X86_KERNELS
+
+}  // namespace
+
+void compute_distances(size_t M, const float *tab, float dis0,
+                       const uint8_t *codes, size_t n, float *dis) {
+#ifdef PQ8_X86_KERNELS
+  if (M % 4 == 0) {
+    int level = Level().load(std::memory_order_relaxed);
+    if (level == KERNEL_AVX512) {
+      PQ8_DISPATCH_M(DistancesAVX512);
+    } else if (level == KERNEL_AVX2) {
+      PQ8_DISPATCH_M(DistancesAVX2);
+    }
+  }
+#endif
+  DistancesScalar(M, tab, dis0, codes, n, dis);
+}
+
+const char *kernel_name() { return kKernelNames[Level().load()]; }
+
+int set_kernel(const char *name) {
+  for (int level = KERNEL_SCALAR; level <= KERNEL_AVX512; level++) {
+    if (strcmp(name, kKernelNames[level])) continue;
+    if (level > SupportedLevel()) return -1;
+    Level() = level;
+    return 0;
+  }
+  return -1;
+}
+
+}  // namespace pq8
@@ -0,0 +1,77 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef PQ8_SCAN_H_
+#define PQ8_SCAN_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* asymmetric distance computation of 8-bit PQ codes with float tables of
+ * M x 256 entries. Kernels gather the table entries of 8 (AVX2) or 16
+ * (AVX-512) codes per instruction, one 32-bit gather fetches 4 sub-quantizer
+ * codes of every lane. They are specialized for M = 8, 16, 32 and 64 and
+ * selected at runtime by the cpu features, M not a multiple of 4 is scalar.
+ * The sums are in the same order as the scalar loop, so the distances are
+ * identical whatever kernel is used.
+ */
+namespace pq8 {
+
+static const int kBatchSize = 64;
+
+/* dis[j] = dis0 + sum_m tab[m * 256 + codes[j * M + m]] for j < n */
+void compute_distances(size_t M, const float *tab, float dis0,
+                       const uint8_t *codes, size_t n, float *dis);
+
+/* name of the selected kernel: "scalar", "avx2" or "avx512" */
+const char *kernel_name();
+
+/* force a kernel, it fails if the cpu does not support it
+ *
+ * @return 0 if successed
+ */
+int set_kernel(const char *name);
+
+/* bit j is set if dis[j] < top (less) or dis[j] > top, n <= kBatchSize */
+inline uint64_t select(const float *dis, size_t n, float top, bool less) {
+  uint64_t mask = 0;
+  if (less) {
+    for (size_t j = 0; j < n; j++) mask |= (uint64_t)(dis[j] < top) << j;
+  } else {
+    for (size_t j = 0; j < n; j++) mask |= (uint64_t)(dis[j] > top) << j;
+  }
+  return mask;
+}
+
+/* bit j is set if ids[j] is deleted (the sign bit of the inverted list ids
+ * is set) or, with an allow-list, if bit vid - vid_begin of vid_bitmap isn't
+ * set, the vids out of [vid_begin, vid_begin + vid_num) aren't allowed.
+ * n <= kBatchSize
+ *
+ * @param vid_bitmap  null if only deleted ids are skipped
+ */
+inline uint64_t skipped(const int64_t *ids, size_t n, const char *vid_bitmap,
+                        long vid_begin, long vid_num) {
+  uint64_t mask = 0;
+  if (vid_bitmap) {
+    for (size_t j = 0; j < n; j++) {
+      int64_t id = ids[j];
+      int64_t vid = (id & INT64_MAX) - vid_begin;
+      uint64_t allowed = vid >= 0 && vid < vid_num
+                             ? (vid_bitmap[vid >> 3] >> (vid & 7)) & 1
+                             : 0;
+      mask |= (((uint64_t)id >> 63) | (allowed ^ 1)) << j;
+    }
+  } else {
+    for (size_t j = 0; j < n; j++) mask |= ((uint64_t)ids[j] >> 63) << j;
+  }
+  return mask;
+}
+
+}  // namespace pq8
+
+#endif
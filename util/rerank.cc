@@ -0,0 +1,56 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "rerank.h"
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "faiss/utils/distances.h"
+
+namespace rerank {
+
+// candidates of a block, 128 vectors of 512 floats are 256KB, which stay in
+// L2 cache between the copy and the distance kernel
+static const int kBlockSize = 128;
+
+void compute_distances(bool inner_product, const float *x, int d, int n,
+                       const float *const *ys, float *dis) {
+  std::vector<float> block((size_t)std::min(n, kBlockSize) * d);
+  for (int j0 = 0; j0 < n; j0 += kBlockSize) {
+    int nb = std::min(kBlockSize, n - j0);
+    for (int j = 0; j < nb; j++) {
+      memcpy(block.data() + (size_t)j * d, ys[j0 + j], d * sizeof(float));
+    }
+    if (inner_product) {
+      faiss::fvec_inner_products_ny(dis + j0, x, block.data(), d, nb);
+    } else {
+      faiss::fvec_L2sqr_ny(dis + j0, x, block.data(), d, nb);
+    }
+  }
+}
+
+void select(bool inner_product, int n, const float *dis, const int64_t *ids,
+            int k, float *simi, int64_t *idxi) {
+  auto better = [&](int a, int b) {
+    if (dis[a] != dis[b])
+      return inner_product ? dis[a] > dis[b] : dis[a] < dis[b];
+    return ids[a] < ids[b];
+  };
+  std::vector<int> order(n);
+  for (int j = 0; j < n; j++) order[j] = j;
+  if (n > k) {
+    std::nth_element(order.begin(), order.begin() + k, order.end(), better);
+    order.resize(k);
+  }
+  std::sort(order.begin(), order.end(), better);
+  for (size_t j = 0; j < order.size(); j++) {
+    simi[j] = dis[order[j]];
+    idxi[j] = ids[order[j]];
+  }
+}
+
+}  // namespace rerank
@@ -0,0 +1,34 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef RERANK_H_
+#define RERANK_H_
+
+#include <stdint.h>
+
+/* exact stage of a search which recalls candidates by compressed codes. The
+ * candidates are gathered block by block into contiguous memory and compared
+ * by the batched faiss kernels, which compute the differences rather than
+ * expanding the norms. They are called from the search threads, so no BLAS
+ * call is made here.
+ */
+namespace rerank {
+
+/* dis[j] = <x, ys[j]> (inner_product) or |x - ys[j]|^2 for j < n */
+void compute_distances(bool inner_product, const float *x, int d, int n,
+                       const float *const *ys, float *dis);
+
+/* the k best of n (dis, ids) sorted by distance to simi and idxi, by a
+ * partial selection rather than a heap update per candidate, ties are
+ * broken by the smaller id. The slots from n are not written
+ */
+void select(bool inner_product, int n, const float *dis, const int64_t *ids,
+            int k, float *simi, int64_t *idxi);
+
+}  // namespace rerank
+
+#endif
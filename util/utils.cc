@@ -8,6 +8,7 @@
 #include "utils.h"
 
 #include <dirent.h>
+#include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/time.h>
@@ -15,6 +16,7 @@
 
 #include <algorithm>
 #include <fstream>
+#include <limits>
 #include <sstream>
 
 namespace utils {
@@ -272,6 +274,28 @@ std::string join(const std::vector<std::string> &strs, char separator) {
   return ss.str();
 }
 
+// "%f" of -FLT_MAX is a sign, 39 digits and 7 of the fraction
+static const int kMaxNumberText = std::numeric_limits<float>::max_exponent10 + 20;
+
+template <typename T>
+static void append_format(std::string &str, const char *format, T value) {
+  char buf[kMaxNumberText];
+  int n = snprintf(buf, sizeof(buf), format, value);
+  if (n < 0) return;
+  if (n >= (int)sizeof(buf)) n = sizeof(buf) - 1;  // truncated
+  str.append(buf, n);
+}
+
+void append(std::string &str, float value, char separator) {
+  append_format(str, "%f", value);
+  str.push_back(separator);
+}
+
+void append(std::string &str, int value, char separator) {
+  append_format(str, "%d", value);
+  str.push_back(separator);
+}
+
 MEM_PACK *get_memoccupy() {
   FILE *fd;
   double mem_total, mem_used_rate;
@@ -89,6 +89,10 @@ inline T *NewArray(int len, const char *msg) {
 
 std::string join(const std::vector<std::string> &strs, char separator);
 
+// appends the text of value, the same as std::to_string, and separator
+void append(std::string &str, float value, char separator);
+void append(std::string &str, int value, char separator);
+
 template <class T>
 std::string join(const T *a, int n, char separator) {
   std::stringstream ss;
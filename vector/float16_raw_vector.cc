@@ -0,0 +1,143 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "float16_raw_vector.h"
+#include "log.h"
+#include "utils.h"
+
+using namespace std;
+
+namespace tig_gamma {
+
+Float16RawVector::Float16RawVector(const string &name, int dimension,
+                                   int max_vector_size, const string &root_path,
+                                   const StoreParams &store_params)
+    : RawVector<float>(name, dimension, max_vector_size, root_path) {
+  store_ = new MmapRawVector<uint16_t>(name + "_fp16", dimension,
+                                       max_vector_size, root_path,
+                                       store_params);
+  encode_buffer_.resize(dimension);
+}
+
+Float16RawVector::~Float16RawVector() {
+  if (store_) {
+    StopFlushingIfNeed(store_);
+    delete store_;
+    store_ = nullptr;
+  }
+}
+
+int Float16RawVector::InitStore() {
+  this->vector_byte_size_ = sizeof(uint16_t) * this->dimension_;
+  // one vector id per slot, docids are managed by this raw vector
+  int ret = store_->Init(false, false);
+  if (ret != 0) {
+    LOG(ERROR) << "init fp16 store error, ret=" << ret;
+    return ret;
+  }
+  StartFlushingIfNeed(store_);
+  this->total_mem_bytes_ += store_->GetTotalMemBytes();
+  LOG(INFO) << "init fp16 raw vector success! name=" << this->vector_name_
+            << ", memory only=" << store_->GetMemoryMode();
+  return 0;
+}
+
+int Float16RawVector::ToField(float *v, int len, Field &field,
+                              ByteArray &value) {
+  if (len != this->dimension_) {
+    LOG(ERROR) << "invalid vector length=" << len
+               << ", dimension=" << this->dimension_;
+    return -1;
+  }
+  float16::encode(v, encode_buffer_.data(), len);
+  value.value = (char *)encode_buffer_.data();
+  value.len = len * sizeof(uint16_t);
+  field.name = nullptr;
+  field.value = &value;
+  field.source = nullptr;
+  field.data_type = VECTOR;
+  return 0;
+}
+
+int Float16RawVector::AddToStore(float *v, int len) {
+  Field field;
+  ByteArray value;
+  if (ToField(v, len, field, value)) return -1;
+  Field *pfield = &field;
+  // vid of the inner store is equal to vid of this one
+  return store_->Add(this->ntotal_, pfield);
+}
+
+int Float16RawVector::UpdateToStore(int vid, float *v, int len) {
+  Field field;
+  ByteArray value;
+  if (ToField(v, len, field, value)) return -1;
+  Field *pfield = &field;
+  int ret = store_->Update(vid, pfield);
+  // updates are consumed through updated_vids_ of this raw vector
+  int updated_vid;
+  while (store_->updated_vids_->try_dequeue(updated_vid)) {
+  }
+  return ret;
+}
+
+int Float16RawVector::GetVectorHeader(int start, int end,
+                                      ScopeVector<float> &vec) {
+  ScopeVector<uint16_t> half_vec;
+  if (store_->GetVectorHeader(start, end, half_vec)) return 1;
+  size_t n = (size_t)(end - start) * this->dimension_;
+  float *decoded = new float[n > 0 ? n : 1];
+  float16::decode(half_vec.Get(), decoded, n);
+  vec.Set(decoded, true);
+  return 0;
+}
+
+int Float16RawVector::GetVector(long vid, const float *&vec,
+                                bool &deletable) const {
+  ScopeVector<uint16_t> half_vec;
+  RawVector<uint16_t> *store = store_;
+  if (store->GetVector(vid, half_vec) || half_vec.Get() == nullptr) {
+    return 1;
+  }
+  float *decoded = new float[this->dimension_];
+  float16::decode(half_vec.Get(), decoded, this->dimension_);
+  vec = decoded;
+  deletable = true;
+  return 0;
+}
+
+int Float16RawVector::GetFP16VectorHeader(int start, int end,
+                                          ScopeVector<uint16_t> &vec) {
+  return store_->GetVectorHeader(start, end, vec);
+}
+
+int Float16RawVector::GetFP16Vector(long vid, ScopeVector<uint16_t> &vec) {
+  RawVector<uint16_t> *store = store_;
+  return store->GetVector(vid, vec);
+}
+
+int Float16RawVector::GetFP16Vectors(int k, long *ids_list,
+                                     ScopeVectors<uint16_t> &vecs) const {
+  return store_->Gets(k, ids_list, vecs);
+}
+
+size_t Float16RawVector::GetStoreMemUsage() {
+  return store_->GetStoreMemUsage();
+}
+
+int Float16RawVector::DumpVectors(int dump_vid, int n) {
+  if (n <= 0) return 0;
+  return store_->Dump(this->root_path_, dump_vid, dump_vid + n - 1);
+}
+
+int Float16RawVector::LoadVectors(int vec_num) {
+  std::vector<std::string> paths;
+  paths.push_back(this->root_path_);
+  return store_->Load(paths, vec_num);
+}
+
+}  // namespace tig_gamma
@@ -0,0 +1,81 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef FLOAT16_RAW_VECTOR_H_
+#define FLOAT16_RAW_VECTOR_H_
+
+#include <string>
+#include <vector>
+#include "float16.h"
+#include "mmap_raw_vector.h"
+#include "raw_vector.h"
+
+namespace tig_gamma {
+
+/** float vectors stored in half precision, 2 bytes per dimension.
+ * It keeps the RawVector<float> interface, vectors are encoded when they are
+ * added and decoded when they are read as floats. Distance computations
+ * should use GetFP16Vector(s)/GetFP16VectorHeader with the kernels in
+ * float16.h to avoid decoding.
+ * The half vectors are kept in an inner MmapRawVector<uint16_t> whose files
+ * are named with the suffix "_fp16", sources and docids stay in this one.
+ */
+class Float16RawVector : public RawVector<float> {
+ public:
+  Float16RawVector(const std::string &name, int dimension, int max_vector_size,
+                   const std::string &root_path,
+                   const StoreParams &store_params);
+  ~Float16RawVector();
+
+  int InitStore() override;
+  int AddToStore(float *v, int len) override;
+  int UpdateToStore(int vid, float *v, int len) override;
+
+  /** decode vectors [start, end) to floats, the result is always a copy
+   */
+  int GetVectorHeader(int start, int end, ScopeVector<float> &vec) override;
+
+  size_t GetStoreMemUsage() override;
+
+  /** get the half vectors header, it is stable in memory mode
+   *
+   * @param start start vector id(include)
+   * @param end end vector id(exclude)
+   * @return 0 if successed
+   */
+  int GetFP16VectorHeader(int start, int end, ScopeVector<uint16_t> &vec);
+
+  /** get half vector by id without decoding
+   *
+   * @return 0 if successed
+   */
+  int GetFP16Vector(long vid, ScopeVector<uint16_t> &vec);
+
+  /** get half vectors by vector id list without decoding
+   *
+   * @return 0 if successed
+   */
+  int GetFP16Vectors(int k, long *ids_list, ScopeVectors<uint16_t> &vecs) const;
+
+  int GetMemoryMode() { return store_->GetMemoryMode(); }
+
+ protected:
+  int GetVector(long vid, const float *&vec, bool &deletable) const override;
+  int DumpVectors(int dump_vid, int n) override;
+  int LoadVectors(int vec_num) override;
+  bool IsSourceOnDisk() override { return !store_->GetMemoryMode(); }
+
+ private:
+  int ToField(float *v, int len, Field &field, ByteArray &value);
+
+  MmapRawVector<uint16_t> *store_;
+  std::vector<uint16_t> encode_buffer_;  // only used by the writing thread
+};
+
+}  // namespace tig_gamma
+
+#endif  // FLOAT16_RAW_VECTOR_H_
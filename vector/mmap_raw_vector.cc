@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <exception>
+#include <sstream>
 #include "log.h"
 #include "utils.h"
 
@@ -27,6 +28,15 @@ MmapRawVector<DataType>::MmapRawVector(const string &name, int dimension,
     : RawVector<DataType>(name, dimension, max_vector_size, root_path),
       AsyncFlusher(name) {
   flush_batch_size_ = 1000;
+  flush_buffer_ = nullptr;
+  direct_fd_ = -1;
+  tail_bytes_ = 0;
+  last_flush_time_ = 0;
+  first_flush_time_ = 0;
+  flushed_bytes_ = 0;
+  flush_writes_ = 0;
+  flush_write_ms_ = 0;
+  prefetched_ranges_ = 0;
   init_vector_num_ = 0;
   this->vector_byte_size_ = sizeof(DataType) * dimension;
   flush_write_retry_ = 10;
@@ -34,10 +44,16 @@ MmapRawVector<DataType>::MmapRawVector(const string &name, int dimension,
   fet_file_path_ = root_path + "/" + name + ".fet";
   updated_fet_file_path_ = root_path + "/" + name + "_updated.fet";
   fet_fd_ = -1;
+  fet_update_fd_ = -1;
+  file_vector_num_ = 0;
+  header_size_ = 0;
+  data_checksum_ = 0;
+  checksum_valid_ = true;
   updated_fet_fp_ = NULL;
   store_params_ = new StoreParams(store_params);
   stored_num_ = 0;
   memory_only_ = false;
+  hot_cache_ = nullptr;
 }
 
 template <typename DataType>
@@ -49,14 +65,23 @@ MmapRawVector<DataType>::~MmapRawVector() {
   if (vector_file_mapper_ != nullptr) {
     delete vector_file_mapper_;
   }
+  CHECK_DELETE(hot_cache_);
 
-  if (flush_batch_vectors_ != nullptr) {
-    delete[] flush_batch_vectors_;
+  if (flush_buffer_ != nullptr) {
+    free(flush_buffer_);
+  }
+  if (direct_fd_ != -1) {
+    fsync(direct_fd_);
+    close(direct_fd_);
   }
   if (fet_fd_ != -1) {
     fsync(fet_fd_);
     close(fet_fd_);
   }
+  if (fet_update_fd_ != -1) {
+    fsync(fet_update_fd_);
+    close(fet_update_fd_);
+  }
   if (updated_fet_fp_ != NULL) {
     fflush(updated_fet_fp_);
     fclose(updated_fet_fp_);
@@ -74,6 +99,12 @@ int MmapRawVector<DataType>::InitStore() {
     LOG(ERROR) << "open file error:" << strerror(errno);
     return -1;
   }
+  fet_update_fd_ = open(fet_file_path_.c_str(), O_WRONLY);
+  if (fet_update_fd_ == -1) {
+    LOG(ERROR) << "open file for update error:" << strerror(errno);
+    return -1;
+  }
+  if (InitFetHeader()) return -1;
   updated_fet_fp_ = fopen(updated_fet_file_path_.c_str(), "ab");
   if (updated_fet_fp_ == NULL) {
     LOG(ERROR) << "open update file error:" << strerror(errno);
@@ -87,7 +118,7 @@ int MmapRawVector<DataType>::InitStore() {
   vector_buffer_queue_ = new VectorBufferQueue<DataType>(
       max_buffer_size_, this->dimension_, buffer_chunk_num_);
   vector_file_mapper_ = new VectorFileMapper<DataType>(
-      fet_file_path_, 0, this->max_vector_size_, this->dimension_);
+      fet_file_path_, header_size_, this->max_vector_size_, this->dimension_);
 
   if (max_buffer_size_ >= this->max_vector_size_)
     memory_only_ = true;  // memory mode
@@ -99,10 +130,7 @@ int MmapRawVector<DataType>::InitStore() {
   }
   this->total_mem_bytes_ += vector_buffer_queue_->GetTotalMemBytes();
 
-  flush_batch_vectors_ =
-      new DataType[(uint64_t)flush_batch_size_ * this->dimension_];
-  this->total_mem_bytes_ +=
-      (uint64_t)flush_batch_size_ * this->dimension_ * sizeof(DataType);
+  if (InitFlushBuffer()) return -1;
 
   ret = vector_file_mapper_->Init();
   if (0 != ret) {
@@ -110,6 +138,17 @@ int MmapRawVector<DataType>::InitStore() {
     return -1;
   }
 
+  if (!memory_only_ && store_params_->hot_cache_size_ > 0) {
+    hot_cache_ = new VectorCache<DataType>(this->dimension_,
+                                           store_params_->hot_cache_size_);
+    if (hot_cache_->Init()) {
+      LOG(ERROR) << "init hot cache error, size="
+                 << store_params_->hot_cache_size_;
+      return -1;
+    }
+    this->total_mem_bytes_ += hot_cache_->GetTotalMemBytes();
+  }
+
   LOG(INFO) << "init success! vector byte size=" << this->vector_byte_size_
             << ", flush batch size=" << flush_batch_size_
             << ", memory only=" << memory_only_
@@ -118,40 +157,231 @@ int MmapRawVector<DataType>::InitStore() {
   return 0;
 }
 
+template <typename DataType>
+int MmapRawVector<DataType>::InitFetHeader() {
+  VectorFileHeader header;
+  int ret = ReadVectorFileHeader(fet_file_path_, header);
+  if (ret < 0) return -1;
+  if (ret == 0) {
+    if (header.dimension != (uint32_t)this->dimension_ ||
+        header.data_type_size != sizeof(DataType)) {
+      LOG(ERROR) << "vector file doesn't match, path=" << fet_file_path_
+                 << ", dimension=" << header.dimension
+                 << ", data type size=" << header.data_type_size;
+      return -1;
+    }
+    header_size_ = header.header_size;
+    // it is decided at load
+    checksum_valid_ = false;
+    return 0;
+  }
+  if (utils::get_file_size(fet_file_path_.c_str()) > 0) {
+    LOG(WARNING) << "vector file has no header, path=" << fet_file_path_;
+    header_size_ = 0;
+    checksum_valid_ = false;
+    return 0;
+  }
+  header.Init(sizeof(DataType), this->dimension_);
+  if (WriteVectorFileHeader(fet_update_fd_, header)) return -1;
+  header_size_ = header.header_size;
+  return 0;
+}
+
+template <typename DataType>
+int MmapRawVector<DataType>::InitFlushBuffer() {
+  long chunk_vectors =
+      store_params_->flush_chunk_size_ / this->vector_byte_size_;
+  if (chunk_vectors < 1) chunk_vectors = 1;
+  // a pop can't be larger than the buffer
+  if (chunk_vectors > max_buffer_size_) chunk_vectors = max_buffer_size_;
+  flush_batch_size_ = (int)chunk_vectors;
+
+  // room for the unaligned tail before and the padding after the vectors
+  size_t size = (size_t)flush_batch_size_ * this->vector_byte_size_ +
+                2 * kDirectIOAlign;
+  if (posix_memalign((void **)&flush_buffer_, kDirectIOAlign, size)) {
+    LOG(ERROR) << "alloc flush buffer error, size=" << size;
+    flush_buffer_ = nullptr;
+    return -1;
+  }
+  this->total_mem_bytes_ += size;
+
+  if (store_params_->direct_io_) {
+    direct_fd_ = open(fet_file_path_.c_str(), O_WRONLY | O_DIRECT);
+    if (direct_fd_ == -1) {
+      LOG(WARNING) << "open vector file with O_DIRECT error:"
+                   << strerror(errno) << ", write through page cache";
+    }
+  }
+  return ResetFlushTail();
+}
+
+template <typename DataType>
+int MmapRawVector<DataType>::ResetFlushTail() {
+  tail_bytes_ = 0;
+  if (direct_fd_ == -1) return 0;
+  off_t file_end = header_size_ + file_vector_num_ * this->vector_byte_size_;
+  tail_bytes_ = file_end % kDirectIOAlign;
+  if (tail_bytes_ == 0) return 0;
+  // the partial block is written again together with the next vectors
+  int fd = open(fet_file_path_.c_str(), O_RDONLY);
+  if (fd == -1) {
+    LOG(ERROR) << "open vector file error:" << strerror(errno);
+    return -1;
+  }
+  ssize_t ret = pread(fd, flush_buffer_, tail_bytes_, file_end - tail_bytes_);
+  close(fd);
+  if (ret != tail_bytes_) {
+    LOG(ERROR) << "read vector file tail error:" << strerror(errno);
+    return -1;
+  }
+  return 0;
+}
+
+template <typename DataType>
+int MmapRawVector<DataType>::WriteChunk(int num) {
+  size_t bytes = (size_t)num * this->vector_byte_size_;
+  off_t file_end = header_size_ + file_vector_num_ * this->vector_byte_size_;
+  double start = utils::getmillisecs();
+  if (direct_fd_ != -1) {
+    off_t offset = file_end - tail_bytes_;
+    size_t len = tail_bytes_ + bytes;
+    size_t aligned_len = (len + kDirectIOAlign - 1) / kDirectIOAlign *
+                         kDirectIOAlign;
+    memset(flush_buffer_ + len, 0, aligned_len - len);
+    ssize_t ret = pwrite(direct_fd_, flush_buffer_, aligned_len, offset);
+    if (ret != (ssize_t)aligned_len) {
+      LOG(ERROR) << "direct write error:" << strerror(errno) << ", num=" << num;
+      return -1;
+    }
+    // the padding is cut, it is written again with the next vectors
+    if (aligned_len != len && ftruncate(direct_fd_, offset + len)) {
+      LOG(ERROR) << "truncate vector file error:" << strerror(errno);
+      return -1;
+    }
+    tail_bytes_ = len % kDirectIOAlign;
+    memmove(flush_buffer_, flush_buffer_ + len - tail_bytes_, tail_bytes_);
+  } else {
+    ssize_t ret = utils::write_n(fet_fd_, flush_buffer_, bytes,
+                                 flush_write_retry_);
+    if (ret != (ssize_t)bytes) {
+      LOG(ERROR) << "write_n error:" << strerror(errno) << ", num=" << num;
+      return -1;
+    }
+    // start writeback now, WaitInflight keeps a bounded number of chunks
+    // under it, so dirty pages don't pile up until the kernel flushes them
+    // all at once
+    sync_file_range(fet_fd_, file_end, bytes, SYNC_FILE_RANGE_WRITE);
+    inflight_ranges_.push_back(std::make_pair(file_end, bytes));
+  }
+  flush_write_ms_ += (long)(utils::getmillisecs() - start);
+  flush_writes_++;
+  flushed_bytes_ += bytes;
+  return 0;
+}
+
+template <typename DataType>
+void MmapRawVector<DataType>::WaitInflight() {
+  double start = utils::getmillisecs();
+  while ((int)inflight_ranges_.size() > store_params_->flush_inflight_) {
+    std::pair<off_t, size_t> range = inflight_ranges_.front();
+    inflight_ranges_.pop_front();
+    sync_file_range(fet_fd_, range.first, range.second,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    // memory mode reads vectors from buffer, the file is only mapped at load
+    // for the vectors already in it, so pages written since are a second copy
+    if (memory_only_) {
+      posix_fadvise(fet_fd_, range.first, range.second, POSIX_FADV_DONTNEED);
+    }
+  }
+  flush_write_ms_ += (long)(utils::getmillisecs() - start);
+}
+
 template <typename DataType>
 int MmapRawVector<DataType>::FlushOnce() {
   int psize = vector_buffer_queue_->GetPopSize();
+  if (psize == 0) return 0;
+  double now = utils::getmillisecs();
+  if (first_flush_time_ == 0) first_flush_time_ = now;
+  // group commit: a small batch waits for more vectors unless it is waited
+  // for or it has waited long enough
+  if (psize < flush_batch_size_ && flush_demand_ <= nflushed_ &&
+      now - last_flush_time_ < kFlushMaxDelay) {
+    return 0;
+  }
   int count = 0;
   while (count < psize) {
     int num =
         psize - count > flush_batch_size_ ? flush_batch_size_ : psize - count;
-    vector_buffer_queue_->Pop(flush_batch_vectors_, this->dimension_, num, -1);
-    ssize_t write_size = (ssize_t)num * this->vector_byte_size_;
-    ssize_t ret = utils::write_n(fet_fd_, (char *)flush_batch_vectors_,
-                                 write_size, flush_write_retry_);
-    if (ret != write_size) {
-      LOG(ERROR) << "write_n error:" << strerror(errno) << ", num=" << num;
-      // TODO: truncate and seek file, or write the success number to file
-      return -2;
+    {
+      // an update in disk mode sees the vector either in buffer or in file
+      std::lock_guard<std::mutex> lock(flush_mutex_);
+      char *vectors = flush_buffer_ + tail_bytes_;
+      vector_buffer_queue_->Pop((DataType *)vectors, this->dimension_, num,
+                                -1);
+      for (int i = 0; i < num; i++) {
+        data_checksum_ ^=
+            VectorChecksum(file_vector_num_ + i,
+                           vectors + (long)i * this->vector_byte_size_,
+                           this->vector_byte_size_);
+      }
+      if (WriteChunk(num)) {
+        // TODO: truncate and seek file, or write the success number to file
+        return -2;
+      }
+      file_vector_num_ += num;
     }
+    // updates aren't blocked while the earlier chunks are written back
+    WaitInflight();
     count += num;
   }
+  last_flush_time_ = now;
   return psize;
 }
 
+template <typename DataType>
+double MmapRawVector<DataType>::GetFlushThroughput() const {
+  double elapsed = utils::getmillisecs() - first_flush_time_;
+  if (first_flush_time_ == 0 || elapsed <= 0) return 0;
+  return flushed_bytes_ * 1000.0 / elapsed;
+}
+
+template <typename DataType>
+std::string MmapRawVector<DataType>::GetFlushStat() const {
+  std::stringstream ss;
+  long writes = flush_writes_;
+  ss << "lag=" << GetFlushLag() << ", flushed bytes=" << flushed_bytes_
+     << ", writes=" << writes << ", avg write ms="
+     << (writes > 0 ? (double)flush_write_ms_ / writes : 0)
+     << ", throughput=" << GetFlushThroughput() / (1024 * 1024) << "MB/s"
+     << ", direct io=" << (direct_fd_ != -1);
+  return ss.str();
+}
+
 template <typename DataType>
 int MmapRawVector<DataType>::DumpVectors(int dump_vid, int n) {
   int dump_end = dump_vid + n;
-  while (nflushed_ < dump_end) {
-    LOG(INFO) << "raw vector=" << this->vector_name_
-              << ", dump waiting! dump_end=" << dump_end
-              << ", nflushed=" << nflushed_;
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-  }
+  Until(dump_end);
   if (fflush(updated_fet_fp_)) {
     LOG(ERROR) << "flush update file error: " << strerror(errno);
     return -1;
   }
+  if (header_size_ > 0) {
+    std::lock_guard<std::mutex> lock(flush_mutex_);
+    VectorFileHeader header;
+    header.Init(sizeof(DataType), this->dimension_);
+    header.vector_num = file_vector_num_;
+    header.data_checksum = data_checksum_;
+    if (!checksum_valid_) header.flags &= ~VectorFileHeader::kChecksumValid;
+    if (WriteVectorFileHeader(fet_update_fd_, header)) return -1;
+  }
+  if (hot_cache_) {
+    LOG(INFO) << "raw vector=" << this->vector_name_
+              << ", hot cache: " << hot_cache_->GetStat();
+  }
+  LOG(INFO) << "raw vector=" << this->vector_name_
+            << ", flush: " << GetFlushStat();
   return 0;
 }
 
@@ -159,11 +389,12 @@ template <typename DataType>
 int MmapRawVector<DataType>::LoadVectors(int vec_num) {
   StopFlushingIfNeed(this);
   long file_size = utils::get_file_size(fet_file_path_.c_str());
-  if (file_size % this->vector_byte_size_ != 0) {
+  if (file_size < header_size_ ||
+      (file_size - header_size_) % this->vector_byte_size_ != 0) {
     LOG(ERROR) << "file_size % vector_byte_size_ != 0, path=" << fet_file_path_;
     return -1;
   }
-  long disk_vector_num = file_size / this->vector_byte_size_;
+  long disk_vector_num = (file_size - header_size_) / this->vector_byte_size_;
   LOG(INFO) << "disk_vector_num=" << disk_vector_num << ", vec_num=" << vec_num;
   assert(disk_vector_num >= vec_num);
   if (disk_vector_num > vec_num) {
@@ -171,7 +402,7 @@ int MmapRawVector<DataType>::LoadVectors(int vec_num) {
     if (fet_fd_ != -1) close(fet_fd_);
     if (vector_file_mapper_) delete vector_file_mapper_;
 
-    long trunc_size = (long)vec_num * this->vector_byte_size_;
+    long trunc_size = header_size_ + (long)vec_num * this->vector_byte_size_;
     if (truncate(fet_file_path_.c_str(), trunc_size)) {
       LOG(ERROR) << "truncate feature file=" << fet_file_path_ << " to "
                  << trunc_size << ", error:" << strerror(errno);
@@ -184,20 +415,28 @@ int MmapRawVector<DataType>::LoadVectors(int vec_num) {
       return -1;
     }
     vector_file_mapper_ = new VectorFileMapper<DataType>(
-        fet_file_path_, 0, this->max_vector_size_, this->dimension_);
+        fet_file_path_, header_size_, this->max_vector_size_, this->dimension_);
     if (vector_file_mapper_->Init()) {
       LOG(ERROR) << "vector file mapper map error";
       return -1;
     }
     disk_vector_num = vec_num;
   }
-
-  // read vectors from fet file to vector buffer queue
-  if (vec_num > 0) {
+  if (LoadChecksum(vec_num)) return -1;
+
+  if (memory_only_ && vec_num > 0 && vec_num <= max_buffer_size_ &&
+      vector_buffer_queue_->MapFile(fet_file_path_, header_size_, vec_num) ==
+          0) {
+    // startup doesn't depend on the file size, pages are read on demand
+    LOG(INFO) << "map " << vec_num << " vectors into buffer, path="
+              << fet_file_path_;
+  } else if (vec_num > 0) {
+    // read vectors from fet file to vector buffer queue
     long offset =
-        vec_num > max_buffer_size_
-            ? (long)(vec_num - max_buffer_size_) * this->vector_byte_size_
-            : 0;
+        header_size_ +
+        (vec_num > max_buffer_size_
+             ? (long)(vec_num - max_buffer_size_) * this->vector_byte_size_
+             : 0);
     FILE *fet_fp = fopen(fet_file_path_.c_str(), "rb");
     if (fet_fp == NULL) {
       LOG(ERROR) << "open feature file error, file path=" << fet_file_path_;
@@ -231,6 +470,8 @@ int MmapRawVector<DataType>::LoadVectors(int vec_num) {
 
   nflushed_ = disk_vector_num;
   last_nflushed_ = nflushed_;
+  file_vector_num_ = disk_vector_num;
+  if (ResetFlushTail()) return -1;
 
   LoadUpdatedVectors();
 
@@ -240,6 +481,39 @@ int MmapRawVector<DataType>::LoadVectors(int vec_num) {
   return 0;
 }
 
+template <typename DataType>
+int MmapRawVector<DataType>::LoadChecksum(int vec_num) {
+  data_checksum_ = 0;
+  checksum_valid_ = false;
+  if (header_size_ == 0) return 0;
+  VectorFileHeader header;
+  if (ReadVectorFileHeader(fet_file_path_, header) == 0 &&
+      (header.flags & VectorFileHeader::kChecksumValid) &&
+      header.vector_num == (uint64_t)vec_num) {
+    data_checksum_ = header.data_checksum;
+    checksum_valid_ = true;
+  }
+  if (!store_params_->verify_checksum_) return 0;
+
+  // it reads the whole file
+  uint64_t checksum = 0;
+  for (int i = 0; i < vec_num; i++) {
+    checksum ^= VectorChecksum(i, (const char *)vector_file_mapper_->GetVector(i),
+                               this->vector_byte_size_);
+  }
+  if (checksum_valid_ && checksum != data_checksum_) {
+    LOG(ERROR) << "vector file checksum error, path=" << fet_file_path_
+               << ", vector num=" << vec_num;
+    return -1;
+  }
+  LOG(INFO) << "vector file checksum "
+            << (checksum_valid_ ? "verified" : "rebuilt")
+            << ", vector num=" << vec_num;
+  data_checksum_ = checksum;
+  checksum_valid_ = true;
+  return 0;
+}
+
 template <typename DataType>
 int MmapRawVector<DataType>::LoadUpdatedVectors() {
   if (!memory_only_) return -1;
@@ -283,7 +557,42 @@ int MmapRawVector<DataType>::UpdateToStore(int vid, DataType *v, int len) {
     fwrite((void *)v, this->vector_byte_size_, 1, updated_fet_fp_);
     return 0;
   }
-  return -1;  // it doesn't support to update in disk mode
+
+  // disk mode: overwrite the slot in buffer and in fet file, the mapped
+  // pages see the new vector as the mapping is shared
+  std::lock_guard<std::mutex> lock(flush_mutex_);
+  if (vid >= stored_num_) {
+    // it fails if the vector isn't in buffer
+    vector_buffer_queue_->Update(vid - stored_num_, v, len);
+  }
+  if (vid < file_vector_num_) {
+    data_checksum_ ^=
+        VectorChecksum(vid, (const char *)vector_file_mapper_->GetVector(vid),
+                       this->vector_byte_size_) ^
+        VectorChecksum(vid, (const char *)v, this->vector_byte_size_);
+    off_t offset = header_size_ + (off_t)vid * this->vector_byte_size_;
+    off_t tail_offset =
+        header_size_ + file_vector_num_ * this->vector_byte_size_ - tail_bytes_;
+    if (offset + this->vector_byte_size_ > tail_offset) {
+      // the tail block is rewritten from flush buffer by the next direct write
+      off_t start = offset > tail_offset ? offset : tail_offset;
+      memcpy(flush_buffer_ + (start - tail_offset),
+             (char *)v + (start - offset),
+             offset + this->vector_byte_size_ - start);
+    }
+    ssize_t ret = pwrite(fet_update_fd_, (void *)v, this->vector_byte_size_,
+                         offset);
+    if (ret != this->vector_byte_size_) {
+      LOG(ERROR) << "update fet file error:" << strerror(errno)
+                 << ", vid=" << vid;
+      checksum_valid_ = false;
+      return -1;
+    }
+  }
+  // after the file, a concurrent miss copies from the mapped pages under
+  // the shard lock, so it can't put the old vector back
+  if (hot_cache_) hot_cache_->Update(vid, v);
+  return 0;
 }
 
 template <typename DataType>
@@ -311,12 +620,48 @@ int MmapRawVector<DataType>::GetVectorHeader(int start, int end,
 template <typename DataType>
 int MmapRawVector<DataType>::GetVector(long vid, const DataType *&vec,
                                        bool &deletable) const {
+  std::atomic<int> *pin = nullptr;
+  int ret = GetPinnedVector(vid, vec, deletable, pin);
+  if (pin != nullptr) {
+    // nobody releases the pin, so the vector is copied
+    DataType *vector = new DataType[this->dimension_];
+    memcpy((void *)vector, (void *)vec, this->vector_byte_size_);
+    pin->fetch_sub(1);
+    vec = vector;
+    deletable = true;
+  }
+  return ret;
+}
+
+template <typename DataType>
+int MmapRawVector<DataType>::GetPinnedVector(long vid, const DataType *&vec,
+                                             bool &deletable,
+                                             std::atomic<int> *&pin) const {
+  pin = nullptr;
   if (vid >= this->ntotal_ || vid < 0) {
     return 1;
   };
 
   // int stored_num = ntotal_ - vector_buffer_queue_->size();
   if (vid >= stored_num_) {
+    // recent vectors are read in place and pinned until they are released,
+    // they are copied only if they are close to be overwritten. The buffer
+    // never wraps in memory only mode
+    const DataType *ref = nullptr;
+    if (memory_only_) {
+      DataType *head = nullptr;
+      if (vector_buffer_queue_->GetVectorHead(vid - stored_num_, &head,
+                                              this->dimension_) == 0) {
+        ref = head;
+      }
+    } else {
+      ref = vector_buffer_queue_->GetVectorRef(vid - stored_num_, pin);
+    }
+    if (ref != nullptr) {
+      vec = ref;
+      deletable = false;
+      return 0;
+    }
     DataType *vector = new DataType[this->dimension_];
     if (vector_buffer_queue_->GetVector(vid - stored_num_, vector,
                                         this->dimension_) == 0) {
@@ -326,12 +671,48 @@ int MmapRawVector<DataType>::GetVector(long vid, const DataType *&vec,
     }
     delete[] vector;
   }
+  if (hot_cache_) {
+    DataType *vector = new DataType[this->dimension_];
+    if (hot_cache_->Get(vid, vector)) {
+      vec = vector;
+      deletable = true;
+      return 0;
+    }
+    delete[] vector;
+  }
   const DataType *fea = vector_file_mapper_->GetVector(vid);
+  if (hot_cache_) hot_cache_->Put(vid, fea);
   vec = fea;
   deletable = false;
   return 0;
 }
 
+template <typename DataType>
+int MmapRawVector<DataType>::Gets(int k, long *ids_list,
+                                  ScopeVectors<DataType> &vecs) const {
+  if (!memory_only_ && k > 1) {
+    std::vector<long> disk_ids;
+    disk_ids.reserve(k);
+    for (int i = 0; i < k; i++) {
+      long vid = ids_list[i];
+      if (vid < 0 || vid >= this->ntotal_) continue;
+      // vectors flushed since load are in file once the buffer wraps
+      if (vid >= stored_num_ &&
+          vector_buffer_queue_->Contains(vid - stored_num_)) {
+        continue;
+      }
+      disk_ids.push_back(vid);
+    }
+    if (disk_ids.size() > 1) {
+      prefetched_ranges_ += vector_file_mapper_->Prefetch(disk_ids);
+    }
+  }
+  // vectors are returned in the order of ids_list, the caller computes
+  // distances while the later pages are still being read
+  return RawVector<DataType>::Gets(k, ids_list, vecs);
+}
+
 template class MmapRawVector<float>;
 template class MmapRawVector<uint8_t>;
+template class MmapRawVector<uint16_t>;
 }  // namespace tig_gamma
@@ -8,15 +8,21 @@
 #ifndef MMAP_RAW_VECTOR_H_
 #define MMAP_RAW_VECTOR_H_
 
+#include <atomic>
+#include <deque>
+#include <mutex>
 #include <string>
 #include <thread>
 #include "raw_vector.h"
 #include "vector_buffer_queue.h"
+#include "vector_cache.h"
 #include "vector_file_mapper.h"
 
 namespace tig_gamma {
 
 static const int kDefaultBufferChunkNum = 1024;
+static const long kDirectIOAlign = 4096;
+static const double kFlushMaxDelay = 500;  // ms
 
 template <typename DataType>
 class MmapRawVector : public RawVector<DataType>, public AsyncFlusher {
@@ -30,25 +36,71 @@ class MmapRawVector : public RawVector<DataType>, public AsyncFlusher {
   int UpdateToStore(int vid, DataType *v, int len);
   int GetMemoryMode() { return memory_only_; }
 
+  /** hot vector cache in disk mode, null if it isn't enabled */
+  VectorCache<DataType> *GetHotCache() { return hot_cache_; }
+
+  /** the number of vectors which aren't written to file yet */
+  int GetFlushLag() const { return vector_buffer_queue_->GetPopSize(); }
+
+  /** average bytes per second written to file since the first flush */
+  double GetFlushThroughput() const;
+
+  std::string GetFlushStat() const;
+
+  /** in disk mode, the pages of all flushed vectors are advised before any of
+   * them is read, so the random reads are issued together instead of one
+   * page fault after another
+   */
+  int Gets(int k, long *ids_list, ScopeVectors<DataType> &vecs) const override;
+
+  /** ranges of the vector file advised by Gets */
+  long GetPrefetchedRanges() const { return prefetched_ranges_; }
+
  protected:
   int FlushOnce() override;
   int GetVector(long vid, const DataType *&vec, bool &deletable) const override;
+  int GetPinnedVector(long vid, const DataType *&vec, bool &deletable,
+                      std::atomic<int> *&pin) const override;
   int DumpVectors(int dump_vid, int max_vid);
   int LoadVectors(int vec_num) override;
   int LoadUpdatedVectors();
+  int InitFetHeader();
+  int LoadChecksum(int vec_num);
+  int InitFlushBuffer();
+  int ResetFlushTail();
+  int WriteChunk(int num);
+  void WaitInflight();
+  bool IsSourceOnDisk() override { return !memory_only_; }
 
  private:
   VectorBufferQueue<DataType> *vector_buffer_queue_;
   VectorFileMapper<DataType> *vector_file_mapper_;
+  VectorCache<DataType> *hot_cache_;
   int max_buffer_size_;
   int buffer_chunk_num_;
   int flush_batch_size_;
   int flush_write_retry_;
   int init_vector_num_;
-  DataType *flush_batch_vectors_;
+  char *flush_buffer_;  // page aligned, [unaligned tail of file][vectors]
+  int direct_fd_;       // -1 if vectors are written through page cache
+  long tail_bytes_;     // bytes after the last aligned offset of file
+  // under writeback, only touched by the flusher thread
+  std::deque<std::pair<off_t, size_t>> inflight_ranges_;
+  double last_flush_time_;
+  double first_flush_time_;
+  std::atomic<long> flushed_bytes_;
+  std::atomic<long> flush_writes_;
+  std::atomic<long> flush_write_ms_;
+  mutable std::atomic<long> prefetched_ranges_;
   std::string fet_file_path_;
   std::string updated_fet_file_path_;
   int fet_fd_;
+  int fet_update_fd_;     // not appending, for updates in disk mode
+  long file_vector_num_;  // vectors written to fet file
+  long header_size_;      // 0 if fet file is written by an older version
+  uint64_t data_checksum_;  // of the vectors in fet file
+  bool checksum_valid_;
+  std::mutex flush_mutex_;  // updates in disk mode and flushing
   FILE *updated_fet_fp_;
   StoreParams *store_params_;
   int stored_num_;
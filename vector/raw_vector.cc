@@ -54,23 +54,30 @@ int RawVectorIO<DataType>::Init() {
 template <typename DataType>
 int RawVectorIO<DataType>::Dump(int start, int n) {
   if (raw_vector_->has_source_) {
-    char *str_mem_ptr = raw_vector_->str_mem_ptr_;
-    long *source_mem_pos = raw_vector_->source_mem_pos_.data();
-
-    // dump source
-    if (str_mem_ptr) {
-      write(src_fd_, (void *)(str_mem_ptr + source_mem_pos[start]),
-            source_mem_pos[start + n] - source_mem_pos[start]);
+    // sources are dumped continuously, the position file keeps the end
+    // position of each source and starts with 0
+    long pos = lseek(src_fd_, 0, SEEK_END);
+    std::vector<long> source_pos;
+    source_pos.reserve(n + 1);
+    if (start == 0) source_pos.push_back(0);
+    std::string buffer;
+    for (int vid = start; vid < start + n; vid++) {
+      char *str = nullptr;
+      int len = 0;
+      raw_vector_->source_store_->Get(vid, str, len);
+      if (len > 0) buffer.append(str, len);
+      pos += len;
+      source_pos.push_back(pos);
+      if (buffer.size() >= 1024 * 1024) {
+        write(src_fd_, (void *)buffer.data(), buffer.size());
+        buffer.clear();
+      }
     }
-
-    // dump source position
-    if (start == 0) {
-      write(src_pos_fd_, (void *)(source_mem_pos + start),
-            (n + 1) * sizeof(long));
-    } else {
-      write(src_pos_fd_, (void *)(source_mem_pos + start + 1),
-            n * sizeof(long));
+    if (buffer.size() > 0) {
+      write(src_fd_, (void *)buffer.data(), buffer.size());
     }
+    write(src_pos_fd_, (void *)source_pos.data(),
+          source_pos.size() * sizeof(long));
   }
 
   if (raw_vector_->vid_mgr_->multi_vids_) {
@@ -114,17 +121,18 @@ int RawVectorIO<DataType>::Load(int doc_num) {
     int num = docid_file_size / sizeof(int);
     read(docid_fd_, (void *)raw_vector_->vid_mgr_->vid2docid_.data(),
          num * sizeof(int));
-    // create docid2vid_ from vid2docid_
+    // create docid2vid_start_ from vid2docid_
     int vid = 0;
     for (; vid < num; vid++) {
       int docid = raw_vector_->vid_mgr_->vid2docid_[vid];
-      if (docid == -1) {
-        continue;
+      if (docid == -1 || docid >= doc_num) {
+        break;
       }
-      if (docid >= doc_num) {
+      if (raw_vector_->vid_mgr_->Add(vid, docid)) {
+        LOG(ERROR) << "load vector id error, vid=" << vid
+                   << ", docid=" << docid;
         break;
       }
-      raw_vector_->vid_mgr_->Add(vid, docid);
     }
     n = vid;
     // set [n, num) to be -1
@@ -140,11 +148,41 @@ int RawVectorIO<DataType>::Load(int doc_num) {
   }
 
   if (raw_vector_->has_source_) {
-    read(src_pos_fd_, (void *)raw_vector_->source_mem_pos_.data(),
-         (n + 1) * sizeof(long));
-    if (raw_vector_->source_mem_pos_[n] > 0) {
-      read(src_fd_, (void *)raw_vector_->str_mem_ptr_,
-           raw_vector_->source_mem_pos_[n]);
+    std::vector<long> source_pos(n + 1, 0);
+    read(src_pos_fd_, (void *)source_pos.data(), (n + 1) * sizeof(long));
+    // sources are read in chunks of kLoadChunkSize bytes at least, a chunk
+    // ends at a source end and is split by the positions
+    const long kLoadChunkSize = 4 * 1024 * 1024;
+    std::vector<char> chunk;
+    for (int begin = 0, end = 0; begin < n; begin = end) {
+      end = begin + 1;
+      while (end < n && source_pos[end] - source_pos[begin] < kLoadChunkSize) {
+        end++;
+      }
+      long chunk_size = source_pos[end] - source_pos[begin];
+      if (chunk_size <= 0) continue;
+      chunk.resize(chunk_size);
+      long done = 0;
+      while (done < chunk_size) {
+        ssize_t ret = pread(src_fd_, (void *)(chunk.data() + done),
+                            chunk_size - done, source_pos[begin] + done);
+        if (ret <= 0) break;
+        done += ret;
+      }
+      if (done != chunk_size) {
+        LOG(ERROR) << "read source error, vid=" << begin
+                   << ", size=" << chunk_size;
+        return -1;
+      }
+      for (int vid = begin; vid < end; vid++) {
+        int len = source_pos[vid + 1] - source_pos[vid];
+        if (len <= 0) continue;
+        const char *str = chunk.data() + source_pos[vid] - source_pos[begin];
+        if (raw_vector_->source_store_->Set(vid, str, len)) {
+          LOG(ERROR) << "load source error, vid=" << vid;
+          return -1;
+        }
+      }
     }
 
     // truncate str file to vid_num length
@@ -152,7 +190,7 @@ int RawVectorIO<DataType>::Load(int doc_num) {
       LOG(ERROR) << "truncate source position file error:" << strerror(errno);
       return -1;
     }
-    if (ftruncate(src_fd_, raw_vector_->source_mem_pos_[n])) {
+    if (ftruncate(src_fd_, source_pos[n])) {
       LOG(ERROR) << "truncate source file error:" << strerror(errno);
       return -1;
     }
@@ -171,28 +209,19 @@ RawVector<DataType>::RawVector(const string &name, int dimension,
       max_vector_size_(max_vector_size),
       root_path_(root_path),
       ntotal_(0),
-      total_mem_bytes_(0) {}
+      total_mem_bytes_(0),
+      source_store_(nullptr),
+      has_source_(false) {}
 
 template <typename DataType>
 RawVector<DataType>::~RawVector() {
-  CHECK_DELETE_ARRAY(str_mem_ptr_);
+  CHECK_DELETE(source_store_);
   CHECK_DELETE(updated_vids_);
   CHECK_DELETE(vid_mgr_);
 }
 
 template <typename DataType>
 int RawVector<DataType>::Init(bool has_source, bool multi_vids) {
-  // source
-  str_mem_ptr_ = nullptr;
-  if (has_source) {
-    uint64_t len = (uint64_t)max_vector_size_ * 100;
-    str_mem_ptr_ = new (std::nothrow) char[len];
-    total_mem_bytes_ += len;
-    source_mem_pos_.resize(max_vector_size_ + 1, 0);
-    total_mem_bytes_ += max_vector_size_ * sizeof(long);
-  }
-  has_source_ = has_source;
-
   // vid2docid
   vid_mgr_ = new VIDMgr(multi_vids);
   vid_mgr_->Init(max_vector_size_, total_mem_bytes_);
@@ -201,6 +230,17 @@ int RawVector<DataType>::Init(bool has_source, bool multi_vids) {
   updated_vids_ = new moodycamel::ConcurrentQueue<int>();
   int ret = InitStore();
   if (ret) return ret;
+
+  // source, segments are allocated when sources are added
+  if (has_source) {
+    string source_file_path =
+        IsSourceOnDisk() ? root_path_ + "/" + vector_name_ + ".src.map" : "";
+    source_store_ = new SourceStore(max_vector_size_, source_file_path);
+    ret = source_store_->Init();
+    if (ret) return ret;
+  }
+  has_source_ = has_source;
+
   LOG(INFO) << "raw vector init success! name=" << vector_name_
             << ", has source=" << has_source << ", multi_vids=" << multi_vids;
   return 0;
@@ -208,7 +248,7 @@ int RawVector<DataType>::Init(bool has_source, bool multi_vids) {
 
 template <typename DataType>
 int RawVector<DataType>::GetVector(long vid, ScopeVector<DataType> &vec) {
-  return GetVector(vid, vec.ptr_, vec.deletable_);
+  return GetPinnedVector(vid, vec.ptr_, vec.deletable_, vec.pin_);
 }
 
 template <typename DataType>
@@ -247,9 +287,10 @@ int RawVector<DataType>::Gets(int k, long *ids_list,
   bool deletable;
   for (int i = 0; i < k; i++) {
     const DataType *vec = nullptr;
+    std::atomic<int> *pin = nullptr;
     deletable = false;
-    GetVector(ids_list[i], vec, deletable);
-    vecs.Set(i, vec, deletable);
+    GetPinnedVector(ids_list[i], vec, deletable, pin);
+    vecs.Set(i, vec, deletable, pin);
   }
   return 0;
 }
@@ -262,9 +303,7 @@ int RawVector<DataType>::GetSource(int vid, char *&str, int &len) {
     len = 0;
     return 0;
   }
-  len = source_mem_pos_[vid + 1] - source_mem_pos_[vid];
-  str = str_mem_ptr_ + source_mem_pos_[vid];
-  return 0;
+  return source_store_->Get(vid, str, len);
 }
 
 template <typename DataType>
@@ -276,22 +315,27 @@ int RawVector<DataType>::Add(int docid, Field *&field) {
     LOG(ERROR) << "Doc [" << docid << "] len " << field->value->len << "]";
     return -1;
   }
-  AddToStore((DataType *)field->value->value,
-             field->value->len / sizeof(DataType));
 
   // add to source
   if (has_source_) {
     int len = field->source ? field->source->len : 0;
-    if (len > 0) {
-      memcpy(str_mem_ptr_ + source_mem_pos_[ntotal_], field->source->value,
-             len * sizeof(char));
-      source_mem_pos_[ntotal_ + 1] = source_mem_pos_[ntotal_] + len;
-    } else {
-      source_mem_pos_[ntotal_ + 1] = source_mem_pos_[ntotal_];
+    if (source_store_->Set(ntotal_, len > 0 ? field->source->value : nullptr,
+                           len)) {
+      LOG(ERROR) << "add source error, docid=" << docid;
+      return -1;
     }
   }
 
-  return vid_mgr_->Add(ntotal_++, docid);
+  // ntotal_ isn't increased if it fails, so vector ids stay continuous
+  if (vid_mgr_->Add(ntotal_, docid)) {
+    LOG(ERROR) << "add vector id error, docid=" << docid;
+    return -1;
+  }
+
+  AddToStore((DataType *)field->value->value,
+             field->value->len / sizeof(DataType));
+  ++ntotal_;
+  return 0;
 }
 
 template <typename DataType>
@@ -309,8 +353,14 @@ int RawVector<DataType>::Update(int docid, Field *&field) {
     LOG(ERROR) << "update to store error, docid=" << docid;
     return -1;
   }
+  // the space of the old source is reused by later sources
+  if (has_source_ && field->source) {
+    if (source_store_->Set(vid, field->source->value, field->source->len)) {
+      LOG(ERROR) << "update source error, docid=" << docid;
+      return -1;
+    }
+  }
   updated_vids_->enqueue(vid);
-  // TODO: update source
   return 0;
 }
 
@@ -319,6 +369,7 @@ AsyncFlusher::AsyncFlusher(string name) : name_(name) {
   last_nflushed_ = nflushed_ = 0;
   interval_ = 100;  // ms
   runner_ = nullptr;
+  flush_demand_ = 0;
 }
 
 AsyncFlusher::~AsyncFlusher() {
@@ -370,6 +421,11 @@ int AsyncFlusher::Flush() {
 }
 
 void AsyncFlusher::Until(int nexpect) {
+  // vectors which are waited for aren't held back for a larger write
+  long demand = flush_demand_;
+  while (demand < nexpect &&
+         !flush_demand_.compare_exchange_weak(demand, nexpect)) {
+  }
   while (nflushed_ < nexpect) {
     LOG(INFO) << "flusher waiting......, expected num=" << nexpect
               << ", flushed num=" << nflushed_;
@@ -394,13 +450,66 @@ int StoreParams::Parse(const char *str) {
     cache_size_ = (long)cache_size * 1024 * 1024;
   }
 
+  double hot_cache_size = 0;
+  if (!jp.GetDouble("hot_cache_size", hot_cache_size)) {
+    if (hot_cache_size > MAX_CACHE_SIZE || hot_cache_size < 0) {
+      LOG(ERROR) << "invalid hot cache size=" << hot_cache_size << "M"
+                 << ", limit size=" << MAX_CACHE_SIZE << "M";
+      return -1;
+    }
+    hot_cache_size_ = (long)(hot_cache_size * 1024 * 1024);
+  }
+
+  std::string precision;
+  if (!jp.GetString("precision", precision)) {
+    if (!strcasecmp("fp16", precision.c_str())) {
+      fp16_ = true;
+    } else if (!strcasecmp("fp32", precision.c_str())) {
+      fp16_ = false;
+    } else {
+      LOG(ERROR) << "invalid precision=" << precision
+                 << ", it should be fp32 or fp16";
+      return -1;
+    }
+  }
+
+  int verify_checksum = 0;
+  if (!jp.GetInt("verify_checksum", verify_checksum)) {
+    verify_checksum_ = verify_checksum != 0;
+  }
+
+  double flush_chunk_size = 0;
+  if (!jp.GetDouble("flush_chunk_size", flush_chunk_size)) {
+    if (flush_chunk_size <= 0 || flush_chunk_size > 1024) {
+      LOG(ERROR) << "invalid flush chunk size=" << flush_chunk_size << "M";
+      return -1;
+    }
+    flush_chunk_size_ = (long)(flush_chunk_size * 1024 * 1024);
+  }
+
+  int direct_io = 0;
+  if (!jp.GetInt("direct_io", direct_io)) {
+    direct_io_ = direct_io != 0;
+  }
+
+  int flush_inflight = 0;
+  if (!jp.GetInt("flush_inflight", flush_inflight)) {
+    if (flush_inflight < 1) {
+      LOG(ERROR) << "invalid flush inflight=" << flush_inflight;
+      return -1;
+    }
+    flush_inflight_ = flush_inflight;
+  }
+
   return 0;
 }
 
 template class RawVector<float>;
 template class RawVector<uint8_t>;
+template class RawVector<uint16_t>;
 
 template class RawVectorIO<float>;
 template class RawVectorIO<uint8_t>;
+template class RawVectorIO<uint16_t>;
 
 }  // namespace tig_gamma
@@ -8,6 +8,7 @@
 #ifndef RAW_VECTOR_H_
 #define RAW_VECTOR_H_
 
+#include <atomic>
 #include <sstream>
 #include <string>
 #include <thread>
@@ -15,6 +16,7 @@
 #include "concurrentqueue/concurrentqueue.h"
 #include "gamma_api.h"
 #include "raw_vector_common.h"
+#include "source_store.h"
 #include "utils.h"
 #include "log.h"
 
@@ -75,7 +77,7 @@ class RawVector {
    * Destroy()
    * @return 0 if successed
    */
-  int Gets(int k, long *ids_list, ScopeVectors<DataType> &vecs) const;
+  virtual int Gets(int k, long *ids_list, ScopeVectors<DataType> &vecs) const;
 
   /** get source of one vector, source is a string, for example the image url of
    * vector
@@ -101,8 +103,11 @@ class RawVector {
   virtual size_t GetStoreMemUsage() { return 0; }
 
   long GetTotalMemBytes() {
-    GetStoreMemUsage();
-    return total_mem_bytes_;
+    long total = total_mem_bytes_ + GetStoreMemUsage();
+    if (source_store_) {
+      return total + source_store_->GetTotalMemBytes();
+    }
+    return total;
   };
   int GetVectorNum() const { return ntotal_; };
   int GetMaxVectorSize() const { return max_vector_size_; }
@@ -128,9 +133,23 @@ class RawVector {
    */
   virtual int GetVector(long vid, const DataType *&vec,
                         bool &deletable) const = 0;
+  /** get vector by id like GetVector, the vector may be read in place and
+   * kept from being overwritten until pin is released
+   *
+   * @param pin(output) null if the vector isn't pinned
+   */
+  virtual int GetPinnedVector(long vid, const DataType *&vec, bool &deletable,
+                              std::atomic<int> *&pin) const {
+    pin = nullptr;
+    return GetVector(vid, vec, deletable);
+  }
   virtual int DumpVectors(int dump_vid, int n) { return 0; }
   virtual int LoadVectors(int vec_num) { return 0; }
   virtual int InitStore() = 0;
+  /** whether sources are mapped from disk instead of heap memory, it is
+   * called after InitStore()
+   */
+  virtual bool IsSourceOnDisk() { return false; }
 
  protected:
   friend RawVectorIO<DataType>;
@@ -141,8 +160,7 @@ class RawVector {
   int vector_byte_size_;
   int ntotal_;                        // vector num
   long total_mem_bytes_;              // total used memory bytes
-  char *str_mem_ptr_;                 // source memory
-  std::vector<long> source_mem_pos_;  // position of each source
+  SourceStore *source_store_;         // null if it has no source
   bool has_source_;
 };
 
@@ -182,6 +200,7 @@ class AsyncFlusher {
   long nflushed_;
   long last_nflushed_;
   int interval_;
+  std::atomic<long> flush_demand_;  // the number waited for by Until
 };
 
 template <typename DataType>
@@ -204,16 +223,42 @@ void StopFlushingIfNeed(RawVector<DataType> *vec) {
 }
 
 struct StoreParams {
-  long cache_size_;  // bytes
-
-  StoreParams() { cache_size_ = -1; }
+  long cache_size_;        // bytes
+  long hot_cache_size_;    // bytes of hot vectors cached in disk mode
+  bool fp16_;              // store float vectors in half precision
+  bool verify_checksum_;   // verify vector file checksum at load
+  long flush_chunk_size_;  // bytes written to vector file at once
+  bool direct_io_;         // write vector file with O_DIRECT
+  int flush_inflight_;     // chunks under writeback without O_DIRECT
+
+  StoreParams() {
+    cache_size_ = -1;
+    hot_cache_size_ = 0;
+    fp16_ = false;
+    verify_checksum_ = false;
+    flush_chunk_size_ = 4 * 1024 * 1024;
+    direct_io_ = false;
+    flush_inflight_ = 4;
+  }
   StoreParams(const StoreParams &other) {
     this->cache_size_ = other.cache_size_;
+    this->hot_cache_size_ = other.hot_cache_size_;
+    this->fp16_ = other.fp16_;
+    this->verify_checksum_ = other.verify_checksum_;
+    this->flush_chunk_size_ = other.flush_chunk_size_;
+    this->direct_io_ = other.direct_io_;
+    this->flush_inflight_ = other.flush_inflight_;
   }
   int Parse(const char *str);
   std::string ToString() {
     std::stringstream ss;
-    ss << "{cache size=" << cache_size_ << "}";
+    ss << "{cache size=" << cache_size_
+       << ", hot cache size=" << hot_cache_size_
+       << ", precision=" << (fp16_ ? "fp16" : "fp32")
+       << ", verify checksum=" << verify_checksum_
+       << ", flush chunk size=" << flush_chunk_size_
+       << ", direct io=" << direct_io_
+       << ", flush inflight=" << flush_inflight_ << "}";
     return ss.str();
   }
 };
@@ -2,6 +2,9 @@
 #define RAW_VECTOR_COMMON_H_
 
 #include <string.h>
+#include <atomic>
+#include <vector>
+#include "log.h"
 #include "utils.h"
 
 const static int MAX_VECTOR_NUM_PER_DOC = 10;
@@ -11,15 +14,22 @@ template <typename DataType>
 struct ScopeVector {
   const DataType *ptr_;
   bool deletable_;
-
-  explicit ScopeVector(const DataType *ptr = nullptr) : ptr_(ptr) {}
-  void Set(const DataType *ptr_in, bool deletable = true) {
+  // released if ptr_ is read in place from a buffer, so the raw vector must
+  // outlive it
+  std::atomic<int> *pin_;
+
+  explicit ScopeVector(const DataType *ptr = nullptr)
+      : ptr_(ptr), pin_(nullptr) {}
+  void Set(const DataType *ptr_in, bool deletable = true,
+           std::atomic<int> *pin = nullptr) {
     ptr_ = ptr_in;
     deletable_ = deletable;
+    pin_ = pin;
   }
   const DataType *Get() { return ptr_; }
   ~ScopeVector() {
     if (deletable_ && ptr_) delete[] ptr_;
+    if (pin_) pin_->fetch_sub(1);
   }
 };
 
@@ -28,72 +38,77 @@ struct ScopeVectors {
   const DataType **ptr_;
   int size_;
   bool *deletable_;
+  std::atomic<int> **pins_;
 
   explicit ScopeVectors(int size) : size_(size) {
     ptr_ = new const DataType *[size_];
     deletable_ = new bool[size_];
+    pins_ = new std::atomic<int> *[size_]();
   }
-  void Set(int idx, const DataType *ptr_in, bool deletable = true) {
+  void Set(int idx, const DataType *ptr_in, bool deletable = true,
+           std::atomic<int> *pin = nullptr) {
     ptr_[idx] = ptr_in;
     deletable_[idx] = deletable;
+    pins_[idx] = pin;
   }
   const DataType **Get() { return ptr_; }
   const DataType *Get(int idx) { return ptr_[idx]; }
   ~ScopeVectors() {
     for (int i = 0; i < size_; i++) {
       if (deletable_[i] && ptr_[i]) delete[] ptr_[i];
+      if (pins_[i]) pins_[i]->fetch_sub(1);
     }
+    delete[] pins_;
     delete[] deletable_;
     delete[] ptr_;
   }
 };
 
+/** mapping between doc id and vector id.
+ * It is identity if one doc has only one vector. Otherwise the vectors of one
+ * doc are added together and their ids are continuous, so docid2vid_start_
+ * keeps the first vector id of each doc (CSR offsets), the vector ids of doc
+ * are [docid2vid_start_[docid], docid2vid_start_[docid + 1]).
+ */
 struct VIDMgr {
-  std::vector<int> vid2docid_;    // vector id to doc id
-  std::vector<int *> docid2vid_;  // doc id to vector id list
+  std::vector<int> vid2docid_;        // vector id to doc id
+  std::vector<int> docid2vid_start_;  // doc id to its first vector id
+  int max_docid_;                     // max doc id which has vectors
   bool multi_vids_;
 
-  VIDMgr(bool multi_vids) : multi_vids_(multi_vids) {}
-
-  ~VIDMgr() {
-    if (multi_vids_) {
-      for (size_t i = 0; i < docid2vid_.size(); i++) {
-        if (docid2vid_[i] != nullptr) {
-          delete[] docid2vid_[i];
-          docid2vid_[i] = nullptr;
-        }
-      }
-    }
-  }
+  VIDMgr(bool multi_vids) : max_docid_(-1), multi_vids_(multi_vids) {}
 
   int Init(int max_vector_size, long &total_mem_bytes) {
     if (multi_vids_) {
       vid2docid_.resize(max_vector_size, -1);
       total_mem_bytes += max_vector_size * sizeof(int);
-      docid2vid_.resize(max_vector_size, nullptr);
-      total_mem_bytes += max_vector_size * sizeof(docid2vid_[0]);
+      docid2vid_start_.resize(max_vector_size + 1, 0);
+      total_mem_bytes += (max_vector_size + 1) * sizeof(int);
     }
     return 0;
   }
 
   int Add(int vid, int docid) {
-    // add to vid2docid_ and docid2vid_
+    // add to vid2docid_ and docid2vid_start_
     if (multi_vids_) {
-      vid2docid_[vid] = docid;
-      if (docid2vid_[docid] == nullptr) {
-        docid2vid_[docid] =
-            utils::NewArray<int>(MAX_VECTOR_NUM_PER_DOC + 1, "init_vid_list");
-        // total_mem_bytes += (MAX_VECTOR_NUM_PER_DOC + 1) * sizeof(int);
-        docid2vid_[docid][0] = 1;
-        docid2vid_[docid][1] = vid;
-      } else {
-        int *vid_list = docid2vid_[docid];
-        if (vid_list[0] + 1 > MAX_VECTOR_NUM_PER_DOC) {
-          return -1;
-        }
-        vid_list[vid_list[0]] = vid;
-        vid_list[0]++;
+      if (docid < max_docid_ || docid + 1 >= (int)docid2vid_start_.size()) {
+        LOG(ERROR) << "invalid docid=" << docid << ", vid=" << vid
+                   << ", max docid=" << max_docid_;
+        return -1;
+      }
+      int next_vid = docid2vid_start_[max_docid_ + 1];
+      if (vid != next_vid) {
+        LOG(ERROR) << "vector ids aren't continuous, docid=" << docid
+                   << ", vid=" << vid << ", expected vid=" << next_vid;
+        return -1;
       }
+      // docs without vector have empty ranges
+      for (int i = max_docid_ + 2; i <= docid; i++) {
+        docid2vid_start_[i] = next_vid;
+      }
+      vid2docid_[vid] = docid;
+      docid2vid_start_[docid + 1] = vid + 1;
+      max_docid_ = docid;
     }
     return 0;
   }
@@ -103,34 +118,50 @@ struct VIDMgr {
     return vid2docid_[vid];
   }
 
-  inline void DocID2VID(int docid, std::vector<int> &vids) {
+  /** get the vector id range of doc
+   *
+   * @param start(output) the first vector id
+   * @return the number of vectors of doc
+   */
+  inline int GetVIDRange(int docid, int &start) {
     if (!multi_vids_) {
-      vids.resize(1);
-      vids[0] = docid;
-      return;
+      start = docid;
+      return 1;
+    }
+    if (docid < 0 || docid > max_docid_) {
+      start = -1;
+      return 0;
+    }
+    start = docid2vid_start_[docid];
+    return docid2vid_start_[docid + 1] - start;
+  }
+
+  inline void DocID2VID(int docid, std::vector<int> &vids) {
+    int start = -1;
+    int num = GetVIDRange(docid, start);
+    vids.resize(num);
+    for (int i = 0; i < num; i++) {
+      vids[i] = start + i;
     }
-    int *vid_list = docid2vid_[docid];
-    vids.resize(vid_list[0]);
-    memcpy((void *)vids.data(), (void *)(vid_list + 1), vid_list[0] * sizeof(int));
-    return;
   }
 
   inline int GetFirstVID(int docid) {
     if (!multi_vids_) {
       return docid;
     }
-    int *vid_list = docid2vid_[docid];
-    if (vid_list[0] <= 0) return -1;
-    return vid_list[1];
+    int start = -1;
+    if (GetVIDRange(docid, start) <= 0) return -1;
+    return start;
   }
 
   inline int GetLastVID(int docid) {
     if (!multi_vids_) {
       return docid;
     }
-    int *vid_list = docid2vid_[docid];
-    if (vid_list[0] <= 0) return -1;
-    return vid_list[vid_list[0]];
+    int start = -1;
+    int num = GetVIDRange(docid, start);
+    if (num <= 0) return -1;
+    return start + num - 1;
   }
 };
 
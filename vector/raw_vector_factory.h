@@ -8,6 +8,7 @@
 #ifndef RAW_VECTOR_FACTORY_H_
 #define RAW_VECTOR_FACTORY_H_
 
+#include "float16_raw_vector.h"
 #include "mmap_raw_vector.h"
 #include "raw_vector.h"
 
@@ -30,11 +31,20 @@ class RawVectorFactory {
     StoreParams store_params;
     if (store_param != "" && store_params.Parse(store_param.c_str()))
       return nullptr;
+    size_t value_size = store_params.fp16_ ? sizeof(uint16_t) : sizeof(float);
     if (store_params.cache_size_ == -1)
-      store_params.cache_size_ = (long)max_doc_size * dimension * sizeof(float);
+      store_params.cache_size_ = (long)max_doc_size * dimension * value_size;
     LOG(INFO) << "store parameters=" << store_params.ToString();
+    if (store_params.fp16_ && type != Mmap) {
+      LOG(ERROR) << "fp16 precision is only supported by Mmap store";
+      return nullptr;
+    }
     switch (type) {
       case Mmap:
+        if (store_params.fp16_) {
+          return (RawVector<float> *)new Float16RawVector(
+              name, dimension, max_doc_size, root_path, store_params);
+        }
         return (RawVector<float> *)new MmapRawVector<float>(
             name, dimension, max_doc_size, root_path, store_params);
 #ifdef WITH_ROCKSDB
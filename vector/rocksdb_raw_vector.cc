@@ -10,6 +10,7 @@
 #include "rocksdb_raw_vector.h"
 #include <stdio.h>
 #include "log.h"
+#include "rocksdb/filter_policy.h"
 #include "rocksdb/table.h"
 #include "utils.h"
 
@@ -44,6 +45,10 @@ int RocksDBRawVector<DataType>::InitStore() {
   std::shared_ptr<Cache> cache = NewLRUCache(block_cache_size_);
   // BlockBasedTableOptions table_options_;
   table_options_.block_cache = cache;
+  // point lookups of rerank skip the files which don't have the key
+  table_options_.filter_policy.reset(NewBloomFilterPolicy(10, false));
+  table_options_.cache_index_and_filter_blocks = true;
+  table_options_.pin_l0_filter_and_index_blocks_in_cache = true;
   Options options;
   options.table_factory.reset(NewBlockBasedTableFactory(table_options_));
 
@@ -75,21 +80,63 @@ int RocksDBRawVector<DataType>::GetVector(long vid, const DataType *&vec,
   if (vid >= this->ntotal_ || vid < 0) {
     return 1;
   }
-  string key, value;
+  string key;
   ToRowKey((int)vid, key);
-  Status s = db_->Get(ReadOptions(), Slice(key), &value);
+  PinnableSlice value;
+  Status s =
+      db_->Get(ReadOptions(), db_->DefaultColumnFamily(), Slice(key), &value);
   if (!s.ok()) {
     LOG(ERROR) << "rocksdb get error:" << s.ToString() << ", key=" << key;
     return 2;
   }
+  if (value.size() != (size_t)this->vector_byte_size_) {
+    LOG(ERROR) << "invalid value size=" << value.size() << ", key=" << key;
+    return 3;
+  }
   DataType *vector = new DataType[this->dimension_];
-  assert((size_t)this->vector_byte_size_ == value.size());
   memcpy((void *)vector, value.data(), this->vector_byte_size_);
   vec = vector;
   deletable = true;
   return 0;
 }
 
+template <typename DataType>
+int RocksDBRawVector<DataType>::Gets(int k, long *ids_list,
+                                     ScopeVectors<DataType> &vecs) const {
+  std::vector<string> keys;
+  std::vector<int> idx;  // position in ids_list of each key
+  keys.reserve(k);
+  idx.reserve(k);
+  for (int i = 0; i < k; i++) {
+    vecs.Set(i, nullptr, false);
+    if (ids_list[i] < 0 || ids_list[i] >= this->ntotal_) continue;
+    string key;
+    ToRowKey((int)ids_list[i], key);
+    keys.push_back(std::move(key));
+    idx.push_back(i);
+  }
+  if (keys.size() == 0) return 0;
+
+  std::vector<Slice> key_slices(keys.begin(), keys.end());
+  std::vector<string> values;
+  std::vector<Status> status =
+      db_->MultiGet(ReadOptions(), key_slices, &values);
+  int ret = 0;
+  for (size_t i = 0; i < keys.size(); i++) {
+    if (!status[i].ok() ||
+        values[i].size() != (size_t)this->vector_byte_size_) {
+      LOG(ERROR) << "rocksdb multi get error:" << status[i].ToString()
+                 << ", key=" << keys[i];
+      ret = 2;
+      continue;
+    }
+    DataType *vector = new DataType[this->dimension_];
+    memcpy((void *)vector, values[i].data(), this->vector_byte_size_);
+    vecs.Set(idx[i], vector, true);
+  }
+  return ret;
+}
+
 template <typename DataType>
 int RocksDBRawVector<DataType>::AddToStore(DataType *v, int len) {
   return UpdateToStore(this->ntotal_, v, len);
@@ -98,16 +145,17 @@ int RocksDBRawVector<DataType>::AddToStore(DataType *v, int len) {
 template <typename DataType>
 size_t RocksDBRawVector<DataType>::GetStoreMemUsage() {
   size_t cache_mem = table_options_.block_cache->GetUsage();
-  std::string index_mem;
-  db_->GetProperty("rocksdb.estimate-table-readers-mem", &index_mem);
-  std::string memtable_mem;
-  db_->GetProperty("rocksdb.cur-size-all-mem-tables", &memtable_mem);
-  size_t pin_mem = table_options_.block_cache->GetPinnedUsage();
+  uint64_t index_mem = 0;
+  db_->GetIntProperty("rocksdb.estimate-table-readers-mem", &index_mem);
+  uint64_t memtable_mem = 0;
+  db_->GetIntProperty("rocksdb.cur-size-all-mem-tables", &memtable_mem);
+#ifdef DEBUG
   LOG(INFO) << "rocksdb mem usage: block cache=" << cache_mem
             << ", index and filter=" << index_mem
-            << ", memtable=" << memtable_mem
-            << ", iterators pinned=" << pin_mem;
-  return 0;
+            << ", memtable=" << memtable_mem << ", iterators pinned="
+            << table_options_.block_cache->GetPinnedUsage();
+#endif
+  return cache_mem + index_mem + memtable_mem;
 }
 
 template <typename DataType>
@@ -130,10 +178,16 @@ int RocksDBRawVector<DataType>::GetVectorHeader(int start, int end, ScopeVector<
     return 1;
   }
 
-  rocksdb::Iterator *it = db_->NewIterator(rocksdb::ReadOptions());
   string start_key, end_key;
   ToRowKey(start, start_key);
   ToRowKey(end, end_key);
+  // a sequential scan, it reads ahead and doesn't evict the rerank blocks
+  Slice upper_bound(end_key);
+  rocksdb::ReadOptions read_options;
+  read_options.fill_cache = false;
+  read_options.readahead_size = 2 * 1024 * 1024;
+  read_options.iterate_upper_bound = &upper_bound;
+  rocksdb::Iterator *it = db_->NewIterator(read_options);
   it->Seek(Slice(start_key));
   int num = end - start;
   DataType *vectors = new DataType[(uint64_t)this->dimension_ * num];
@@ -141,10 +195,16 @@ int RocksDBRawVector<DataType>::GetVectorHeader(int start, int end, ScopeVector<
     if (!it->Valid()) {
       LOG(ERROR) << "rocksdb iterator error, count=" << c;
       delete it;
+      delete[] vectors;
       return 2;
     }
     Slice value = it->value();
-    assert(value.size_ == (size_t)this->vector_byte_size_);
+    if (value.size() != (size_t)this->vector_byte_size_) {
+      LOG(ERROR) << "invalid value size=" << value.size() << ", vid=" << c;
+      delete it;
+      delete[] vectors;
+      return 3;
+    }
     memcpy((void *)(vectors + (uint64_t)c * this->dimension_), value.data_,
            this->vector_byte_size_);
 #ifdef DEBUG
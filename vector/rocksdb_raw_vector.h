@@ -32,7 +32,11 @@ class RocksDBRawVector : public RawVector<DataType> {
   int GetVectorHeader(int start, int end, ScopeVector<DataType> &vec) override;
   int UpdateToStore(int vid, DataType *v, int len);
 
-  size_t GetStoreMemUsage();
+  /** vectors are read by one MultiGet, the invalid ids get null
+   */
+  int Gets(int k, long *ids_list, ScopeVectors<DataType> &vecs) const override;
+
+  size_t GetStoreMemUsage() override;
 
  protected:
   int GetVector(long vid, const DataType *&vec, bool &deletable) const override;
@@ -0,0 +1,231 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "source_store.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <iterator>
+#include "log.h"
+#include "utils.h"
+
+namespace tig_gamma {
+
+static const int kMaxSegmentNum = 65536;
+
+SourceStore::SourceStore(int max_num, const std::string &file_path,
+                         long segment_size, int reuse_delay)
+    : max_num_(max_num), file_path_(file_path) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  // mmap offsets must be page aligned
+  segment_size_ = (segment_size + page_size - 1) / page_size * page_size;
+  max_segment_num_ = kMaxSegmentNum;
+  segments_ = nullptr;
+  segment_num_ = 0;
+  append_pos_ = 0;
+  free_bytes_ = 0;
+  reuse_delay_ = reuse_delay;
+  retired_bytes_ = 0;
+  fd_ = -1;
+}
+
+SourceStore::~SourceStore() {
+  if (segments_) {
+    for (int i = 0; i < segment_num_; i++) {
+      if (fd_ != -1) {
+        munmap(segments_[i], segment_size_);
+      } else {
+        delete[] segments_[i];
+      }
+    }
+    delete[] segments_;
+    segments_ = nullptr;
+  }
+  if (fd_ != -1) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+int SourceStore::Init() {
+  // the segment table is never reallocated, readers need no lock
+  segments_ = new (std::nothrow) char *[max_segment_num_];
+  if (segments_ == nullptr) {
+    LOG(ERROR) << "alloc source segments error";
+    return -1;
+  }
+  memset(segments_, 0, sizeof(char *) * max_segment_num_);
+  pos_.resize(max_num_, -1);
+
+  if (file_path_ != "") {
+    fd_ = open(file_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 00664);
+    if (fd_ == -1) {
+      LOG(ERROR) << "open source file error, path=" << file_path_
+                 << ", error:" << strerror(errno);
+      return -1;
+    }
+  }
+  LOG(INFO) << "init source store success! segment size=" << segment_size_
+            << ", file path=" << file_path_;
+  return 0;
+}
+
+int SourceStore::AddSegment() {
+  if (segment_num_ >= max_segment_num_) {
+    LOG(ERROR) << "source segment number exceeds " << max_segment_num_;
+    return -1;
+  }
+  char *segment = nullptr;
+  if (fd_ != -1) {
+    off_t offset = (off_t)segment_num_ * segment_size_;
+    if (ftruncate(fd_, offset + segment_size_)) {
+      LOG(ERROR) << "truncate source file error:" << strerror(errno);
+      return -1;
+    }
+    void *buf = mmap(NULL, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd_, offset);
+    if (buf == MAP_FAILED) {
+      LOG(ERROR) << "mmap source segment error:" << strerror(errno);
+      return -1;
+    }
+    segment = (char *)buf;
+  } else {
+    segment = new (std::nothrow) char[segment_size_];
+    if (segment == nullptr) {
+      LOG(ERROR) << "alloc source segment error, size=" << segment_size_;
+      return -1;
+    }
+  }
+  segments_[segment_num_] = segment;
+  ++segment_num_;
+  return 0;
+}
+
+long SourceStore::Alloc(long size) {
+  if (!retired_.empty()) Reclaim();
+  // best fit, the rest of the block stays free
+  auto it = free_by_size_.lower_bound(std::make_pair(size, -1L));
+  if (it != free_by_size_.end()) {
+    long block_size = it->first, offset = it->second;
+    free_by_size_.erase(it);
+    free_blocks_.erase(offset);
+    free_bytes_ -= block_size;
+    if (block_size > size) Free(offset + size, block_size - size);
+    return offset;
+  }
+  if (size > segment_size_) {
+    LOG(ERROR) << "source size=" << size
+               << " is larger than segment size=" << segment_size_;
+    return -1;
+  }
+  long remain = segment_size_ - append_pos_ % segment_size_;
+  if (size > remain) {
+    // a source never crosses segments, keep the tail for smaller ones
+    Free(append_pos_, remain);
+    append_pos_ += remain;
+  }
+  if (append_pos_ / segment_size_ >= segment_num_) {
+    if (AddSegment()) return -1;
+  }
+  long offset = append_pos_;
+  append_pos_ += size;
+  return offset;
+}
+
+void SourceStore::Free(long offset, long size) {
+  if (size < AlignedSize(0)) return;
+  free_bytes_ += size;
+  // merge with the free neighbours, a block never crosses segments
+  auto next = free_blocks_.lower_bound(offset);
+  if (next != free_blocks_.end() && next->first == offset + size &&
+      next->first % segment_size_ != 0) {
+    size += next->second;
+    free_by_size_.erase(std::make_pair(next->second, next->first));
+    next = free_blocks_.erase(next);
+  }
+  if (next != free_blocks_.begin() && offset % segment_size_ != 0) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      free_by_size_.erase(std::make_pair(prev->second, prev->first));
+      offset = prev->first;
+      size += prev->second;
+      free_blocks_.erase(prev);
+    }
+  }
+  free_blocks_[offset] = size;
+  free_by_size_.insert(std::make_pair(size, offset));
+}
+
+void SourceStore::Retire(long offset, long size) {
+  if (size < AlignedSize(0)) return;
+  RetiredSpace space;
+  space.time = utils::getmillisecs();
+  space.offset = offset;
+  space.size = size;
+  retired_.push_back(space);
+  retired_bytes_ += size;
+}
+
+void SourceStore::Reclaim() {
+  double now = utils::getmillisecs();
+  while (!retired_.empty() && now - retired_.front().time >= reuse_delay_) {
+    const RetiredSpace &space = retired_.front();
+    Free(space.offset, space.size);
+    retired_bytes_ -= space.size;
+    retired_.pop_front();
+  }
+}
+
+int SourceStore::Set(int id, const char *str, int len) {
+  if (id < 0 || id >= max_num_ || len < 0) return -1;
+  long old_pos = pos_[id];
+  if (len == 0) {
+    pos_[id] = -1;
+  } else {
+    long size = AlignedSize(len);
+    long offset = Alloc(size);
+    if (offset < 0) return -1;
+    char *p = segments_[offset / segment_size_] + offset % segment_size_;
+    memcpy(p, &len, sizeof(int));
+    memcpy(p + sizeof(int), str, len);
+    pos_[id] = offset;
+  }
+  if (old_pos >= 0) {
+    char *p = segments_[old_pos / segment_size_] + old_pos % segment_size_;
+    int old_len = 0;
+    memcpy(&old_len, p, sizeof(int));
+    // it may still be copied by a reader which got it before
+    Retire(old_pos, AlignedSize(old_len));
+  }
+  return 0;
+}
+
+int SourceStore::Get(int id, char *&str, int &len) const {
+  if (id < 0 || id >= max_num_) return -1;
+  long offset = pos_[id];
+  if (offset < 0) {
+    str = nullptr;
+    len = 0;
+    return 0;
+  }
+  char *p = segments_[offset / segment_size_] + offset % segment_size_;
+  memcpy(&len, p, sizeof(int));
+  str = p + sizeof(int);
+  return 0;
+}
+
+long SourceStore::GetTotalMemBytes() const {
+  long bytes = (long)max_num_ * sizeof(long);
+  if (fd_ == -1) bytes += (long)segment_num_ * segment_size_;
+  return bytes;
+}
+
+}  // namespace tig_gamma
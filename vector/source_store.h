@@ -0,0 +1,105 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef SOURCE_STORE_H_
+#define SOURCE_STORE_H_
+
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace tig_gamma {
+
+/** storage of the sources of raw vectors.
+ * Sources are kept in fixed size segments which are allocated when they are
+ * needed, a segment is never moved so the returned pointers are stable.
+ * Each source is stored as [int len][bytes] in 8 bytes aligned blocks, the
+ * block of an overwritten source is freed and merged with its free
+ * neighbours in the same segment. A new source takes the smallest free
+ * block which fits, the rest of the block is freed again. Readers copy
+ * sources out of the returned pointers without lock, so the space is only
+ * reused reuse_delay ms after it is overwritten, like the old buckets of
+ * realtime index are freed.
+ * If file path is set, segments are mapped from that file instead of heap
+ * memory, the file is a scratch file which is truncated at initialization.
+ */
+class SourceStore {
+ public:
+  SourceStore(int max_num, const std::string &file_path = "",
+              long segment_size = kDefaultSegmentSize,
+              int reuse_delay = kDefaultReuseDelay);
+  ~SourceStore();
+
+  int Init();
+
+  /** set the source of id, it can be added or overwritten
+   *
+   * @param id vector id, less than max_num
+   * @param str source, it can be null if len is 0
+   * @param len length of source
+   * @return 0 if successed
+   */
+  int Set(int id, const char *str, int len);
+
+  /** get the source of id, str is null if it has no source
+   *
+   * @return 0 if successed
+   */
+  int Get(int id, char *&str, int &len) const;
+
+  long GetTotalMemBytes() const;
+
+  /** bytes which can be reused now */
+  long GetFreeBytes() const { return free_bytes_; }
+
+  /** bytes of overwritten sources which wait for reuse_delay */
+  long GetRetiredBytes() const { return retired_bytes_; }
+
+  int GetSegmentNum() const { return segment_num_; }
+
+  static const long kDefaultSegmentSize = 64 * 1024 * 1024;
+  static const int kDefaultReuseDelay = 1000;  // ms
+
+ private:
+  struct RetiredSpace {
+    double time;  // ms, when it is overwritten
+    long offset;
+    long size;
+  };
+
+  long Alloc(long size);
+  void Free(long offset, long size);
+  void Retire(long offset, long size);
+  void Reclaim();
+  int AddSegment();
+
+  static long AlignedSize(int len) {
+    return ((long)sizeof(int) + len + 7) & ~7L;
+  }
+
+  int max_num_;
+  std::string file_path_;
+  long segment_size_;
+  int max_segment_num_;
+  char **segments_;
+  int segment_num_;
+  long append_pos_;                // global offset of next new source
+  std::vector<long> pos_;          // global offset of each source, -1 if none
+  std::map<long, long> free_blocks_;              // offset -> size
+  std::set<std::pair<long, long>> free_by_size_;  // (size, offset)
+  long free_bytes_;
+  int reuse_delay_;                   // ms
+  std::deque<RetiredSpace> retired_;  // in the order of time
+  long retired_bytes_;
+  int fd_;
+};
+
+}  // namespace tig_gamma
+
+#endif  // SOURCE_STORE_H_
@@ -8,11 +8,15 @@
 #include "vector_buffer_queue.h"
 #include <stdio.h>
 #include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <cassert>
 #include <iostream>
 #include <stdexcept>
+#include <thread>
 #include "log.h"
+#include "memory_policy.h"
 #include "thread_util.h"
 #include "utils.h"
 
@@ -28,12 +32,17 @@ VectorBufferQueue<DataType>::VectorBufferQueue(int max_vector_size,
   push_index_ = 0;
   total_mem_bytes_ = 0;
   stored_num_ = 0;
+  buffer_ = nullptr;
+  shared_mutexes_ = nullptr;
+  chunk_epochs_ = nullptr;
+  chunk_pins_ = nullptr;
+  safe_window_ = 0;
 }
 
 template <typename DataType>
 VectorBufferQueue<DataType>::~VectorBufferQueue() {
   if (buffer_ != NULL) {
-    free(buffer_);
+    utils::FreeLarge(buffer_, (size_t)max_vector_size_ * vector_byte_size_);
     buffer_ = nullptr;
   }
   if (shared_mutexes_ != nullptr) {
@@ -46,6 +55,14 @@ VectorBufferQueue<DataType>::~VectorBufferQueue() {
     delete[] shared_mutexes_;
     shared_mutexes_ = nullptr;
   }
+  if (chunk_epochs_ != nullptr) {
+    delete[] chunk_epochs_;
+    chunk_epochs_ = nullptr;
+  }
+  if (chunk_pins_ != nullptr) {
+    delete[] chunk_pins_;
+    chunk_pins_ = nullptr;
+  }
 }
 
 template <typename DataType>
@@ -61,7 +78,8 @@ int VectorBufferQueue<DataType>::Init() {
   chunk_size_ = max_vector_size_ / chunk_num_;
 
   vector_byte_size_ = sizeof(DataType) * dimension_;
-  buffer_ = (DataType *)malloc((size_t)max_vector_size_ * vector_byte_size_);
+  buffer_ = (DataType *)utils::AllocLarge(
+      (size_t)max_vector_size_ * vector_byte_size_, "vector buffer");
   if (buffer_ == NULL) {
     cerr << "malloc buffer failed" << endl;
     return 2;
@@ -76,6 +94,15 @@ int VectorBufferQueue<DataType>::Init() {
       return 2;
     }
   }
+  chunk_epochs_ = new std::atomic<std::uint64_t>[chunk_num_];
+  chunk_pins_ = new std::atomic<int>[chunk_num_];
+  for (int i = 0; i < chunk_num_; i++) {
+    chunk_epochs_[i] = 0;
+    chunk_pins_[i] = 0;
+  }
+  // an eighth of buffer, at least one chunk
+  safe_window_ = max_vector_size_ / 8 > chunk_size_ ? max_vector_size_ / 8
+                                                     : chunk_size_;
   LOG(INFO) << "vector buffer queue init success! buffer byte size="
             << (long)max_vector_size_ * vector_byte_size_
             << ", buffer vector size=" << max_vector_size_
@@ -92,6 +119,10 @@ int VectorBufferQueue<DataType>::Push(const DataType *v, int dim, int timeout) {
     return 3;  // timeout
   }
   int chunk_id = push_index_ / chunk_size_ % chunk_num_;
+  if (push_index_ >= (uint64_t)max_vector_size_ &&
+      push_index_ % chunk_size_ == 0) {
+    WaitForPins(chunk_id);
+  }
   WriteThreadLock write_lock(shared_mutexes_[chunk_id]);
 
   memcpy((void *)(buffer_ + push_index_ % max_vector_size_ * dimension_),
@@ -113,6 +144,9 @@ int VectorBufferQueue<DataType>::Push(const DataType *v, int dim, int num,
     int offset = push_index_ % chunk_size_;
     int batch_size = offset + num > chunk_size_ ? chunk_size_ - offset : num;
     int chunk_id = push_index_ / chunk_size_ % chunk_num_;
+    if (push_index_ >= (uint64_t)max_vector_size_ && offset == 0) {
+      WaitForPins(chunk_id);
+    }
     WriteThreadLock *write_lock =
         new WriteThreadLock(shared_mutexes_[chunk_id]);
     memcpy((void *)(buffer_ + push_index_ % max_vector_size_ * dimension_),
@@ -180,6 +214,32 @@ int VectorBufferQueue<DataType>::GetVector(int id, DataType *v, int dim) {
   return 0;
 }
 
+template <typename DataType>
+const DataType *VectorBufferQueue<DataType>::GetVectorRef(
+    int id, std::atomic<int> *&pin) {
+  uint64_t push_index = push_index_;
+  if (id < 0 || (uint64_t)id >= push_index ||
+      (uint64_t)id + max_vector_size_ < push_index + safe_window_) {
+    return nullptr;
+  }
+  int chunk_id = id / chunk_size_ % chunk_num_;
+  chunk_pins_[chunk_id]++;
+  // the chunk started to be overwritten after the position is checked
+  if (chunk_epochs_[chunk_id] != (uint64_t)id / max_vector_size_) {
+    chunk_pins_[chunk_id]--;
+    return nullptr;
+  }
+  pin = &chunk_pins_[chunk_id];
+  return buffer_ + (long)id % max_vector_size_ * dimension_;
+}
+
+template <typename DataType>
+bool VectorBufferQueue<DataType>::Contains(int id) const {
+  uint64_t push_index = push_index_;
+  return id >= 0 && (uint64_t)id < push_index &&
+         push_index - id <= (uint64_t)max_vector_size_;
+}
+
 template <typename DataType>
 int VectorBufferQueue<DataType>::GetVectorHead(int id, DataType **vec_head,
                                                int dim) {
@@ -189,10 +249,50 @@ int VectorBufferQueue<DataType>::GetVectorHead(int id, DataType **vec_head,
   return 0;
 }
 
+template <typename DataType>
+int VectorBufferQueue<DataType>::MapFile(const std::string &path, long offset,
+                                         int num) {
+  static const long page_size = sysconf(_SC_PAGESIZE);
+  size_t buffer_byte_size = (size_t)max_vector_size_ * vector_byte_size_;
+  // only an arena from mmap can be partly replaced
+  if (num <= 0 || num > max_vector_size_ || push_index_ != 0 ||
+      offset % page_size != 0 || buffer_byte_size < utils::kLargeArenaBytes)
+    return 1;
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    LOG(ERROR) << "open vector file error, path=" << path
+               << ", error:" << strerror(errno);
+    return 2;
+  }
+  size_t len = ((size_t)num * vector_byte_size_ + page_size - 1) / page_size *
+               page_size;
+  void *buf = mmap(buffer_, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_FIXED, fd, offset);
+  close(fd);
+  if (buf == MAP_FAILED) {
+    LOG(WARNING) << "map vector file over buffer error:" << strerror(errno);
+    // the old mapping is usually kept, eg. a hugetlb arena
+    if (msync(buffer_, len, MS_ASYNC) == 0) return 1;
+    buf = mmap(buffer_, len, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (buf == MAP_FAILED) {
+      LOG(ERROR) << "restore buffer error:" << strerror(errno);
+      return 2;
+    }
+    return 1;
+  }
+  push_index_ = num;
+  pop_index_ = num;
+  return 0;
+}
+
 template <typename DataType>
 int VectorBufferQueue<DataType>::Update(int id, DataType *v, int dim) {
   if (v == nullptr || dim != dimension_ || (uint64_t)id >= push_index_)
     return 1;
+  // the slot is reused by a newer vector
+  if (push_index_ - id > (uint64_t)max_vector_size_) return 4;
   DataType *dst_vec = buffer_ + (long)id % max_vector_size_ * dimension_;
   memcpy((void *)dst_vec, (void *)v, vector_byte_size_);
   return 0;
@@ -232,5 +332,17 @@ bool VectorBufferQueue<DataType>::WaitFor(int timeout, int type, int num) {
   return false;
 }
 
+template <typename DataType>
+void VectorBufferQueue<DataType>::WaitForPins(int chunk_id) {
+  // the epoch is increased before the pins are read and a reader pins the
+  // chunk before it reads the epoch, so either the reader gives up or the
+  // chunk is waited for
+  chunk_epochs_[chunk_id]++;
+  while (chunk_pins_[chunk_id] > 0) {
+    std::this_thread::yield();
+  }
+}
+
 template class VectorBufferQueue<float>;
-template class VectorBufferQueue<uint8_t>;
\ No newline at end of file
+template class VectorBufferQueue<uint8_t>;
+template class VectorBufferQueue<uint16_t>;
\ No newline at end of file
@@ -9,6 +9,7 @@
 #define VECTOR_BUFFER_QUEUER_H_
 
 #include <pthread.h>
+#include <atomic>
 #include <cstdint>
 #include <string>
 
@@ -81,6 +82,24 @@ class VectorBufferQueue {
   int Pop(DataType *v, int dim, int num, int timeout);  // batch pop
 
   int GetVector(int id, DataType *v, int dim);
+
+  /**
+   * get the address of vector in the ring buffer without lock and copy, its
+   * chunk is pinned and pushes wait before overwriting it until the pin is
+   * released. It fails if the vector is in the oldest chunks which will be
+   * overwritten by the next safe window pushes, so ingest isn't blocked
+   * @param id vector id
+   * @param pin(output) the pin of the chunk, the caller decreases it once
+   * the address isn't used
+   * @return the address of vector, null if it isn't in buffer or it is going
+   * to be overwritten
+   */
+  const DataType *GetVectorRef(int id, std::atomic<int> *&pin);
+
+  /**
+   * @return true if the vector of id is pushed and isn't overwritten yet
+   */
+  bool Contains(int id) const;
   /**
    * get the head address of sequential vectors begin with id
    * warning: this function is unsafe, it is only for memory only mode of
@@ -91,6 +110,18 @@ class VectorBufferQueue {
    * @return 0 success; 1 parameter error
    */
   int GetVectorHead(int id, DataType **vec_head, int dim);
+
+  /**
+   * map num vectors of file at offset over the head of an empty buffer,
+   * they are read lazily and regarded as popped. The mapping is private,
+   * updates don't go to the file.
+   * @param path vector file path
+   * @param offset byte offset of the first vector, it must be page aligned
+   * @param num the number of vectors
+   * @return 0 success; 1 parameter error or the buffer can't be remapped;
+   * 2 map error
+   */
+  int MapFile(const std::string &path, long offset, int num);
   int Update(int id, DataType *v, int dim);
   int Size() const;
   int GetPopSize() const;
@@ -99,6 +130,7 @@ class VectorBufferQueue {
 
  private:
   bool WaitFor(int timeout, int type, int num);
+  void WaitForPins(int chunk_id);
 
  private:
   DataType *buffer_;
@@ -110,6 +142,11 @@ class VectorBufferQueue {
   std::uint64_t push_index_;
   int vector_byte_size_;
   pthread_rwlock_t *shared_mutexes_;
+  // increased when a chunk starts to be overwritten, so it is the number of
+  // times the buffer wraps for the vectors in the chunk
+  std::atomic<std::uint64_t> *chunk_epochs_;
+  std::atomic<int> *chunk_pins_;  // the addresses got in each chunk
+  int safe_window_;  // pushes which a returned address can survive
   long total_mem_bytes_;
   int stored_num_;
 };
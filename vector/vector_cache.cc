@@ -0,0 +1,151 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#include "vector_cache.h"
+#include <string.h>
+#include <sstream>
+#include "log.h"
+
+namespace tig_gamma {
+
+template <typename DataType>
+VectorCache<DataType>::VectorCache(int dimension, long memory_size)
+    : dimension_(dimension), memory_size_(memory_size) {
+  shard_slots_ = 0;
+  shards_ = nullptr;
+  hits_ = 0;
+  misses_ = 0;
+  evictions_ = 0;
+}
+
+template <typename DataType>
+VectorCache<DataType>::~VectorCache() {
+  if (shards_) {
+    for (int i = 0; i < kShardNum; i++) {
+      delete[] shards_[i].data;
+    }
+    delete[] shards_;
+    shards_ = nullptr;
+  }
+}
+
+template <typename DataType>
+int VectorCache<DataType>::Init() {
+  long vector_byte_size = (long)sizeof(DataType) * dimension_;
+  if (dimension_ <= 0 || memory_size_ < vector_byte_size * kShardNum) {
+    LOG(ERROR) << "hot cache size=" << memory_size_
+               << " is too small, vector byte size=" << vector_byte_size;
+    return -1;
+  }
+  shard_slots_ = (int)(memory_size_ / vector_byte_size / kShardNum);
+  shards_ = new (std::nothrow) Shard[kShardNum];
+  if (shards_ == nullptr) return -1;
+  for (int i = 0; i < kShardNum; i++) {
+    Shard &shard = shards_[i];
+    shard.data =
+        new (std::nothrow) DataType[(size_t)shard_slots_ * dimension_];
+    if (shard.data == nullptr) {
+      LOG(ERROR) << "alloc hot cache error, slots=" << shard_slots_;
+      return -1;
+    }
+    shard.slot_vids.resize(shard_slots_, -1);
+    shard.counts.resize(shard_slots_, 0);
+    shard.slots.reserve(shard_slots_);
+  }
+  LOG(INFO) << "init hot cache success! capacity=" << GetCapacity()
+            << ", memory size=" << memory_size_;
+  return 0;
+}
+
+template <typename DataType>
+bool VectorCache<DataType>::Get(long vid, DataType *out) {
+  Shard &shard = GetShard(vid);
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.slots.find(vid);
+    if (it != shard.slots.end()) {
+      int slot = it->second;
+      if (shard.counts[slot] < kMaxCount) shard.counts[slot]++;
+      memcpy(out, shard.data + (size_t)slot * dimension_,
+             sizeof(DataType) * dimension_);
+      hits_++;
+      return true;
+    }
+  }
+  misses_++;
+  return false;
+}
+
+template <typename DataType>
+int VectorCache<DataType>::Evict(Shard &shard) {
+  // the hand sweeps at most kMaxCount + 1 rounds
+  while (true) {
+    int slot = shard.hand;
+    shard.hand = (shard.hand + 1) % shard_slots_;
+    if (shard.slot_vids[slot] == -1) return slot;
+    if (shard.counts[slot] == 0) {
+      shard.slots.erase(shard.slot_vids[slot]);
+      shard.slot_vids[slot] = -1;
+      evictions_++;
+      return slot;
+    }
+    shard.counts[slot]--;
+  }
+}
+
+template <typename DataType>
+void VectorCache<DataType>::Put(long vid, const DataType *v) {
+  Shard &shard = GetShard(vid);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  if (shard.slots.find(vid) != shard.slots.end()) return;
+  int slot = Evict(shard);
+  memcpy(shard.data + (size_t)slot * dimension_, v,
+         sizeof(DataType) * dimension_);
+  shard.slot_vids[slot] = vid;
+  shard.counts[slot] = 0;
+  shard.slots[vid] = slot;
+}
+
+template <typename DataType>
+void VectorCache<DataType>::Update(long vid, const DataType *v) {
+  Shard &shard = GetShard(vid);
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  auto it = shard.slots.find(vid);
+  if (it == shard.slots.end()) return;
+  memcpy(shard.data + (size_t)it->second * dimension_, v,
+         sizeof(DataType) * dimension_);
+}
+
+template <typename DataType>
+double VectorCache<DataType>::GetHitRate() const {
+  long hits = hits_;
+  long total = hits + misses_;
+  return total > 0 ? (double)hits / total : 0;
+}
+
+template <typename DataType>
+long VectorCache<DataType>::GetTotalMemBytes() const {
+  // data, vid, count and about two words per hash entry
+  return GetCapacity() *
+         ((long)sizeof(DataType) * dimension_ + sizeof(long) + 1 +
+          2 * sizeof(long));
+}
+
+template <typename DataType>
+std::string VectorCache<DataType>::GetStat() const {
+  std::stringstream ss;
+  ss << "capacity=" << GetCapacity() << ", hits=" << hits_
+     << ", misses=" << misses_ << ", evictions=" << evictions_
+     << ", hit rate=" << GetHitRate();
+  return ss.str();
+}
+
+template class VectorCache<float>;
+template class VectorCache<uint8_t>;
+template class VectorCache<uint16_t>;
+
+}  // namespace tig_gamma
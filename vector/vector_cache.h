@@ -0,0 +1,87 @@
+/**
+ * Copyright 2019 The Gamma Authors.
+ *
+ * This source code is licensed under the Apache License, Version 2.0 license
+ * found in the LICENSE file in the root directory of this source tree.
+ */
+
+#ifndef VECTOR_CACHE_H_
+#define VECTOR_CACHE_H_
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace tig_gamma {
+
+/** bounded cache of hot vectors in front of the disk store.
+ * Replacement is a generalized CLOCK: every slot has a small access counter
+ * which is increased on hit and decreased when the hand passes it, so
+ * vectors fetched again and again stay while one-shot reads are evicted
+ * first. The cache is split into shards by vector id, each with its own
+ * lock and hand. Hits are copied out as the slot may be reused at any time.
+ */
+template <typename DataType>
+class VectorCache {
+ public:
+  /**
+   * @param dimension    vector dimension
+   * @param memory_size  memory budget in bytes, only the vector data counts
+   */
+  VectorCache(int dimension, long memory_size);
+  ~VectorCache();
+
+  int Init();
+
+  /** copy the vector of vid to out if it is cached
+   *
+   * @return true if hit
+   */
+  bool Get(long vid, DataType *out);
+
+  /** add vector of vid, an old one is evicted if the shard is full */
+  void Put(long vid, const DataType *v);
+
+  /** overwrite the cached vector of vid, it does nothing if not cached */
+  void Update(long vid, const DataType *v);
+
+  long GetCapacity() const { return (long)shard_slots_ * kShardNum; }
+  long GetHits() const { return hits_; }
+  long GetMisses() const { return misses_; }
+  long GetEvictions() const { return evictions_; }
+  double GetHitRate() const;
+  long GetTotalMemBytes() const;
+  std::string GetStat() const;
+
+  static const int kShardNum = 16;
+  static const uint8_t kMaxCount = 3;
+
+ private:
+  struct Shard {
+    std::mutex mutex;
+    DataType *data;
+    std::vector<long> slot_vids;  // -1 if free
+    std::vector<uint8_t> counts;
+    std::unordered_map<long, int> slots;  // vid -> slot
+    int hand;
+
+    Shard() : data(nullptr), hand(0) {}
+  };
+
+  Shard &GetShard(long vid) { return shards_[vid % kShardNum]; }
+  int Evict(Shard &shard);
+
+  int dimension_;
+  long memory_size_;
+  int shard_slots_;
+  Shard *shards_;
+  std::atomic<long> hits_;
+  std::atomic<long> misses_;
+  std::atomic<long> evictions_;
+};
+
+}  // namespace tig_gamma
+
+#endif  // VECTOR_CACHE_H_
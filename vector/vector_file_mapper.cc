@@ -9,13 +9,100 @@
 #include "log.h"
 #include "utils.h"
 #include <errno.h>
+#include <stddef.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include <algorithm>
 
 namespace tig_gamma {
 
+static const char kVectorFileMagic[8] = {'G', 'A', 'M', 'M',
+                                         'A', 'F', 'E', 'T'};
+
+static uint64_t Mix(uint64_t h, uint64_t v) {
+  h ^= v;
+  h *= 0x100000001b3ULL;
+  h ^= h >> 29;
+  return h;
+}
+
+uint64_t VectorChecksum(long vid, const char *v, int len) {
+  uint64_t h = Mix(0xcbf29ce484222325ULL, (uint64_t)vid);
+  int i = 0;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, v + i, sizeof(word));
+    h = Mix(h, word);
+  }
+  for (; i < len; i++) h = Mix(h, (unsigned char)v[i]);
+  return h;
+}
+
+void VectorFileHeader::Init(int type_size, int dim) {
+  memset(this, 0, sizeof(*this));
+  memcpy(magic, kVectorFileMagic, sizeof(magic));
+  version = kVersion;
+  header_size = kHeaderSize;
+  data_type_size = type_size;
+  dimension = dim;
+  flags = kChecksumValid;
+}
+
+bool VectorFileHeader::IsValid() const {
+  if (memcmp(magic, kVectorFileMagic, sizeof(magic))) return false;
+  uint64_t checksum = VectorChecksum(
+      -1, (const char *)this, offsetof(VectorFileHeader, header_checksum));
+  return checksum == header_checksum;
+}
+
+void VectorFileHeader::Seal() {
+  header_checksum = VectorChecksum(-1, (const char *)this,
+                                   offsetof(VectorFileHeader, header_checksum));
+}
+
+int ReadVectorFileHeader(const std::string &path, VectorFileHeader &header) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd == -1) {
+    LOG(ERROR) << "open vector file error, path=" << path
+               << ", error:" << strerror(errno);
+    return -1;
+  }
+  ssize_t ret = pread(fd, &header, sizeof(header), 0);
+  close(fd);
+  if (ret < 0) {
+    LOG(ERROR) << "read vector file header error, path=" << path
+               << ", error:" << strerror(errno);
+    return -1;
+  }
+  if (ret < (ssize_t)sizeof(header) ||
+      memcmp(header.magic, kVectorFileMagic, sizeof(header.magic))) {
+    return 1;
+  }
+  if (!header.IsValid() || header.version > VectorFileHeader::kVersion ||
+      header.header_size % sysconf(_SC_PAGESIZE) != 0) {
+    LOG(ERROR) << "invalid vector file header, path=" << path
+               << ", version=" << header.version
+               << ", header size=" << header.header_size;
+    return -1;
+  }
+  return 0;
+}
+
+int WriteVectorFileHeader(int fd, VectorFileHeader &header) {
+  header.Seal();
+  std::vector<char> buf(header.header_size, 0);
+  memcpy(buf.data(), &header, sizeof(header));
+  ssize_t ret = pwrite(fd, buf.data(), buf.size(), 0);
+  if (ret != (ssize_t)buf.size()) {
+    LOG(ERROR) << "write vector file header error:" << strerror(errno);
+    return -1;
+  }
+  return 0;
+}
+
 template <typename DataType>
 VectorFileMapper<DataType>::VectorFileMapper(std::string file_path, int offset,
                                              int max_vector_size, int dimension)
@@ -81,6 +168,40 @@ const DataType *VectorFileMapper<DataType>::GetVectors() {
   return vectors_;
 }
 
+template <typename DataType>
+int VectorFileMapper<DataType>::Prefetch(std::vector<long> &ids) {
+  static const size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t vector_byte_size = sizeof(DataType) * dimension_;
+  std::sort(ids.begin(), ids.end());
+
+  int advised = 0;
+  size_t range_start = 0, range_end = 0;  // page aligned, [start, end)
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (ids[i] < 0 || ids[i] >= max_vector_size_) continue;
+    size_t begin = offset_ + (size_t)ids[i] * vector_byte_size;
+    size_t start = begin & ~(page_size - 1);
+    size_t end = (begin + vector_byte_size + page_size - 1) & ~(page_size - 1);
+    if (range_end > range_start && start <= range_end) {
+      range_end = std::max(range_end, end);
+      continue;
+    }
+    if (range_end > range_start) {
+      madvise((char *)buf_ + range_start, range_end - range_start,
+              MADV_WILLNEED);
+      ++advised;
+    }
+    range_start = start;
+    range_end = end;
+  }
+  if (range_end > range_start) {
+    madvise((char *)buf_ + range_start, range_end - range_start,
+            MADV_WILLNEED);
+    ++advised;
+  }
+  return advised;
+}
+
 template class VectorFileMapper<float>;
 template class VectorFileMapper<uint8_t>;
+template class VectorFileMapper<uint16_t>;
 }  // namespace tig_gamma
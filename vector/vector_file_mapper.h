@@ -7,11 +7,61 @@
 
 #ifndef VECTOR_FILE_MAPPER_H_
 #define VECTOR_FILE_MAPPER_H_
+#include <stdint.h>
 #include <string>
+#include <vector>
 #include <sys/mman.h>
 
 namespace tig_gamma {
 
+/** header of the .fet file. Vectors start at header_size which is page
+ * aligned, so the file can be mapped directly and every vector keeps the
+ * alignment of its offset for SIMD loads. Files written by older versions
+ * have no header, their vectors start at 0.
+ * data_checksum is the xor of VectorChecksum of the first vector_num
+ * vectors, it is maintained while vectors are appended or updated in place
+ * and written at dump.
+ */
+struct VectorFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t data_type_size;
+  uint32_t dimension;
+  uint32_t flags;
+  uint32_t reserved;
+  uint64_t vector_num;
+  uint64_t data_checksum;
+  uint64_t header_checksum;  // of the fields above
+
+  static const uint32_t kVersion = 1;
+  static const uint32_t kHeaderSize = 4096;
+  static const uint32_t kChecksumValid = 0x1;
+
+  void Init(int type_size, int dim);
+  bool IsValid() const;
+  void Seal();
+};
+
+/** checksum of one vector, it depends on the vector id so moved vectors are
+ * detected as well
+ */
+uint64_t VectorChecksum(long vid, const char *v, int len);
+
+/** read the header of vector file
+ *
+ * @return 0 if it has a valid header, 1 if it is empty or written by an older
+ * version without header, -1 if the header is broken or reading failed
+ */
+int ReadVectorFileHeader(const std::string &path, VectorFileHeader &header);
+
+/** seal and write the header at the beginning of fd, fd must not be opened
+ * with O_APPEND
+ *
+ * @return 0 if successed
+ */
+int WriteVectorFileHeader(int fd, VectorFileHeader &header);
+
 template <typename DataType>
 class VectorFileMapper {
  public:
@@ -21,6 +71,14 @@ class VectorFileMapper {
   int Init();
   const DataType *GetVector(int id);
   const DataType *GetVectors();
+
+  /** start reading the pages of vectors in background, ids are sorted and
+   * the pages of neighbouring vectors are advised in one range
+   *
+   * @param ids vector ids, the ones out of range are ignored
+   * @return the number of advised ranges
+   */
+  int Prefetch(std::vector<long> &ids);
   int GetMappedNum() const {
     return mapped_num_;
   };
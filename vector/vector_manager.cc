@@ -7,6 +7,8 @@
 
 #include "vector_manager.h"
 
+#include <stdio.h>
+
 #include "gamma_index_factory.h"
 #include "raw_vector_factory.h"
 #include "utils.h"
@@ -60,19 +62,8 @@ int VectorManager::CreateVectorTable(VectorInfo **vectors_info, int vectors_num,
     }
   }
 
-  RetrievalModel model = default_model_;
-  if (!strcasecmp("IVFPQ", retrieval_type.c_str())) {
-    model = RetrievalModel::IVFPQ;
-  } else if (!strcasecmp("GPU", retrieval_type.c_str())) {
-    model = RetrievalModel::GPU_IVFPQ;
-  } else if (!strcasecmp("BINARYIVF", retrieval_type.c_str())) {
-    model = RetrievalModel::BINARYIVF;
-  } else if (!strcasecmp("HNSW", retrieval_type.c_str())) {
-    model = RetrievalModel::HNSW;
-  } else if (!strcasecmp("FLAT", retrieval_type.c_str())) {
-    model = RetrievalModel::FLAT;
-  } else {
-    LOG(ERROR) << "NO support for retrieval type " << retrieval_type;
+  RetrievalModel table_model = default_model_;
+  if (GammaIndexFactory::ParseModel(retrieval_type, table_model)) {
     return -1;
   }
 
@@ -104,6 +95,33 @@ int VectorManager::CreateVectorTable(VectorInfo **vectors_info, int vectors_num,
                          vectors_info[i]->store_param->len);
     }
 
+    // one table can hold heterogeneous indexes, a vector field without its
+    // own retrieval type or parameters inherits the table's
+    RetrievalModel model = table_model;
+    if (vectors_info[i]->retrieval_type &&
+        vectors_info[i]->retrieval_type->len > 0) {
+      std::string field_type(vectors_info[i]->retrieval_type->value,
+                             vectors_info[i]->retrieval_type->len);
+      if (GammaIndexFactory::ParseModel(field_type, model)) {
+        return -1;
+      }
+    }
+    std::string field_param = retrieval_param;
+    if (vectors_info[i]->retrieval_param &&
+        vectors_info[i]->retrieval_param->len > 0) {
+      field_param.assign(vectors_info[i]->retrieval_param->value,
+                         vectors_info[i]->retrieval_param->len);
+    }
+    RetrievalParams *field_retrieval_param = new RetrievalParams();
+    if (field_param != "" &&
+        field_retrieval_param->Parse(field_param.c_str())) {
+      LOG(ERROR) << "parse retrieval param of " << vec_name << " error";
+      delete field_retrieval_param;
+      return -2;
+    }
+    CHECK_DELETE(field_retrieval_params_[vec_name]);
+    field_retrieval_params_[vec_name] = field_retrieval_param;
+
     if (model == RetrievalModel::BINARYIVF) {
       RawVector<uint8_t> *vec = RawVectorFactory::CreateBinary(
           store_type, vec_name, dimension / 8, max_doc_size_, root_path_,
@@ -126,7 +144,7 @@ int VectorManager::CreateVectorTable(VectorInfo **vectors_info, int vectors_num,
 
       GammaIndex *index =
           GammaIndexFactory::CreateBinary(model, dimension, docids_bitmap_, vec,
-                                          retrieval_param, gamma_counters_);
+                                          field_param, gamma_counters_);
       if (index == nullptr) {
         LOG(ERROR) << "create gamma index " << vec_name << " error!";
         return -1;
@@ -160,7 +178,7 @@ int VectorManager::CreateVectorTable(VectorInfo **vectors_info, int vectors_num,
 
       GammaIndex *index =
           GammaIndexFactory::Create(model, dimension, docids_bitmap_, vec,
-                                    retrieval_param, gamma_counters_);
+                                    field_param, gamma_counters_);
       if (index == nullptr) {
         LOG(ERROR) << "create gamma index " << vec_name << " error!";
         return -1;
@@ -277,7 +295,7 @@ int VectorManager::Search(const GammaQuery &query, GammaResult *results) {
   VectorResult all_vector_results[query.vec_num];
 
   query.condition->sort_by_docid = query.vec_num > 1 ? true : false;
-  query.condition->metric_type =
+  DistanceMetricType merge_metric =
       static_cast<DistanceMetricType>(retrieval_param_->metric_type);
   std::string vec_names[query.vec_num];
   for (int i = 0; i < query.vec_num; i++) {
@@ -312,6 +330,19 @@ int VectorManager::Search(const GammaQuery &query, GammaResult *results) {
       return -1;
     }
 
+    // every field is searched with the metric of its own index, scores of
+    // multiple fields are added, so they must have the same metric
+    query.condition->metric_type = GetMetricType(name);
+    if (i == 0) {
+      merge_metric = query.condition->metric_type;
+    } else if (query.condition->metric_type != merge_metric) {
+      LOG(ERROR) << "Query name " << name << " metric type "
+                 << query.condition->metric_type
+                 << " differs from the metric type " << merge_metric
+                 << " of " << vec_names[0]
+                 << ", scores of mixed metrics can't be merged";
+      return -1;
+    }
     query.condition->min_dist = query.vec_query[i]->min_score;
     query.condition->max_dist = query.vec_query[i]->max_score;
     int ret_vec = index->Search(query.vec_query[i], query.condition,
@@ -326,6 +357,7 @@ int VectorManager::Search(const GammaQuery &query, GammaResult *results) {
 #endif
   }
 
+  query.condition->metric_type = merge_metric;
   if (query.condition->sort_by_docid) {
     for (int i = 0; i < n; i++) {
       int start_docid = 0, common_docid_count = 0, common_idx = 0;
@@ -433,108 +465,119 @@ int VectorManager::Search(const GammaQuery &query, GammaResult *results) {
   return ret;
 }
 
+template <typename DataType>
+int VectorManager::PackVector(RawVector<DataType> *raw_vec, int docid,
+                              ByteArray *&ba) {
+  int vid = raw_vec->vid_mgr_->GetFirstVID(docid);
+
+  char *source = nullptr;
+  int len = -1;
+  int ret = raw_vec->GetSource(vid, source, len);
+  if (ret != 0 || len < 0) {
+    LOG(ERROR) << "Get source failed!";
+    return -1;
+  }
+
+  // points into the store if it is resident, otherwise a pinned copy which
+  // is released when scope_vec goes out of scope
+  ScopeVector<DataType> scope_vec;
+  raw_vec->GetVector(vid, scope_vec);
+  const DataType *feature = scope_vec.Get();
+  if (feature == nullptr) {
+    LOG(ERROR) << "Get vector failed, vid=" << vid;
+    return -1;
+  }
+
+  int d_byte = raw_vec->GetDimension() * sizeof(DataType);
+  int total = sizeof(d_byte) + d_byte + len;
+
+  // layout: [int d_byte][vector bytes][source], written once into the
+  // response buffer
+  ba = static_cast<ByteArray *>(malloc(sizeof(ByteArray)));
+  ba->value = static_cast<char *>(malloc(total));
+  ba->len = total;
+
+  char *cur = ba->value;
+  memcpy(cur, &d_byte, sizeof(d_byte));
+  cur += sizeof(d_byte);
+  memcpy(cur, feature, d_byte);
+  cur += d_byte;
+  if (len > 0) memcpy(cur, source, len);
+  return 0;
+}
+
+template <typename DataType>
+int VectorManager::FormatVector(RawVector<DataType> *raw_vec, int docid,
+                                string &str_vec) {
+  int vid = raw_vec->vid_mgr_->GetFirstVID(docid);
+  ScopeVector<DataType> scope_vec;
+  raw_vec->GetVector(vid, scope_vec);
+  const DataType *feature = scope_vec.Get();
+  if (feature == nullptr) {
+    LOG(ERROR) << "Get vector failed, vid=" << vid;
+    return -1;
+  }
+
+  int d = raw_vec->GetDimension();
+  str_vec.reserve(d * 10);
+  for (int i = 0; i < d; ++i) {
+    // binary vectors are integers
+    utils::append(str_vec, feature[i], ',');
+  }
+  if (!str_vec.empty()) str_vec.pop_back();
+  return 0;
+}
+
 int VectorManager::GetVector(
     const std::vector<std::pair<string, int>> &fields_ids,
-    std::vector<string> &vec, bool is_bytearray) {
+    std::vector<ByteArray *> &vec) {
   for (const auto &pair : fields_ids) {
-    const string &field = pair.first;
-    const int id = pair.second;
     std::map<std::string, GammaIndex *>::iterator iter =
-        vector_indexes_.find(field);
+        vector_indexes_.find(pair.first);
     if (iter == vector_indexes_.end()) {
       continue;
     }
     GammaIndex *gamma_index = iter->second;
+    ByteArray *ba = nullptr;
+    int ret = -1;
     if (gamma_index->raw_vec_ != nullptr) {
-      RawVector<float> *raw_vec = gamma_index->raw_vec_;
-      if (raw_vec == nullptr) {
-        LOG(ERROR) << "raw_vec is null!";
-        return -1;
-      }
-      int vid = raw_vec->vid_mgr_->GetFirstVID(id);
-
-      char *source = nullptr;
-      int len = -1;
-      int ret = raw_vec->GetSource(vid, source, len);
-
-      if (ret != 0 || len < 0) {
-        LOG(ERROR) << "Get source failed!";
-        return -1;
-      }
-
-      ScopeVector<float> scope_vec;
-      raw_vec->GetVector(vid, scope_vec);
-      const float *feature = scope_vec.Get();
-      string str_vec;
-      if (is_bytearray) {
-        int d = raw_vec->GetDimension();
-        int d_byte = d * sizeof(float);
-
-        char feat_source[sizeof(d) + d_byte + len];
-
-        memcpy((void *)feat_source, &d_byte, sizeof(int));
-        int cur = sizeof(d_byte);
-
-        memcpy((void *)(feat_source + cur), feature, d_byte);
-        cur += d_byte;
-
-        memcpy((void *)(feat_source + cur), source, len);
-
-        str_vec =
-            string((char *)feat_source, sizeof(unsigned int) + d_byte + len);
-      } else {
-        for (int i = 0; i < raw_vec->GetDimension(); ++i) {
-          str_vec += std::to_string(feature[i]) + ",";
-        }
-        str_vec.pop_back();
-      }
-      vec.emplace_back(std::move(str_vec));
+      ret = PackVector(gamma_index->raw_vec_, pair.second, ba);
+    } else if (gamma_index->raw_vec_binary_ != nullptr) {
+      ret = PackVector(gamma_index->raw_vec_binary_, pair.second, ba);
     } else {
-      RawVector<uint8_t> *raw_vec = gamma_index->raw_vec_binary_;
-      if (raw_vec == nullptr) {
-        LOG(ERROR) << "raw_vec is null!";
-        return -1;
-      }
-
-      int vid = raw_vec->vid_mgr_->GetFirstVID(id);
-
-      char *source = nullptr;
-      int len = -1;
-      int ret = raw_vec->GetSource(vid, source, len);
-
-      if (ret != 0 || len < 0) {
-        LOG(ERROR) << "Get source failed!";
-        return -1;
-      }
-
-      ScopeVector<uint8_t> scope_vec;
-      raw_vec->GetVector(vid, scope_vec);
-      const uint8_t *feature = scope_vec.Get();
-      string str_vec;
-      if (is_bytearray) {
-        int d = raw_vec->GetDimension();
-        int d_byte = d * sizeof(uint8_t);
-
-        char feat_source[sizeof(d) + d_byte + len];
-
-        memcpy((void *)feat_source, &d_byte, sizeof(int));
-        int cur = sizeof(d_byte);
-
-        memcpy((void *)(feat_source + cur), feature, d_byte);
-        cur += d_byte;
-
-        memcpy((void *)(feat_source + cur), source, len);
+      LOG(ERROR) << "raw_vec is null!";
+    }
+    if (ret != 0) {
+      for (ByteArray *packed : vec) DestroyByteArray(packed);
+      vec.clear();
+      return -1;
+    }
+    vec.push_back(ba);
+  }
+  return 0;
+}
 
-        str_vec =
-            string((char *)feat_source, sizeof(unsigned int) + d_byte + len);
-      } else {
-        for (int i = 0; i < raw_vec->GetDimension(); ++i) {
-          str_vec += std::to_string(feature[i]) + ",";
-        }
-        str_vec.pop_back();
-      }
-      vec.emplace_back(std::move(str_vec));
+int VectorManager::GetVectorText(
+    const std::vector<std::pair<string, int>> &fields_ids,
+    std::vector<string> &vec) {
+  for (const auto &pair : fields_ids) {
+    std::map<std::string, GammaIndex *>::iterator iter =
+        vector_indexes_.find(pair.first);
+    if (iter == vector_indexes_.end()) {
+      continue;
     }
+    GammaIndex *gamma_index = iter->second;
+    string str_vec;
+    int ret = -1;
+    if (gamma_index->raw_vec_ != nullptr) {
+      ret = FormatVector(gamma_index->raw_vec_, pair.second, str_vec);
+    } else if (gamma_index->raw_vec_binary_ != nullptr) {
+      ret = FormatVector(gamma_index->raw_vec_binary_, pair.second, str_vec);
+    } else {
+      LOG(ERROR) << "raw_vec is null!";
+    }
+    if (ret != 0) return -1;
+    vec.emplace_back(std::move(str_vec));
   }
   return 0;
 }
@@ -646,6 +689,11 @@ void VectorManager::Close() {
   vector_indexes_.clear();
   LOG(INFO) << "Vector indexes cleared.";
 
+  for (auto &iter : field_retrieval_params_) {
+    CHECK_DELETE(iter.second);
+  }
+  field_retrieval_params_.clear();
+
   if (retrieval_param_ != nullptr) {
     delete retrieval_param_;
     retrieval_param_ = nullptr;
@@ -40,8 +40,23 @@ class VectorManager {
   // int Add(int docid, const std::vector<Field *> &field_vecs);
   int Search(const GammaQuery &query, GammaResult *results);
 
+  /** get vectors packed as [int d_byte][vector bytes][source], each one is
+   * written straight into a new ByteArray which the caller owns
+   *
+   * @param fields_ids (vector name, docid) pairs
+   * @param vec(output) packed vectors, destroy with DestroyByteArray
+   * @return 0 if successed
+   */
   int GetVector(const std::vector<std::pair<std::string, int>> &fields_ids,
-                std::vector<std::string> &vec, bool is_bytearray = false);
+                std::vector<ByteArray *> &vec);
+
+  /** get vectors formatted as comma separated text, only for callers which
+   * explicitly need the text form
+   *
+   * @return 0 if successed
+   */
+  int GetVectorText(const std::vector<std::pair<std::string, int>> &fields_ids,
+                    std::vector<std::string> &vec);
 
   long GetTotalMemBytes() {
     long index_total_mem_bytes = 0;
@@ -80,13 +95,30 @@ class VectorManager {
  private:
   void Close();  // release all resource
 
+  DistanceMetricType GetMetricType(const std::string &name) const {
+    const auto &it = field_retrieval_params_.find(name);
+    if (it == field_retrieval_params_.end() || it->second == nullptr) {
+      return retrieval_param_->metric_type;
+    }
+    return it->second->metric_type;
+  }
+
+  template <typename DataType>
+  int PackVector(RawVector<DataType> *raw_vec, int docid, ByteArray *&ba);
+
+  template <typename DataType>
+  int FormatVector(RawVector<DataType> *raw_vec, int docid,
+                   std::string &str_vec);
+
  private:
   RetrievalModel default_model_;
   VectorStorageType default_store_type_;
   const char *docids_bitmap_;
   int max_doc_size_;
   bool table_created_;
-  RetrievalParams *retrieval_param_;
+  RetrievalParams *retrieval_param_;  // table level retrieval parameters
+  // retrieval parameters of each vector field, see VectorInfo
+  std::map<std::string, RetrievalParams *> field_retrieval_params_;
   std::string root_path_;
   GammaCounters *gamma_counters_;
 